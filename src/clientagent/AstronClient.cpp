@@ -26,6 +26,10 @@ static ConfigVariable<bool> send_version_to_client("send_version", true, astronc
 static ConfigVariable<uint64_t> write_buffer_size("write_buffer_size", 256 * 1024,
         astronclient_config);
 static ConfigVariable<unsigned int> write_timeout_ms("write_timeout_ms", 5000, astronclient_config);
+static ConfigVariable<bool> write_cork("write_cork", true, astronclient_config);
+static ConfigVariable<unsigned int> write_cork_delay_ms("write_cork_delay_ms", 0, astronclient_config);
+static ConfigVariable<unsigned int> write_cork_bytes("write_cork_bytes", 1400, astronclient_config);
+static BooleanValueConstraint write_cork_is_boolean(write_cork);
 
 //by default, have heartbeat disabled.
 static ConfigVariable<long> heartbeat_timeout_config("heartbeat_timeout", 0, astronclient_config);
@@ -58,6 +62,41 @@ class AstronClient : public Client, public NetworkHandler
     long m_heartbeat_timeout;
     Timeout* m_heartbeat_timer = nullptr;
 
+    // Datagrams held back from the client while sends are held; see hold_sends.
+    std::vector<OutgoingDatagram> m_held_sends;
+    unsigned int m_send_holds = 0;
+
+    // send_to_client sends a datagram to the client, or holds it back if sends are held.
+    inline void send_to_client(DatagramHandle dg)
+    {
+        if(m_send_holds > 0) {
+            m_held_sends.emplace_back(dg);
+        } else {
+            m_client->send_datagram(dg);
+        }
+    }
+
+    // send_to_client(header, body) sends header followed by the rest of body from body_offset.
+    //     The body is shared rather than copied, so an update broadcast to a crowd of clients
+    //     only costs each of them a few bytes of header.
+    inline void send_to_client(DatagramHandle header, DatagramHandle body, dgsize_t body_offset)
+    {
+        if(m_send_holds > 0) {
+            m_held_sends.emplace_back(header, body, body_offset);
+        } else {
+            m_client->send_datagram(header, body, body_offset);
+        }
+    }
+
+    // flush_held_sends sends everything held back so far in a single write.
+    void flush_held_sends()
+    {
+        if(!m_held_sends.empty()) {
+            m_client->send_datagrams(m_held_sends);
+            m_held_sends.clear();
+        }
+    }
+
   public:
     AstronClient(ConfigNode config, ClientAgent* client_agent, const std::shared_ptr<uvw::TcpHandle> &socket,
                  const uvw::Addr &remote, const uvw::Addr &local, const bool haproxy_mode) :
@@ -88,6 +127,12 @@ class AstronClient : public Client, public NetworkHandler
         // Set NetworkClient configuration.
         m_client->set_write_timeout(write_timeout_ms.get_rval(m_config));
         m_client->set_write_buffer(write_buffer_size.get_rval(m_config));
+
+        FlushPolicy flush_policy;
+        flush_policy.cork = write_cork.get_rval(m_config);
+        flush_policy.max_delay = write_cork_delay_ms.get_rval(m_config);
+        flush_policy.min_bytes = write_cork_bytes.get_rval(m_config);
+        m_client->set_flush_policy(flush_policy);
     }
 
     void heartbeat_timeout()
@@ -150,7 +195,8 @@ class AstronClient : public Client, public NetworkHandler
             resp->add_uint16(CLIENT_EJECT);
             resp->add_uint16(reason);
             resp->add_string(error_string);
-            m_client->send_datagram(resp);
+            send_to_client(resp);
+            flush_held_sends();
 
             m_clean_disconnect = true;
             m_client->disconnect();
@@ -238,13 +284,29 @@ class AstronClient : public Client, public NetworkHandler
     // Handler for CLIENTAGENT_SEND_DATAGRAM.
     virtual void forward_datagram(DatagramHandle dg)
     {
-        m_client->send_datagram(dg);
+        send_to_client(dg);
+    }
+
+    // hold_sends queues the datagrams sent to the client until the matching release_sends.
+    virtual void hold_sends()
+    {
+        ++m_send_holds;
+    }
+
+    // release_sends sends the held datagrams once the outermost hold is released.
+    virtual void release_sends()
+    {
+        if(--m_send_holds == 0) {
+            flush_held_sends();
+        }
     }
 
     // handle_drop should immediately disconnect the client without sending any more data.
     // Handler for CLIENTAGENT_DROP.
     virtual void handle_drop()
     {
+        // Whatever was sent before the drop still goes out.
+        flush_held_sends();
         m_clean_disconnect = true;
         m_client->disconnect();
     }
@@ -265,7 +327,7 @@ class AstronClient : public Client, public NetworkHandler
         for(auto it = i.zones.begin(); it != i.zones.end(); ++it) {
             resp->add_zone(*it);
         }
-        m_client->send_datagram(resp);
+        send_to_client(resp);
     }
 
     // handle_remove_interest should inform the client an interest was removed by the server.
@@ -275,7 +337,7 @@ class AstronClient : public Client, public NetworkHandler
         resp->add_uint16(CLIENT_REMOVE_INTEREST);
         resp->add_uint32(context);
         resp->add_uint16(interest_id);
-        m_client->send_datagram(resp);
+        send_to_client(resp);
     }
 
     // handle_add_object should inform the client of a new object. The datagram iterator
@@ -284,13 +346,14 @@ class AstronClient : public Client, public NetworkHandler
     virtual void handle_add_object(doid_t do_id, doid_t parent_id, zone_t zone_id, uint16_t dc_id,
                                    DatagramIterator &dgi, bool other)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t)
+                           + sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t) + dgi.get_remaining());
         resp->add_uint16(other ? CLIENT_ENTER_OBJECT_REQUIRED_OTHER : CLIENT_ENTER_OBJECT_REQUIRED);
         resp->add_doid(do_id);
         resp->add_location(parent_id, zone_id);
         resp->add_uint16(dc_id);
-        resp->add_data(dgi.read_remainder());
-        m_client->send_datagram(resp);
+        dgi.copy_remainder(resp);
+        send_to_client(resp);
     }
 
     // handle_add_ownership should inform the client it has control of a new object. The datagram
@@ -299,36 +362,37 @@ class AstronClient : public Client, public NetworkHandler
     virtual void handle_add_ownership(doid_t do_id, doid_t parent_id, zone_t zone_id, uint16_t dc_id,
                                       DatagramIterator &dgi, bool other)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t)
+                           + sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t) + dgi.get_remaining());
         resp->add_uint16(other ? CLIENT_ENTER_OBJECT_REQUIRED_OTHER_OWNER
                          : CLIENT_ENTER_OBJECT_REQUIRED_OWNER);
         resp->add_doid(do_id);
         resp->add_location(parent_id, zone_id);
         resp->add_uint16(dc_id);
-        resp->add_data(dgi.read_remainder());
-        m_client->send_datagram(resp);
+        dgi.copy_remainder(resp);
+        send_to_client(resp);
     }
 
     // handle_set_field should inform the client that the field has been updated.
     virtual void handle_set_field(doid_t do_id, uint16_t field_id, DatagramIterator &dgi)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t)
+                           + sizeof(uint16_t));
         resp->add_uint16(CLIENT_OBJECT_SET_FIELD);
         resp->add_doid(do_id);
         resp->add_uint16(field_id);
-        resp->add_data(dgi.read_remainder());
-        m_client->send_datagram(resp);
+        send_to_client(resp, dgi.get_datagram(), dgi.tell());
     }
 
     // handle_set_fields should inform the client that a group of fields has been updated.
     virtual void handle_set_fields(doid_t do_id, uint16_t num_fields, DatagramIterator &dgi)
     {
-        DatagramPtr resp = Datagram::create();
+        DatagramPtr resp = Datagram::create_with_capacity(sizeof(uint16_t) + sizeof(doid_t)
+                           + sizeof(uint16_t));
         resp->add_uint16(CLIENT_OBJECT_SET_FIELDS);
         resp->add_doid(do_id);
         resp->add_uint16(num_fields);
-        resp->add_data(dgi.read_remainder());
-        m_client->send_datagram(resp);
+        send_to_client(resp, dgi.get_datagram(), dgi.tell());
     }
 
     // handle_change_location should inform the client that the objects location has changed.
@@ -338,7 +402,7 @@ class AstronClient : public Client, public NetworkHandler
         resp->add_uint16(CLIENT_OBJECT_LOCATION);
         resp->add_doid(do_id);
         resp->add_location(new_parent, new_zone);
-        m_client->send_datagram(resp);
+        send_to_client(resp);
     }
 
     // handle_remove_object should send a mesage to remove the object from the connected client.
@@ -349,7 +413,7 @@ class AstronClient : public Client, public NetworkHandler
         DatagramPtr resp = Datagram::create();
         resp->add_uint16(CLIENT_OBJECT_LEAVING);
         resp->add_doid(do_id);
-        m_client->send_datagram(resp);
+        send_to_client(resp);
     }
 
     // handle_remove_ownership should notify the client it no has control of the object.
@@ -359,7 +423,7 @@ class AstronClient : public Client, public NetworkHandler
         DatagramPtr resp = Datagram::create();
         resp->add_uint16(CLIENT_OBJECT_LEAVING_OWNER);
         resp->add_doid(do_id);
-        m_client->send_datagram(resp);
+        send_to_client(resp);
     }
 
     // handle_interest_done is called when all of the objects from an opened interest have been
@@ -370,7 +434,7 @@ class AstronClient : public Client, public NetworkHandler
         resp->add_uint16(CLIENT_DONE_INTEREST_RESP);
         resp->add_uint32(context);
         resp->add_uint16(interest_id);
-        m_client->send_datagram(resp);
+        send_to_client(resp);
     }
 
     // Client has just connected and should only send "CLIENT_HELLO"
@@ -414,7 +478,7 @@ class AstronClient : public Client, public NetworkHandler
 
         DatagramPtr resp = Datagram::create();
         resp->add_uint16(CLIENT_HELLO_RESP);
-        m_client->send_datagram(resp);
+        send_to_client(resp);
 
         m_state = CLIENT_STATE_ANONYMOUS;
     }
@@ -576,7 +640,8 @@ class AstronClient : public Client, public NetworkHandler
 
         // If an exception occurs while packing data it will be handled by
         // receive_datagram and the client will be dc'd with "oversized datagram".
-        DatagramPtr resp = Datagram::create();
+        DatagramPtr resp = Datagram::create_with_capacity(Datagram::server_header_size()
+                           + sizeof(doid_t) + sizeof(uint16_t) + data.size());
         resp->add_server_header(do_id, m_channel, STATESERVER_OBJECT_SET_FIELD);
         resp->add_doid(do_id);
         resp->add_uint16(field_id);
@@ -7,9 +7,10 @@ using namespace std;
 using dclass::Class;
 
 Client::Client(ConfigNode, ClientAgent* client_agent) :
-    m_client_agent(client_agent)
+    m_client_agent(client_agent), m_io_loop(&IoLoop::current())
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    // Clients are created by the loop (main or I/O thread) their connection was accepted onto.
+    assert(m_io_loop->in_thread());
 
     m_channel = m_client_agent->m_ct.alloc_channel();
     if(!m_channel) {
@@ -92,8 +93,8 @@ void Client::generate_timeout(TimeoutSetCallback timeout_set_callback)
         m_pending_timeouts.push(timeout_set_callback);
     }
 
-    if(std::this_thread::get_id() != g_main_thread_id) {
-        TaskQueue::singleton.enqueue_task([self = this]() {
+    if(!m_io_loop->in_thread()) {
+        m_io_loop->tasks().enqueue_task([self = this]() {
             self->generate_timeouts();
         });
     } else {
@@ -103,7 +104,7 @@ void Client::generate_timeout(TimeoutSetCallback timeout_set_callback)
 
 void Client::generate_timeouts()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_io_loop->in_thread());
 
     if(m_is_generating_timeouts) {
         // Already in the middle of another generate_timeouts invocation.
@@ -250,7 +251,9 @@ void Client::add_interest(Interest &i, uint32_t context, channel_t caller)
             i.id, context, request_context, i.parent, new_zones, caller);
     m_pending_interests.emplace(request_context, iop);
 
-    DatagramPtr resp = Datagram::create();
+    DatagramPtr resp = Datagram::create_with_capacity(Datagram::server_header_size()
+                       + sizeof(uint32_t) + sizeof(doid_t) + sizeof(uint16_t)
+                       + sizeof(zone_t) * new_zones.size());
     resp->add_server_header(i.parent, m_channel, STATESERVER_OBJECT_GET_ZONES_OBJECTS);
     resp->add_uint32(request_context);
     resp->add_doid(i.parent);
@@ -346,6 +349,18 @@ void Client::send_disconnect(uint16_t reason, const string &error_string, bool s
     log_event(event);
 }
 
+// handle_datagrams is the handler for bursts of datagrams received from the Astron cluster
+void Client::handle_datagrams(DatagramSpan dgs)
+{
+    lock_guard<recursive_mutex> lock(m_client_lock);
+    SendHold hold(this);
+    for(const auto& dg : dgs) {
+        DatagramIterator dgi(dg);
+        dgi.seek_payload();
+        handle_datagram(dg, dgi);
+    }
+}
+
 // handle_datagram is the handler for datagrams received from the Astron cluster
 void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
 {
@@ -414,9 +429,7 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
     }
     break;
     case CLIENTAGENT_SEND_DATAGRAM: {
-        DatagramPtr forward = Datagram::create();
-        forward->add_data(dgi.read_datagram());
-        forward_datagram(forward);
+        forward_datagram(dgi.read_datagram());
     }
     break;
     case CLIENTAGENT_OPEN_CHANNEL: {
@@ -592,10 +605,12 @@ void Client::handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi)
     break;
     case STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED_OTHER:
     case STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED: {
-        doid_t do_id = dgi.read_doid();
-        doid_t parent = dgi.read_doid();
-        zone_t zone = dgi.read_zone();
-        uint16_t dc_id = dgi.read_uint16();
+        DatagramRegion header = dgi.read_region(sizeof(doid_t) * 2 + sizeof(zone_t)
+                                                + sizeof(uint16_t));
+        doid_t do_id = header.read_doid();
+        doid_t parent = header.read_doid();
+        zone_t zone = header.read_zone();
+        uint16_t dc_id = header.read_uint16();
 
         if (m_owned_objects.find(do_id) == m_owned_objects.end())
         {
@@ -804,10 +819,11 @@ bool Client::try_queue_pending(doid_t do_id, DatagramHandle dg)
 
 void Client::handle_object_entrance(DatagramIterator &dgi, bool other)
 {
-    doid_t do_id = dgi.read_doid();
-    doid_t parent = dgi.read_doid();
-    zone_t zone = dgi.read_zone();
-    uint16_t dc_id = dgi.read_uint16();
+    DatagramRegion header = dgi.read_region(sizeof(doid_t) * 2 + sizeof(zone_t) + sizeof(uint16_t));
+    doid_t do_id = header.read_doid();
+    doid_t parent = header.read_doid();
+    zone_t zone = header.read_zone();
+    uint16_t dc_id = header.read_uint16();
 
     // this object is no longer pending
     m_pending_objects.erase(do_id);
@@ -888,7 +904,7 @@ InterestOperation::~InterestOperation()
 
 void InterestOperation::on_timeout_generate(Timeout* timeout)
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_client->m_io_loop->in_thread());
 
     m_timeout = timeout;
     m_timeout->initialize(m_timeout_interval, bind(&InterestOperation::timeout, this));
@@ -915,6 +931,9 @@ void InterestOperation::finish(bool is_timeout)
         m_timeout = nullptr;
     }
 
+    // Everything the interest delivers goes out to the client in one write.
+    Client::SendHold hold(m_client);
+
     // Send objects in the initial snapshot
     for(const auto& it : m_pending_generates) {
         DatagramIterator dgi(it);
@@ -941,11 +960,7 @@ void InterestOperation::finish(bool is_timeout)
     m_client->m_pending_interests.erase(m_request_context);
 
     // Dispatch other received and queued messages
-    for(const auto& it : dispatch) {
-        DatagramIterator dgi(it);
-        dgi.seek_payload();
-        m_client->handle_datagram(it, dgi);
-    }
+    m_client->handle_datagrams(DatagramSpan(dispatch));
 
     m_finished = true;
 
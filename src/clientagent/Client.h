@@ -103,6 +103,14 @@ class Client : public MDParticipantInterface
 
     // handle_datagram is the handler for datagrams received from the server
     void handle_datagram(DatagramHandle dg, DatagramIterator &dgi);
+    // handle_datagrams handles a burst of datagrams from the server, holding back
+    //     everything sent to the client until the whole burst has been handled.
+    void handle_datagrams(DatagramSpan dgs);
+
+    virtual IoLoop *get_io_loop()
+    {
+        return m_io_loop;
+    }
 
   protected:
     std::recursive_mutex m_client_lock;     // The lock guarding the client.
@@ -146,6 +154,7 @@ class Client : public MDParticipantInterface
 
     std::mutex m_timeout_mutex;
     std::queue<TimeoutSetCallback> m_pending_timeouts;
+    IoLoop *m_io_loop; // The loop the client was accepted onto, which its timeouts run on.
 
     Client(ConfigNode config, ClientAgent* client_agent);
 
@@ -206,6 +215,37 @@ class Client : public MDParticipantInterface
     // Handler for CLIENTAGENT_SEND_DATAGRAM.
     virtual void forward_datagram(DatagramHandle dg) = 0;
 
+    // hold_sends should queue the datagrams sent to the connected client until the matching
+    // call to release_sends, so that a burst of them goes out in a single write.
+    // Holds may be nested; the queue is only sent when the outermost hold is released.
+    virtual void hold_sends()
+    {
+    }
+    virtual void release_sends()
+    {
+    }
+
+    // A SendHold holds the client's sends for as long as it's in scope, so they're released
+    // even when handling a datagram throws.
+    class SendHold
+    {
+      public:
+        SendHold(Client *client) : m_client(client)
+        {
+            m_client->hold_sends();
+        }
+        ~SendHold()
+        {
+            m_client->release_sends();
+        }
+
+        SendHold(const SendHold&) = delete;
+        SendHold& operator=(const SendHold&) = delete;
+
+      private:
+        Client *m_client;
+    };
+
     // handle_drop should immediately disconnect the client without sending any more data.
     // Handler for CLIENTAGENT_DROP.
     virtual void handle_drop() = 0;
@@ -13,6 +13,7 @@ RoleConfigGroup clientagent_config("clientagent");
 static ConfigVariable<string> bind_addr("bind", "0.0.0.0:7198", clientagent_config);
 static ConfigVariable<string> server_version("version", "dev", clientagent_config);
 static ConfigVariable<bool> behind_haproxy("haproxy", false, clientagent_config);
+static ConfigVariable<unsigned int> listeners("listeners", 1, clientagent_config);
 static ConfigVariable<uint32_t> override_hash("manual_dc_hash", 0x0, clientagent_config);
 static ValidAddressConstraint valid_bind_addr(bind_addr);
 
@@ -37,7 +38,9 @@ static ConfigGroup tuning_config("tuning", clientagent_config);
 static ConfigVariable<unsigned long> interest_timeout("interest_timeout", 500, tuning_config);
 
 ClientAgent::ClientAgent(RoleConfig roleconfig) : Role(roleconfig), m_net_acceptor(nullptr),
-    m_server_version(server_version.get_rval(roleconfig))
+    m_server_version(server_version.get_rval(roleconfig)),
+    m_ct(min_channel.get_rval(clientagent_config.get_child_node(channels_config, roleconfig)),
+         max_channel.get_rval(clientagent_config.get_child_node(channels_config, roleconfig)))
 {
 
     stringstream ss;
@@ -48,10 +51,6 @@ ClientAgent::ClientAgent(RoleConfig roleconfig) : Role(roleconfig), m_net_accept
     ConfigNode client = clientagent_config.get_child_node(ca_client_config, roleconfig);
     m_client_type = ca_client_type.get_rval(client);
 
-    // ... and also the channel range ...
-    ConfigNode channels = clientagent_config.get_child_node(channels_config, roleconfig);
-    m_ct = ChannelTracker(min_channel.get_rval(channels), max_channel.get_rval(channels));
-
     // ... then store a copy of the client config.
     m_clientconfig = clientagent_config.get_child_node(ca_client_config, roleconfig);
 
@@ -78,6 +77,7 @@ ClientAgent::ClientAgent(RoleConfig roleconfig) : Role(roleconfig), m_net_accept
     m_net_acceptor = std::unique_ptr<TcpAcceptor>(new TcpAcceptor(callback, err_callback));
 
     m_net_acceptor->set_haproxy_mode(behind_haproxy.get_rval(m_roleconfig));
+    m_net_acceptor->set_listeners(listeners.get_rval(m_roleconfig));
 
     // Begin listening for new Clients
     m_net_acceptor->bind(bind_addr.get_rval(m_roleconfig), 7198);
@@ -124,6 +124,8 @@ ChannelTracker::ChannelTracker(channel_t min, channel_t max) : m_next(min), m_ma
 
 channel_t ChannelTracker::alloc_channel()
 {
+    std::lock_guard<std::mutex> lock(m_lock);
+
     if(m_next <= m_max) {
         return m_next++;
     } else {
@@ -138,5 +140,6 @@ channel_t ChannelTracker::alloc_channel()
 
 void ChannelTracker::free_channel(channel_t channel)
 {
+    std::lock_guard<std::mutex> lock(m_lock);
     m_unused_channels.push(channel);
 }
@@ -23,6 +23,7 @@ class ChannelTracker
     channel_t m_next;
     channel_t m_max;
     std::queue<channel_t> m_unused_channels;
+    std::mutex m_lock; // Clients may be destroyed on any of the MessageDirector's threads.
 };
 
 class ClientAgent final : public Role
@@ -193,6 +193,13 @@ class LogCategory
     // debug() provides a stream with the time and "DEBUG" severity preprended to the message.
     // trace messages are only output when compiled with -DASTRON_DEBUG_MESSAGES.
     F(debug, LSEVERITY_DEBUG)
+
+    // trace_enabled returns true if trace messages are being output, so callers can skip
+    // building expensive trace messages which would just be thrown away.
+    inline bool trace_enabled()
+    {
+        return g_logger->get_min_severity() <= LSEVERITY_TRACE;
+    }
 #else
     // packet() provides a stream with the time and "PACKET" severity preprended to the message.
     // packet messages are only output when compiled with -DASTRON_DEBUG_MESSAGES.
@@ -212,6 +219,12 @@ class LogCategory
     {
         return null_stream;
     }
+    // trace_enabled returns true if trace messages are being output, so callers can skip
+    // building expensive trace messages which would just be thrown away.
+    inline bool trace_enabled()
+    {
+        return false;
+    }
 
 #endif
     // info() provides a stream with the time and "INFO" severity preprended to the message.
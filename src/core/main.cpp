@@ -15,6 +15,7 @@ using dclass::Class;
 #include <pthread.h> // for setting thread-local storage size
 #endif
 #include "util/TaskQueue.h"
+#include "util/IoLoop.h"
 #include "util/filesystem.h"
 
 using namespace std;
@@ -25,6 +26,7 @@ static ConfigGroup general_config("general");
 static ConfigVariable<vector<string> > dc_files("dc_files", vector<string>(), general_config);
 static ConfigVariable<string> eventlogger_addr("eventlogger", "", general_config);
 static ValidAddressConstraint valid_eventlogger_addr(eventlogger_addr);
+static ConfigVariable<unsigned int> io_threads("io_threads", 0, general_config);
 
 static ConfigList uberdogs_config("uberdogs");
 static ConfigVariable<doid_t> uberdog_id("id", INVALID_DO_ID, uberdogs_config);
@@ -217,6 +219,7 @@ int main(int argc, char *argv[])
 
     try {
         TaskQueue::singleton.init_queue();
+        IoLoop::start_threads(io_threads.get_val());
         // Initialize configured MessageDirector
         MessageDirector::singleton.init_network();
         g_eventsender.init(eventlogger_addr.get_val());
@@ -34,6 +34,7 @@ enum MessageTypes {
     CONTROL_REMOVE_CHANNEL     = 9001,
     CONTROL_ADD_RANGE          = 9002,
     CONTROL_REMOVE_RANGE       = 9003,
+    CONTROL_SUBSCRIPTION_BATCH = 9004,
     CONTROL_ADD_POST_REMOVE    = 9010,
     CONTROL_CLEAR_POST_REMOVES = 9011,
     CONTROL_SET_CON_NAME       = 9012,
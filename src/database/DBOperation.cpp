@@ -8,6 +8,16 @@ using namespace std;
 using dclass::Field;
 using dclass::Class;
 
+// field_values_size returns the size of a list of {uint16 field_id, value} pairs.
+static size_t field_values_size(const FieldValues &fields)
+{
+    size_t size = 0;
+    for(const auto& it : fields) {
+        size += sizeof(uint16_t) + it.second.size();
+    }
+    return size;
+}
+
 void DBOperation::cleanup()
 {
     m_dbserver->clear_operation(this);
@@ -30,7 +40,8 @@ void DBOperation::announce_fields(const FieldValues& fields)
     // Send delete fields broadcast
     if(!deleted_fields.empty()) {
         bool multi = (deleted_fields.size() > 1);
-        DatagramPtr update = Datagram::create();
+        DatagramPtr update = Datagram::create_with_capacity(Datagram::server_header_size()
+                             + sizeof(doid_t) + sizeof(uint16_t) * (deleted_fields.size() + 1));
         update->add_server_header(database_to_object(m_doid), m_sender,
                                   multi ? DBSERVER_OBJECT_DELETE_FIELDS :
                                   DBSERVER_OBJECT_DELETE_FIELD);
@@ -47,7 +58,8 @@ void DBOperation::announce_fields(const FieldValues& fields)
     // Send update fields broadcast
     if(!changed_fields.empty()) {
         bool multi = (changed_fields.size() > 1);
-        DatagramPtr update = Datagram::create();
+        DatagramPtr update = Datagram::create_with_capacity(Datagram::server_header_size()
+                             + sizeof(doid_t) + sizeof(uint16_t) + field_values_size(changed_fields));
         update->add_server_header(database_to_object(m_doid), m_sender,
                                   multi ? DBSERVER_OBJECT_SET_FIELDS :
                                   DBSERVER_OBJECT_SET_FIELD);
@@ -364,12 +376,6 @@ void DBOperationGet::on_failure()
 
 void DBOperationGet::on_complete(DBObjectSnapshot *snapshot)
 {
-    DatagramPtr resp = Datagram::create();
-    resp->add_server_header(m_sender, m_dbserver->m_control_channel,
-                            m_resp_msgtype);
-    resp->add_uint32(m_context);
-    resp->add_uint8(SUCCESS);
-
     // Calculate the fields that we are sending in our response:
     FieldValues response_fields;
     if(m_resp_msgtype == DBSERVER_OBJECT_GET_ALL_RESP) {
@@ -392,8 +398,7 @@ void DBOperationGet::on_complete(DBObjectSnapshot *snapshot)
             // Try and unpack the field contents using a DatagramIterator.
             // If we get a FieldConstraintViolation, the field in this object (as serialised in the DB) is invalid.
             // If we get a DatagramIteratorEOF, we have a short read for this field.
-            DatagramPtr dg = Datagram::create();
-            dg->add_data(it.second);
+            DatagramPtr dg = Datagram::create(it.second);
             DatagramIterator dgi(dg);
             dgi.unpack_field(it.first, buffer);
         } catch(const FieldConstraintViolation& violation) {
@@ -410,14 +415,22 @@ void DBOperationGet::on_complete(DBObjectSnapshot *snapshot)
     }
 
     // WHAT we send depends on our m_resp_msgtype, so:
-    if(m_resp_msgtype == DBSERVER_OBJECT_GET_FIELD_RESP) {
-        if(response_fields.empty()) {
-            // We did not find the field we were looking for.
-            // Therefore, this is a failure.
-            on_failure();
-            return;
-        }
+    if(m_resp_msgtype == DBSERVER_OBJECT_GET_FIELD_RESP && response_fields.empty()) {
+        // We did not find the field we were looking for.
+        // Therefore, this is a failure.
+        on_failure();
+        return;
+    }
 
+    DatagramPtr resp = Datagram::create_with_capacity(Datagram::server_header_size()
+                       + sizeof(uint32_t) + sizeof(uint8_t) + 2 * sizeof(uint16_t)
+                       + field_values_size(response_fields));
+    resp->add_server_header(m_sender, m_dbserver->m_control_channel,
+                            m_resp_msgtype);
+    resp->add_uint32(m_context);
+    resp->add_uint8(SUCCESS);
+
+    if(m_resp_msgtype == DBSERVER_OBJECT_GET_FIELD_RESP) {
         resp->add_uint16(response_fields.begin()->first->get_id());
         resp->add_data(response_fields.begin()->second);
 
@@ -671,12 +684,6 @@ void DBOperationUpdate::on_failure()
 
 void DBOperationUpdate::on_criteria_mismatch(DBObjectSnapshot *snapshot)
 {
-    DatagramPtr resp = Datagram::create();
-    resp->add_server_header(m_sender, m_dbserver->m_control_channel,
-                            m_resp_msgtype);
-    resp->add_uint32(m_context);
-    resp->add_uint8(FAILURE);
-
     // Calculate the fields that we are sending in our response:
     FieldValues mismatched_fields;
 
@@ -687,6 +694,14 @@ void DBOperationUpdate::on_criteria_mismatch(DBObjectSnapshot *snapshot)
         }
     }
 
+    DatagramPtr resp = Datagram::create_with_capacity(Datagram::server_header_size()
+                       + sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint16_t)
+                       + field_values_size(mismatched_fields));
+    resp->add_server_header(m_sender, m_dbserver->m_control_channel,
+                            m_resp_msgtype);
+    resp->add_uint32(m_context);
+    resp->add_uint8(FAILURE);
+
     if(m_resp_msgtype == DBSERVER_OBJECT_SET_FIELDS_IF_EQUALS_RESP) {
         resp->add_uint16(mismatched_fields.size());
     }
@@ -3,6 +3,7 @@
 #include "value/default.h"
 #include "dc/File.h"
 #include "dc/Struct.h"
+#include "dc/UnpackPlan.h"
 
 #include "Field.h"
 namespace dclass   // open namespace
@@ -10,7 +11,8 @@ namespace dclass   // open namespace
 
 // constructor
 Field::Field(DistributedType* type, const std::string &name) :
-    m_struct(nullptr), m_id(0), m_name(name), m_type(type), m_has_default_value(false)
+    m_struct(nullptr), m_id(0), m_name(name), m_type(type), m_has_default_value(false),
+    m_plan(nullptr)
 {
     bool implicit_value;
 
@@ -26,6 +28,7 @@ Field::Field(DistributedType* type, const std::string &name) :
 Field::~Field()
 {
     delete m_type;
+    delete m_plan;
 }
 
 // as_molecular returns this as a MolecularField if it is molecular, or nullptr otherwise.
@@ -57,6 +60,9 @@ void Field::set_type(DistributedType* type)
     m_type = type;
     m_has_default_value = false;
     m_default_value = create_default_value(type);
+
+    delete m_plan;
+    m_plan = nullptr;
 }
 
 // set_default_value establishes a default value for this field.
@@ -69,6 +75,13 @@ bool Field::set_default_value(const std::string& default_value)
     return true;
 }
 
+// compile_plan compiles the field's type into an UnpackPlan, replacing any earlier plan.
+void Field::compile_plan()
+{
+    delete m_plan;
+    m_plan = new UnpackPlan(m_type);
+}
+
 // set_id sets the unique index number associated with the field.
 void Field::set_id(unsigned int id)
 {
@@ -11,6 +11,7 @@ class Class;
 class Struct;
 class MolecularField;
 class HashGenerator;
+class UnpackPlan;
 
 // A Field is a member of a class or struct.
 class Field : public KeywordList
@@ -40,6 +41,10 @@ class Field : public KeywordList
     //     If a default value hasn't been set, returns an implicit default.
     inline const std::string& get_default_value() const;
 
+    // get_plan returns the compiled UnpackPlan for the field's type,
+    //     or nullptr if it hasn't been compiled since the type was last set.
+    inline const UnpackPlan* get_plan() const;
+
     // set_name sets the name of this field.  Returns false if a field with
     //     the same name already exists in the containing struct.
     bool set_name(const std::string& name);
@@ -51,6 +56,9 @@ class Field : public KeywordList
     //     Returns false if the value is invalid for the field's type.
     virtual bool set_default_value(const std::string& default_value);
 
+    // compile_plan compiles the field's type into an UnpackPlan, replacing any earlier plan.
+    void compile_plan();
+
     // generate_hash accumulates the properties of this field into the hash.
     virtual void generate_hash(HashGenerator& hashgen) const;
 
@@ -71,6 +79,7 @@ class Field : public KeywordList
 
     bool m_has_default_value; // is true if an explicity default has been set
     std::string m_default_value; // the binary data of the default value encoded in a string
+    UnpackPlan* m_plan;
 };
 
 // Field comparison operators for sorting
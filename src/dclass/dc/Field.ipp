@@ -48,6 +48,13 @@ inline const std::string& Field::get_default_value() const
 	return m_default_value;
 }
 
+// get_plan returns the compiled UnpackPlan for the field's type,
+//     or nullptr if it hasn't been compiled since the type was last set.
+inline const UnpackPlan* Field::get_plan() const
+{
+	return m_plan;
+}
+
 // pointer comparison implementation for fields
 inline bool FieldPtrComp::operator()(const Field* lhs, const Field* rhs) const
 {
@@ -165,6 +165,14 @@ void File::add_field(Field *field)
     m_fields_by_id.push_back(field);
 }
 
+// compile_plans compiles an UnpackPlan for every field in the file.
+void File::compile_plans()
+{
+    for(auto it = m_fields_by_id.begin(); it != m_fields_by_id.end(); ++it) {
+        (*it)->compile_plan();
+    }
+}
+
 uint32_t File::get_hash() const
 {
     HashGenerator hashgen;
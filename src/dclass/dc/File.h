@@ -95,6 +95,10 @@ class File
     // add_keyword adds a keyword with the name <keyword> to the list of declared keywords.
     void add_keyword(const std::string &keyword);
 
+    // compile_plans compiles an UnpackPlan for every field in the file.
+    //     This should be called again after adding to the file.
+    void compile_plans();
+
     // get_hash returns a 32-bit hash representing the file.
     uint32_t get_hash() const;
 
@@ -1,5 +1,6 @@
 // Filename: NumericRange.h
 #pragma once
+#include <stdint.h>
 #include <limits> // std::numeric_limits<float>::infinity()
 namespace dclass   // open namespace dclass
 {
@@ -9,6 +9,7 @@
 #include <math.h>
 #include <memory.h>
 #include "util/HashGenerator.h"
+#include "util/range_scan.h"
 
 #include "NumericType.h"
 namespace dclass   // open namespace dclass
@@ -206,44 +207,49 @@ std::pair<bool, Number> NumericType::data_to_number(const std::vector<uint8_t>*
         return std::make_pair(false, Number(0));
     }
 
+    return data_to_number(&data->front());
+}
+
+std::pair<bool, Number> NumericType::data_to_number(const uint8_t* data) const
+{
     switch(m_type) {
         case T_INT8: {
-            int64_t val = *(int8_t*)&data->front();
+            int64_t val = *(int8_t*)data;
             return std::make_pair(true, Number(val));
         }
         case T_INT16: {
-            int64_t val = *(int16_t*)&data->front();
+            int64_t val = *(int16_t*)data;
             return std::make_pair(true, Number(val));
         }
         case T_INT32: {
-            int64_t val = *(int32_t*)&data->front();
+            int64_t val = *(int32_t*)data;
             return std::make_pair(true, Number(val));
         }
         case T_INT64: {
-            return std::make_pair(true, Number(*(int64_t*)&data->front()));
+            return std::make_pair(true, Number(*(int64_t*)data));
         }
         case T_CHAR:
         case T_UINT8: {
-            uint64_t val = *(uint8_t*)&data->front();
+            uint64_t val = *(uint8_t*)data;
             return std::make_pair(true, Number(val));
         }
         case T_UINT16: {
-            uint64_t val = *(uint16_t*)&data->front();
+            uint64_t val = *(uint16_t*)data;
             return std::make_pair(true, Number(val));
         }
         case T_UINT32: {
-            uint64_t val = *(uint32_t*)&data->front();
+            uint64_t val = *(uint32_t*)data;
             return std::make_pair(true, Number(val));
         }
         case T_UINT64: {
-            return std::make_pair(true, Number(*(uint64_t*)&data->front()));
+            return std::make_pair(true, Number(*(uint64_t*)data));
         }
         case T_FLOAT32: {
-            double val = *(float*)&data->front();
+            double val = *(float*)data;
             return std::make_pair(true, Number(val));
         }
         case T_FLOAT64: {
-            return std::make_pair(true, Number(*(double*)&data->front()));
+            return std::make_pair(true, Number(*(double*)data));
         }
         default: {
             break;
@@ -265,6 +271,17 @@ bool NumericType::within_range(const std::vector<uint8_t>* data, uint64_t length
     return m_range.contains(result.second);
 }
 
+bool NumericType::value_within_range(const uint8_t* data) const
+{
+    auto result = data_to_number(data);
+    return result.first && m_range.contains(result.second);
+}
+
+bool NumericType::values_within_range(const uint8_t* data, size_t count) const
+{
+    return scan_within_range(m_type, data, count, m_range);
+}
+
 // generate_hash accumulates the properties of this type into the hash.
 void NumericType::generate_hash(HashGenerator &hashgen) const
 {
@@ -32,6 +32,9 @@ class NumericType : public DistributedType
     virtual bool has_range() const;
     // get_range returns the NumericRange that constrains the type's values.
     inline NumericRange get_range() const;
+    // get_scaled_range returns the range after scaling by the divisor,
+    //     which is what packed values are checked against.
+    inline const NumericRange& get_scaled_range() const;
 
     // set_divisor sets a divisor for the numeric type, typically to represent fixed-point.
     //     Returns false if the divisor is not valid for this type.
@@ -44,6 +47,10 @@ class NumericType : public DistributedType
     bool set_range(const NumericRange &range);
 
     virtual bool within_range(const std::vector<uint8_t>* data, uint64_t length) const;
+    // value_within_range checks a packed value of the type, read straight from data.
+    bool value_within_range(const uint8_t* data) const;
+    // values_within_range checks an array of count packed values of the type.
+    bool values_within_range(const uint8_t* data, size_t count) const;
 
     // generate_hash accumulates the properties of this type into the hash.
     virtual void generate_hash(HashGenerator &hashgen) const;
@@ -52,6 +59,7 @@ class NumericType : public DistributedType
     unsigned int m_divisor;
 
     std::pair<bool, Number> data_to_number(const std::vector<uint8_t>* data) const;
+    std::pair<bool, Number> data_to_number(const uint8_t* data) const;
 
     // These are the original range and modulus values from the file, unscaled by the divisor.
     double m_orig_modulus;
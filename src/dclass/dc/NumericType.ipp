@@ -32,5 +32,12 @@ inline NumericRange NumericType::get_range() const
 	return m_orig_range;
 }
 
+// get_scaled_range returns the range after scaling by the divisor,
+//     which is what packed values are checked against.
+inline const NumericRange& NumericType::get_scaled_range() const
+{
+	return m_range;
+}
+
 
 } // close namespace dclass
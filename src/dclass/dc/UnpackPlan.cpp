@@ -0,0 +1,155 @@
+// Filename: UnpackPlan.cpp
+#include "dc/ArrayType.h"
+#include "dc/NumericType.h"
+#include "dc/Struct.h"
+#include "dc/Method.h"
+#include "dc/Parameter.h"
+#include "dc/Field.h"
+#include "util/range_scan.h"
+
+#include "UnpackPlan.h"
+namespace dclass   // open namespace dclass
+{
+
+
+// values_within_range returns true if all of the count packed numbers at data are in range.
+bool UnpackOp::values_within_range(const uint8_t* data, size_t count) const
+{
+    return scan_within_range(value_type, data, count, range);
+}
+
+// constructor
+UnpackPlan::UnpackPlan(const DistributedType* type) : m_merge_from(0)
+{
+    compile(type);
+}
+
+// compile appends the ops for a type to the plan.
+void UnpackPlan::compile(const DistributedType* type)
+{
+    // A Struct or Method with constraints on any of its members has to be taken apart,
+    //     even if it is fixed-size, so that those members can be checked.
+    bool is_composite = (type->get_type() == T_STRUCT || type->get_type() == T_METHOD);
+    if(type->has_fixed_size() && !(is_composite && type->has_range())) {
+        const ArrayType* array = type->as_array();
+        const NumericType* num = type->as_numeric();
+
+        if(type->get_type() == T_ARRAY && array->get_element_type()->has_range()) {
+            const DistributedType* element = array->get_element_type();
+            const NumericType* element_num = element->as_numeric();
+
+            UnpackOp op = UnpackOp();
+            op.size = type->get_size();
+            op.count = (uint32_t)array->get_array_size();
+            op.type = type;
+            if(element_num != nullptr) {
+                op.code = UnpackOp::ARRAY;
+                op.value_type = element->get_type();
+                op.range = element_num->get_scaled_range();
+                m_ops.push_back(op);
+                m_merge_from = m_ops.size();
+            } else {
+                op.code = UnpackOp::REPEAT;
+                size_t repeat = open_body(op);
+                compile(element);
+                close_body(repeat);
+            }
+        } else if(num != nullptr && num->has_range()) {
+            UnpackOp op = UnpackOp();
+            op.code = UnpackOp::NUMBER;
+            op.value_type = type->get_type();
+            op.size = type->get_size();
+            op.range = num->get_scaled_range();
+            op.type = type;
+            m_ops.push_back(op);
+            m_merge_from = m_ops.size();
+        } else if(type->get_type() == T_STRING) {
+            UnpackOp op = UnpackOp();
+            op.code = UnpackOp::STRING;
+            op.size = type->get_size();
+            op.type = type;
+            m_ops.push_back(op);
+            m_merge_from = m_ops.size();
+        } else {
+            add_fixed(type->get_size());
+        }
+        return;
+    }
+
+    switch(type->get_type()) {
+    case T_VARSTRING:
+    case T_VARBLOB: {
+        UnpackOp op = UnpackOp();
+        op.code = (type->get_type() == T_VARSTRING) ? UnpackOp::VARSTRING : UnpackOp::VARBLOB;
+        op.type = type;
+        m_ops.push_back(op);
+        m_merge_from = m_ops.size();
+        break;
+    }
+    case T_VARARRAY: {
+        UnpackOp op = UnpackOp();
+        op.code = UnpackOp::VARARRAY;
+        op.type = type;
+        size_t vararray = open_body(op);
+        compile(type->as_array()->get_element_type());
+        close_body(vararray);
+        break;
+    }
+    case T_STRUCT: {
+        const Struct* dstruct = type->as_struct();
+        size_t num_fields = dstruct->get_num_fields();
+        for(unsigned int i = 0; i < num_fields; ++i) {
+            compile(dstruct->get_field(i)->get_type());
+        }
+        break;
+    }
+    case T_METHOD: {
+        const Method* dmethod = type->as_method();
+        size_t num_params = dmethod->get_num_parameters();
+        for(unsigned int i = 0; i < num_params; ++i) {
+            compile(dmethod->get_parameter(i)->get_type());
+        }
+        break;
+    }
+    default: {
+        // Nothing is packed for an invalid type.
+        break;
+    }
+    }
+}
+
+// add_fixed adds a run of bytes which need no checking, merging it into the previous run if any.
+void UnpackPlan::add_fixed(uint32_t size)
+{
+    if(size == 0) {
+        return;
+    }
+
+    if(m_ops.size() > m_merge_from && m_ops.back().code == UnpackOp::FIXED) {
+        m_ops.back().size += size;
+        return;
+    }
+
+    UnpackOp op = UnpackOp();
+    op.code = UnpackOp::FIXED;
+    op.size = size;
+    m_ops.push_back(op);
+}
+
+// open_body adds an op which is followed by a body, and returns its index for close_body.
+size_t UnpackPlan::open_body(UnpackOp op)
+{
+    m_ops.push_back(op);
+    m_merge_from = m_ops.size();
+    return m_ops.size() - 1;
+}
+
+// close_body ends the body of the op at the given index.
+void UnpackPlan::close_body(size_t op)
+{
+    m_ops[op].body = (uint32_t)(m_ops.size() - op - 1);
+    m_merge_from = m_ops.size();
+}
+
+
+} // close namespace dclass
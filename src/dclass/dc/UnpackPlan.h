@@ -0,0 +1,64 @@
+// Filename: UnpackPlan.h
+#pragma once
+#include <stdint.h>
+#include <vector> // std::vector
+#include "NumericRange.h"
+#include "DistributedType.h"
+namespace dclass   // open namespace dclass
+{
+
+
+// An UnpackOp is a single step of an UnpackPlan.  Each op covers a stretch of packed data:
+//     a run of values which only needs copying, a value which has to be checked, or an array
+//     which is followed by the ops for one of its elements.
+struct UnpackOp {
+    enum Code : uint8_t {
+        FIXED,     // size bytes which need no checking
+        NUMBER,    // a number of type value_type, which must be within range
+        STRING,    // a fixed-length string of size characters
+        ARRAY,     // a fixed array of count numbers of type value_type, which must be within range
+        REPEAT,    // a fixed array of count elements, each unpacked by the following body ops
+        VARSTRING, // a variable-length string, with a length in range for type
+        VARBLOB,   // a variable-length blob, with a length in range for type
+        VARARRAY,  // a variable-length array of elements, each unpacked by the following body ops
+    };
+
+    Code code;
+    Type value_type;    // NUMBER, ARRAY: the numeric type of the values.
+    uint32_t size;      // The number of bytes the op covers, or 0 if it is variable.
+    uint32_t count;     // ARRAY, REPEAT: the number of elements.
+    uint32_t body;      // REPEAT, VARARRAY: the number of ops following this one for an element.
+    NumericRange range; // NUMBER, ARRAY: the range the values must be within.
+    const DistributedType* type; // The type the op was compiled from, for range checks and errors.
+
+    // value_within_range returns true if the packed number at data is within range.
+    inline bool value_within_range(const uint8_t* data) const;
+    // values_within_range returns true if all of the count packed numbers at data are in range.
+    bool values_within_range(const uint8_t* data, size_t count) const;
+};
+
+// An UnpackPlan is a DistributedType compiled down to a flat list of UnpackOps, so the packed
+//     data for a field can be unpacked or skipped by a simple loop instead of walking the type.
+//     Fixed-size values with no constraints are merged into runs which can be copied at once.
+class UnpackPlan
+{
+  public:
+    UnpackPlan(const DistributedType* type);
+
+    inline const UnpackOp* begin() const;
+    inline const UnpackOp* end() const;
+    inline size_t size() const;
+
+  private:
+    std::vector<UnpackOp> m_ops;
+    size_t m_merge_from; // Ops before this may not be extended by a following FIXED op.
+
+    void compile(const DistributedType* type);
+    void add_fixed(uint32_t size);
+    size_t open_body(UnpackOp op);
+    void close_body(size_t op);
+};
+
+
+} // close namespace dclass
+#include "UnpackPlan.ipp"
@@ -0,0 +1,51 @@
+// Filename: UnpackPlan.ipp
+namespace dclass   // open namespace dclass
+{
+
+
+// value_within_range returns true if the packed number at data is within range.
+inline bool UnpackOp::value_within_range(const uint8_t* data) const
+{
+	switch(value_type) {
+		case T_INT8:
+			return range.contains(Number(int64_t(*(int8_t*)data)));
+		case T_INT16:
+			return range.contains(Number(int64_t(*(int16_t*)data)));
+		case T_INT32:
+			return range.contains(Number(int64_t(*(int32_t*)data)));
+		case T_INT64:
+			return range.contains(Number(*(int64_t*)data));
+		case T_CHAR:
+		case T_UINT8:
+			return range.contains(Number(uint64_t(*(uint8_t*)data)));
+		case T_UINT16:
+			return range.contains(Number(uint64_t(*(uint16_t*)data)));
+		case T_UINT32:
+			return range.contains(Number(uint64_t(*(uint32_t*)data)));
+		case T_UINT64:
+			return range.contains(Number(*(uint64_t*)data));
+		case T_FLOAT32:
+			return range.contains(Number(double(*(float*)data)));
+		case T_FLOAT64:
+			return range.contains(Number(*(double*)data));
+		default:
+			return false;
+	}
+}
+
+inline const UnpackOp* UnpackPlan::begin() const
+{
+	return m_ops.data();
+}
+inline const UnpackOp* UnpackPlan::end() const
+{
+	return m_ops.data() + m_ops.size();
+}
+// size returns the number of ops in the plan.
+inline size_t UnpackPlan::size() const
+{
+	return m_ops.size();
+}
+
+
+} // close namespace dclass
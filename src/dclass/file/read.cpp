@@ -10,14 +10,20 @@ namespace dclass   // open namespace dclass
 
 
 // append opens the given file or stream and parses it as a .dc file.  The distributed
-//     classes defined in the file are added to the list of classes associated with the File.
+//     classes defined in the file are added to the list of classes associated with the File,
+//     and the UnpackPlans of all of its fields are compiled.
 //     When appending from a stream, a filename is optional only used to report errors.
 bool append(File* f, istream &in, const string &filename)
 {
     init_file_parser(in, filename, *f);
     run_parser();
     cleanup_parser();
-    return (parser_error_count() == 0);
+    if(parser_error_count() != 0) {
+        return false;
+    }
+
+    f->compile_plans();
+    return true;
 }
 bool append(File* f, const string &filename)
 {
@@ -0,0 +1,383 @@
+// Filename: range_scan.cpp
+#include <math.h>   // isnan
+#include <string.h> // memcpy
+#include <atomic>
+#include "range_scan.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RANGE_SCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace dclass   // open namespace dclass
+{
+
+
+// is_nan returns true if the number is a floating-point NaN.
+template<typename T>
+static inline bool is_nan(T)
+{
+    return false;
+}
+static inline bool is_nan(float v)
+{
+    return isnan(v);
+}
+static inline bool is_nan(double v)
+{
+    return isnan(v);
+}
+
+// scan_scalar scans the numbers one at a time, widening lo and hi to fit them.
+template<typename T>
+static bool scan_scalar(const uint8_t* data, size_t count, T& lo, T& hi)
+{
+    for(size_t i = 0; i < count; ++i) {
+        T v;
+        memcpy(&v, data + i * sizeof(T), sizeof(T));
+        if(is_nan(v)) {
+            return false;
+        }
+        if(v < lo) {
+            lo = v;
+        }
+        if(v > hi) {
+            hi = v;
+        }
+    }
+    return true;
+}
+
+template<typename T>
+using ScanKernel = bool (*)(const uint8_t* data, size_t count, T& lo, T& hi);
+
+#ifdef RANGE_SCAN_X86
+
+#define TARGET_SSE42 __attribute__((target("sse4.2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+static SimdLevel detect_simd_level()
+{
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        return SIMD_AVX2;
+    }
+    if(__builtin_cpu_supports("sse4.2")) {
+        return SIMD_SSE42;
+    }
+    return SIMD_NONE;
+}
+
+
+// The kernels below scan a whole vector of numbers at a time, keeping a running minimum and
+//     maximum in each lane.  The last vector overlaps the one before it if the count isn't a
+//     multiple of the vector width, which is harmless for a minimum or maximum, so the count
+//     must be at least the vector width.  The lanes are then folded together one at a time.
+#define RANGE_SCAN_KERNEL(name, target, T, V, load, vmin, vmax)                            \
+    target static bool name(const uint8_t* data, size_t count, T& lo, T& hi)               \
+    {                                                                                      \
+        const size_t lanes = sizeof(V) / sizeof(T);                                        \
+        V vlo = load(data);                                                                \
+        V vhi = vlo;                                                                       \
+        size_t i = lanes;                                                                  \
+        for(; i + lanes <= count; i += lanes) {                                            \
+            V v = load(data + i * sizeof(T));                                              \
+            vlo = vmin(vlo, v);                                                            \
+            vhi = vmax(vhi, v);                                                            \
+        }                                                                                  \
+        if(i < count) {                                                                    \
+            V v = load(data + (count - lanes) * sizeof(T));                                \
+            vlo = vmin(vlo, v);                                                            \
+            vhi = vmax(vhi, v);                                                            \
+        }                                                                                  \
+                                                                                           \
+        T los[lanes], his[lanes];                                                          \
+        memcpy(los, &vlo, sizeof(V));                                                      \
+        memcpy(his, &vhi, sizeof(V));                                                      \
+        lo = los[0];                                                                       \
+        hi = his[0];                                                                       \
+        scan_scalar((const uint8_t*)los, lanes, lo, hi);                                   \
+        scan_scalar((const uint8_t*)his, lanes, lo, hi);                                   \
+        return true;                                                                       \
+    }
+
+// The floating-point kernels also look for NaNs, which the minimum and maximum would skip.
+#define RANGE_SCAN_FLOAT_KERNEL(name, target, T, V, load, vmin, vmax, vunord, vor, vmask)  \
+    target static bool name(const uint8_t* data, size_t count, T& lo, T& hi)               \
+    {                                                                                      \
+        const size_t lanes = sizeof(V) / sizeof(T);                                        \
+        V vlo = load(data);                                                                \
+        V vhi = vlo;                                                                       \
+        V nan = vunord(vlo, vlo);                                                          \
+        size_t i = lanes;                                                                  \
+        for(; i + lanes <= count; i += lanes) {                                            \
+            V v = load(data + i * sizeof(T));                                              \
+            vlo = vmin(vlo, v);                                                            \
+            vhi = vmax(vhi, v);                                                            \
+            nan = vor(nan, vunord(v, v));                                                  \
+        }                                                                                  \
+        if(i < count) {                                                                    \
+            V v = load(data + (count - lanes) * sizeof(T));                                \
+            vlo = vmin(vlo, v);                                                            \
+            vhi = vmax(vhi, v);                                                            \
+            nan = vor(nan, vunord(v, v));                                                  \
+        }                                                                                  \
+        if(vmask(nan) != 0) {                                                              \
+            return false;                                                                  \
+        }                                                                                  \
+                                                                                           \
+        T los[lanes], his[lanes];                                                          \
+        memcpy(los, &vlo, sizeof(V));                                                      \
+        memcpy(his, &vhi, sizeof(V));                                                      \
+        lo = los[0];                                                                       \
+        hi = his[0];                                                                       \
+        scan_scalar((const uint8_t*)los, lanes, lo, hi);                                   \
+        scan_scalar((const uint8_t*)his, lanes, lo, hi);                                   \
+        return true;                                                                       \
+    }
+
+// SSE4.2 helpers
+TARGET_SSE42 static inline __m128i load_sse42(const uint8_t* p)
+{
+    return _mm_loadu_si128((const __m128i*)p);
+}
+TARGET_SSE42 static inline __m128 load_ps_sse42(const uint8_t* p)
+{
+    return _mm_loadu_ps((const float*)p);
+}
+TARGET_SSE42 static inline __m128d load_pd_sse42(const uint8_t* p)
+{
+    return _mm_loadu_pd((const double*)p);
+}
+TARGET_SSE42 static inline __m128i min_epi64_sse42(__m128i a, __m128i b)
+{
+    return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b));
+}
+TARGET_SSE42 static inline __m128i max_epi64_sse42(__m128i a, __m128i b)
+{
+    return _mm_blendv_epi8(b, a, _mm_cmpgt_epi64(a, b));
+}
+// SSE has no unsigned 64-bit comparison, so the sign bits are flipped for a signed one.
+TARGET_SSE42 static inline __m128i gt_epu64_sse42(__m128i a, __m128i b)
+{
+    const __m128i sign = _mm_set1_epi64x(INT64_MIN);
+    return _mm_cmpgt_epi64(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+}
+TARGET_SSE42 static inline __m128i min_epu64_sse42(__m128i a, __m128i b)
+{
+    return _mm_blendv_epi8(a, b, gt_epu64_sse42(a, b));
+}
+TARGET_SSE42 static inline __m128i max_epu64_sse42(__m128i a, __m128i b)
+{
+    return _mm_blendv_epi8(b, a, gt_epu64_sse42(a, b));
+}
+TARGET_SSE42 static inline __m128 unord_ps_sse42(__m128 a, __m128 b)
+{
+    return _mm_cmpunord_ps(a, b);
+}
+TARGET_SSE42 static inline __m128d unord_pd_sse42(__m128d a, __m128d b)
+{
+    return _mm_cmpunord_pd(a, b);
+}
+
+// AVX2 helpers
+TARGET_AVX2 static inline __m256i load_avx2(const uint8_t* p)
+{
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+TARGET_AVX2 static inline __m256 load_ps_avx2(const uint8_t* p)
+{
+    return _mm256_loadu_ps((const float*)p);
+}
+TARGET_AVX2 static inline __m256d load_pd_avx2(const uint8_t* p)
+{
+    return _mm256_loadu_pd((const double*)p);
+}
+TARGET_AVX2 static inline __m256i min_epi64_avx2(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b));
+}
+TARGET_AVX2 static inline __m256i max_epi64_avx2(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b));
+}
+TARGET_AVX2 static inline __m256i gt_epu64_avx2(__m256i a, __m256i b)
+{
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    return _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+}
+TARGET_AVX2 static inline __m256i min_epu64_avx2(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(a, b, gt_epu64_avx2(a, b));
+}
+TARGET_AVX2 static inline __m256i max_epu64_avx2(__m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, gt_epu64_avx2(a, b));
+}
+TARGET_AVX2 static inline __m256 unord_ps_avx2(__m256 a, __m256 b)
+{
+    return _mm256_cmp_ps(a, b, _CMP_UNORD_Q);
+}
+TARGET_AVX2 static inline __m256d unord_pd_avx2(__m256d a, __m256d b)
+{
+    return _mm256_cmp_pd(a, b, _CMP_UNORD_Q);
+}
+
+RANGE_SCAN_KERNEL(scan_int8_sse42, TARGET_SSE42, int8_t, __m128i, load_sse42,
+                  _mm_min_epi8, _mm_max_epi8)
+RANGE_SCAN_KERNEL(scan_uint8_sse42, TARGET_SSE42, uint8_t, __m128i, load_sse42,
+                  _mm_min_epu8, _mm_max_epu8)
+RANGE_SCAN_KERNEL(scan_int16_sse42, TARGET_SSE42, int16_t, __m128i, load_sse42,
+                  _mm_min_epi16, _mm_max_epi16)
+RANGE_SCAN_KERNEL(scan_uint16_sse42, TARGET_SSE42, uint16_t, __m128i, load_sse42,
+                  _mm_min_epu16, _mm_max_epu16)
+RANGE_SCAN_KERNEL(scan_int32_sse42, TARGET_SSE42, int32_t, __m128i, load_sse42,
+                  _mm_min_epi32, _mm_max_epi32)
+RANGE_SCAN_KERNEL(scan_uint32_sse42, TARGET_SSE42, uint32_t, __m128i, load_sse42,
+                  _mm_min_epu32, _mm_max_epu32)
+RANGE_SCAN_KERNEL(scan_int64_sse42, TARGET_SSE42, int64_t, __m128i, load_sse42,
+                  min_epi64_sse42, max_epi64_sse42)
+RANGE_SCAN_KERNEL(scan_uint64_sse42, TARGET_SSE42, uint64_t, __m128i, load_sse42,
+                  min_epu64_sse42, max_epu64_sse42)
+RANGE_SCAN_FLOAT_KERNEL(scan_float32_sse42, TARGET_SSE42, float, __m128, load_ps_sse42,
+                        _mm_min_ps, _mm_max_ps, unord_ps_sse42, _mm_or_ps, _mm_movemask_ps)
+RANGE_SCAN_FLOAT_KERNEL(scan_float64_sse42, TARGET_SSE42, double, __m128d, load_pd_sse42,
+                        _mm_min_pd, _mm_max_pd, unord_pd_sse42, _mm_or_pd, _mm_movemask_pd)
+
+RANGE_SCAN_KERNEL(scan_int8_avx2, TARGET_AVX2, int8_t, __m256i, load_avx2,
+                  _mm256_min_epi8, _mm256_max_epi8)
+RANGE_SCAN_KERNEL(scan_uint8_avx2, TARGET_AVX2, uint8_t, __m256i, load_avx2,
+                  _mm256_min_epu8, _mm256_max_epu8)
+RANGE_SCAN_KERNEL(scan_int16_avx2, TARGET_AVX2, int16_t, __m256i, load_avx2,
+                  _mm256_min_epi16, _mm256_max_epi16)
+RANGE_SCAN_KERNEL(scan_uint16_avx2, TARGET_AVX2, uint16_t, __m256i, load_avx2,
+                  _mm256_min_epu16, _mm256_max_epu16)
+RANGE_SCAN_KERNEL(scan_int32_avx2, TARGET_AVX2, int32_t, __m256i, load_avx2,
+                  _mm256_min_epi32, _mm256_max_epi32)
+RANGE_SCAN_KERNEL(scan_uint32_avx2, TARGET_AVX2, uint32_t, __m256i, load_avx2,
+                  _mm256_min_epu32, _mm256_max_epu32)
+RANGE_SCAN_KERNEL(scan_int64_avx2, TARGET_AVX2, int64_t, __m256i, load_avx2,
+                  min_epi64_avx2, max_epi64_avx2)
+RANGE_SCAN_KERNEL(scan_uint64_avx2, TARGET_AVX2, uint64_t, __m256i, load_avx2,
+                  min_epu64_avx2, max_epu64_avx2)
+RANGE_SCAN_FLOAT_KERNEL(scan_float32_avx2, TARGET_AVX2, float, __m256, load_ps_avx2,
+                        _mm256_min_ps, _mm256_max_ps, unord_ps_avx2, _mm256_or_ps,
+                        _mm256_movemask_ps)
+RANGE_SCAN_FLOAT_KERNEL(scan_float64_avx2, TARGET_AVX2, double, __m256d, load_pd_avx2,
+                        _mm256_min_pd, _mm256_max_pd, unord_pd_avx2, _mm256_or_pd,
+                        _mm256_movemask_pd)
+
+#define RANGE_SCAN_KERNELS(name) scan_##name##_sse42, scan_##name##_avx2
+#else
+static SimdLevel detect_simd_level()
+{
+    return SIMD_NONE;
+}
+
+#define RANGE_SCAN_KERNELS(name) nullptr, nullptr
+#endif // RANGE_SCAN_X86
+
+SimdLevel supported_simd_level()
+{
+    static const SimdLevel level = detect_simd_level();
+    return level;
+}
+
+static std::atomic<SimdLevel>& simd_level()
+{
+    static std::atomic<SimdLevel> level(supported_simd_level());
+    return level;
+}
+
+void set_simd_level(SimdLevel level)
+{
+    SimdLevel supported = supported_simd_level();
+    simd_level().store(level < supported ? level : supported, std::memory_order_relaxed);
+}
+
+// scan picks the widest kernel which the SIMD level allows and the count is long enough for.
+template<typename T>
+static bool scan(const uint8_t* data, size_t count, T& lo, T& hi,
+                 ScanKernel<T> sse42, ScanKernel<T> avx2)
+{
+#ifdef RANGE_SCAN_X86
+    SimdLevel level = simd_level().load(std::memory_order_relaxed);
+    if(level >= SIMD_AVX2 && count * sizeof(T) >= 32) {
+        return avx2(data, count, lo, hi);
+    }
+    if(level >= SIMD_SSE42 && count * sizeof(T) >= 16) {
+        return sse42(data, count, lo, hi);
+    }
+#else
+    (void) sse42;
+    (void) avx2;
+#endif
+
+    memcpy(&lo, data, sizeof(T));
+    hi = lo;
+    return scan_scalar(data, count, lo, hi);
+}
+
+template<typename T, typename N>
+static bool scan_numbers(const uint8_t* data, size_t count, Number& min, Number& max,
+                         ScanKernel<T> sse42, ScanKernel<T> avx2)
+{
+    T lo, hi;
+    if(!scan(data, count, lo, hi, sse42, avx2)) {
+        return false;
+    }
+    min = Number(N(lo));
+    max = Number(N(hi));
+    return true;
+}
+
+// scan_range finds the smallest and largest of <count> packed numbers of the numeric type
+//     <type> at <data>, so a whole array can be checked against a range with two comparisons.
+//     Returns false if the numbers can't be ordered, because they include a floating-point NaN.
+bool scan_range(Type type, const uint8_t* data, size_t count, Number& min, Number& max)
+{
+    if(count == 0) {
+        min = max = Number();
+        return true;
+    }
+
+    switch(type) {
+    case T_INT8:
+        return scan_numbers<int8_t, int64_t>(data, count, min, max, RANGE_SCAN_KERNELS(int8));
+    case T_INT16:
+        return scan_numbers<int16_t, int64_t>(data, count, min, max, RANGE_SCAN_KERNELS(int16));
+    case T_INT32:
+        return scan_numbers<int32_t, int64_t>(data, count, min, max, RANGE_SCAN_KERNELS(int32));
+    case T_INT64:
+        return scan_numbers<int64_t, int64_t>(data, count, min, max, RANGE_SCAN_KERNELS(int64));
+    case T_CHAR:
+    case T_UINT8:
+        return scan_numbers<uint8_t, uint64_t>(data, count, min, max, RANGE_SCAN_KERNELS(uint8));
+    case T_UINT16:
+        return scan_numbers<uint16_t, uint64_t>(data, count, min, max, RANGE_SCAN_KERNELS(uint16));
+    case T_UINT32:
+        return scan_numbers<uint32_t, uint64_t>(data, count, min, max, RANGE_SCAN_KERNELS(uint32));
+    case T_UINT64:
+        return scan_numbers<uint64_t, uint64_t>(data, count, min, max, RANGE_SCAN_KERNELS(uint64));
+    case T_FLOAT32:
+        return scan_numbers<float, double>(data, count, min, max, RANGE_SCAN_KERNELS(float32));
+    case T_FLOAT64:
+        return scan_numbers<double, double>(data, count, min, max, RANGE_SCAN_KERNELS(float64));
+    default:
+        return false;
+    }
+}
+
+// scan_within_range returns true if all of the <count> packed numbers of the numeric type <type>
+//     at <data> are within <range>.
+bool scan_within_range(Type type, const uint8_t* data, size_t count, const NumericRange& range)
+{
+    Number min, max;
+    if(!scan_range(type, data, count, min, max)) {
+        return false;
+    }
+    return count == 0 || (range.contains(min) && range.contains(max));
+}
+
+
+} // close namespace dclass
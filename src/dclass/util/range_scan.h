@@ -0,0 +1,35 @@
+// Filename: range_scan.h
+#pragma once
+#include <stddef.h> // size_t
+#include <stdint.h>
+#include "dc/DistributedType.h"
+#include "dc/NumericRange.h"
+namespace dclass   // open namespace dclass
+{
+
+
+// scan_range finds the smallest and largest of <count> packed numbers of the numeric type
+//     <type> at <data>, so a whole array can be checked against a range with two comparisons.
+//     Returns false if the numbers can't be ordered, because they include a floating-point NaN.
+//     Where the CPU supports it, the scan uses SSE4.2 or AVX2.
+bool scan_range(Type type, const uint8_t* data, size_t count, Number& min, Number& max);
+// scan_within_range returns true if all of the <count> packed numbers of the numeric type <type>
+//     at <data> are within <range>.  A NaN is never within range.
+bool scan_within_range(Type type, const uint8_t* data, size_t count, const NumericRange& range);
+
+// A SimdLevel is the widest vector instruction set scan_range may use.
+enum SimdLevel {
+    SIMD_NONE,
+    SIMD_SSE42,
+    SIMD_AVX2,
+};
+
+// supported_simd_level returns the widest level the CPU supports, which scan_range uses unless
+//     set_simd_level has limited it.
+SimdLevel supported_simd_level();
+// set_simd_level limits scan_range to kernels no wider than <level>, so that tests can check
+//     each kernel in turn.  Levels the CPU doesn't support fall back to the widest it does.
+void set_simd_level(SimdLevel level);
+
+
+} // close namespace dclass
@@ -0,0 +1,28 @@
+#include "ChannelGroup.h"
+
+ChannelGroupHandle ChannelGroup::create(const std::unordered_set<channel_t> &channels)
+{
+    ChannelGroupHandle group(new ChannelGroup(channels));
+    return group;
+}
+
+ChannelGroup::ChannelGroup(const std::unordered_set<channel_t> &channels)
+{
+    for(const auto& channel : channels) {
+        m_channels.push_back(channel);
+    }
+}
+
+DatagramPtr ChannelGroup::create_datagram(channel_t from_channel, uint16_t message_type,
+                                          size_t payload_size) const
+{
+    DatagramPtr dg = Datagram::create_with_capacity(
+                         Datagram::server_header_size(m_channels.size()) + payload_size);
+    dg->add_uint8(m_channels.size());
+    for(const auto& channel : m_channels) {
+        dg->add_channel(channel);
+    }
+    dg->add_channel(from_channel);
+    dg->add_uint16(message_type);
+    return dg;
+}
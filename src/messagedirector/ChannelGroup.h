@@ -0,0 +1,48 @@
+#pragma once
+#include <memory>
+#include <unordered_set>
+#include "ChannelMap.h"
+#include "util/Datagram.h"
+
+class ChannelGroup;
+typedef std::shared_ptr<const ChannelGroup> ChannelGroupHandle;
+
+// A ChannelGroup is a fixed list of channels that a participant routes datagrams to over and
+//     over again, such as the location, AI and owner channels a DistributedObject broadcasts to.
+// The MessageDirector remembers which subscribers the group's channels resolved to, and only
+//     looks them up again once the subscriptions have changed.
+class ChannelGroup
+{
+  public:
+    // create registers a group for the given channels.  The group is immutable, so a
+    //     participant should create a new one (and drop the old) when its targets change.
+    static ChannelGroupHandle create(const std::unordered_set<channel_t> &channels);
+
+    inline const ChannelMap::ChannelList &channels() const
+    {
+        return m_channels;
+    }
+
+    // create_datagram creates a new datagram with a server header addressed to the group.
+    // Only datagrams created this way may be routed to the group.
+    // payload_size is how much will be added after the header, if it is known ahead of time.
+    DatagramPtr create_datagram(channel_t from_channel, uint16_t message_type,
+                                size_t payload_size = 0) const;
+
+  private:
+    friend class ChannelMap;
+
+    // A Resolution is the set of subscribers the group's channels resolved to,
+    //     at a given subscription epoch of the ChannelMap.
+    struct Resolution {
+        uint64_t epoch;
+        ChannelMap::SubscriberList subscribers;
+    };
+
+    ChannelGroup(const std::unordered_set<channel_t> &channels);
+
+    ChannelMap::ChannelList m_channels;
+    // The latest resolution, which may be replaced by any routing thread;
+    // only ever accessed through std::atomic_load and std::atomic_store.
+    mutable std::shared_ptr<const Resolution> m_resolution;
+};
@@ -1,4 +1,7 @@
 #include "ChannelMap.h"
+#include "ChannelGroup.h"
+#include <algorithm>
+#include <functional>
 
 typedef boost::icl::discrete_interval<channel_t> interval_t;
 
@@ -15,57 +18,226 @@ static void get_closed_bounds(const interval_t &interval, channel_t &lower, chan
     }
 }
 
-ChannelMap::ChannelMap()
+// SubscriberIndices hands out ChannelSubscriber indices, preferring to reuse freed ones.
+class SubscriberIndices
+{
+  public:
+    static SubscriberIndices &singleton()
+    {
+        // Never destroyed: participants may still be deleted by static destructors at exit.
+        static SubscriberIndices *indices = new SubscriberIndices;
+        return *indices;
+    }
+
+    size_t allocate()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if(m_free.empty()) {
+            return m_next++;
+        }
+
+        size_t index = m_free.back();
+        m_free.pop_back();
+        return index;
+    }
+
+    void release(size_t index)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_free.push_back(index);
+    }
+
+  private:
+    SubscriberIndices() : m_next(0)
+    {
+    }
+
+    std::mutex m_lock;
+    std::vector<size_t> m_free;
+    size_t m_next;
+};
+
+ChannelSubscriber::ChannelSubscriber() : m_index(SubscriberIndices::singleton().allocate())
 {
-    // Initialize m_range_susbcriptions with empty range
-    auto empty_set = std::unordered_set<ChannelSubscriber*>();
-    m_range_subscriptions = boost::icl::interval_map<channel_t, std::unordered_set<ChannelSubscriber*> >();
-    m_range_subscriptions += std::make_pair(interval_t::closed(0, CHANNEL_MAX), empty_set);
 }
 
-void ChannelMap::subscribe_channel(ChannelSubscriber *p, channel_t c)
+ChannelSubscriber::~ChannelSubscriber()
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    SubscriberIndices::singleton().release(m_index);
+}
 
-    if(is_subscribed(p, c)) {
-        return;
+// A SeenSubscribers bitmap marks, by subscriber index, the subscribers already found by a lookup.
+// Each thread keeps its own, and every lookup clears the bits it set before returning,
+// so it is only ever (re)allocated when a larger subscriber index shows up.
+class SeenSubscribers
+{
+  public:
+    // insert marks a subscriber as seen, returning false if it already was.
+    inline bool insert(const ChannelSubscriber *p)
+    {
+        size_t index = p->subscriber_index();
+        size_t word = index / 64;
+        if(word >= m_bits.size()) {
+            m_bits.resize(std::max(word + 1, m_bits.size() * 2), 0);
+        }
+
+        uint64_t bit = uint64_t(1) << (index % 64);
+        if(m_bits[word] & bit) {
+            return false;
+        }
+        m_bits[word] |= bit;
+        return true;
     }
 
-    p->channels().insert(p->channels().end(), c);
-    bool has_subs = (m_channel_subscriptions.find(c) != m_channel_subscriptions.end());
+    inline void erase(const ChannelSubscriber *p)
+    {
+        size_t index = p->subscriber_index();
+        m_bits[index / 64] &= ~(uint64_t(1) << (index % 64));
+    }
 
-    if(!has_subs) {
-        on_add_channel(c);
+  private:
+    std::vector<uint64_t> m_bits;
+};
+
+// A WriteScope holds the writers' lock while a subscription changes, and publishes the
+// modified copies of the snapshot once the outermost write is finished.
+class ChannelMap::WriteScope
+{
+  public:
+    WriteScope(ChannelMap *map) : m_map(map), m_guard(map->m_lock)
+    {
+        ++m_map->m_write_depth;
     }
 
-    m_channel_subscriptions.insert(std::make_pair(c, p));
+    ~WriteScope()
+    {
+        if(--m_map->m_write_depth == 0) {
+            m_map->publish();
+        }
+    }
+
+  private:
+    ChannelMap *m_map;
+    std::lock_guard<std::recursive_mutex> m_guard;
+};
+
+ChannelMap::ChannelMap() : m_pending_ranges(nullptr), m_write_depth(0), m_subscription_epoch(0)
+{
+    for(auto& shard : m_channel_shards) {
+        shard.store(nullptr, std::memory_order_relaxed);
+    }
+
+    // Initialize m_range_susbcriptions with empty range
+    m_range_subscriptions.store(new RangeIndex(), std::memory_order_release);
 }
 
-bool ChannelMap::remove_subscriber(ChannelSubscriber *p, channel_t c)
+ChannelMap::~ChannelMap()
 {
-    auto sub_cnt = m_channel_subscriptions.count(c);
-    if(sub_cnt == 0) {
-        return false;
+    for(auto& shard : m_channel_shards) {
+        delete shard.load(std::memory_order_relaxed);
     }
+    delete m_range_subscriptions.load(std::memory_order_relaxed);
+}
 
-    auto subs = m_channel_subscriptions.equal_range(c);
+size_t ChannelMap::shard_of(channel_t c)
+{
+    // Use the top bits of a multiplicative hash; the ChannelTable in each shard hashes
+    // channels differently, so channels in one shard still spread out over its slots.
+    uint64_t h = std::hash<channel_t>()(c) * 0x9e3779b97f4a7c15ULL;
+    return size_t(h >> (64 - channel_shard_bits));
+}
 
-    for(auto it = subs.first; it != subs.second; ++it) {
-        if(it->second == p) {
-            m_channel_subscriptions.erase(it);
-            --sub_cnt;
-            break;
+ChannelTable &ChannelMap::writable_channels(channel_t c)
+{
+    size_t index = shard_of(c);
+    for(auto& pending : m_pending_shards) {
+        if(pending.first == index) {
+            return *pending.second;
         }
     }
 
-    return (sub_cnt == 0);
+    const ChannelTable *current = m_channel_shards[index].load(std::memory_order_relaxed);
+    ChannelTable *copy = current ? new ChannelTable(*current) : new ChannelTable();
+    m_pending_shards.push_back(std::make_pair(index, copy));
+    return *copy;
+}
+
+RangeIndex &ChannelMap::writable_ranges()
+{
+    if(m_pending_ranges == nullptr) {
+        m_pending_ranges = new RangeIndex(current_ranges());
+    }
+    return *m_pending_ranges;
+}
+
+const RangeIndex &ChannelMap::current_ranges()
+{
+    if(m_pending_ranges != nullptr) {
+        return *m_pending_ranges;
+    }
+    return *m_range_subscriptions.load(std::memory_order_relaxed);
+}
+
+void ChannelMap::publish()
+{
+    bool changed = !m_pending_shards.empty() || m_pending_ranges != nullptr;
+
+    for(auto& pending : m_pending_shards) {
+        ChannelTable *table = pending.second;
+        if(table->size() == 0) {
+            // Nobody has seen the copy yet, so it can go right away.
+            delete table;
+            table = nullptr;
+        }
+
+        auto& shard = m_channel_shards[pending.first];
+        const ChannelTable *old = shard.load(std::memory_order_relaxed);
+        shard.store(table, std::memory_order_release);
+        m_reclaimer.retire(old);
+    }
+    m_pending_shards.clear();
+
+    if(m_pending_ranges != nullptr) {
+        const RangeIndex *old = m_range_subscriptions.load(std::memory_order_relaxed);
+        m_range_subscriptions.store(m_pending_ranges, std::memory_order_release);
+        m_reclaimer.retire(old);
+        m_pending_ranges = nullptr;
+    }
+
+    // Readers which see the new epoch are guaranteed to see the new snapshot too.
+    if(changed) {
+        m_subscription_epoch.fetch_add(1, std::memory_order_release);
+    }
+
+    m_reclaimer.reclaim();
+}
+
+void ChannelMap::subscribe_channel(ChannelSubscriber *p, channel_t c)
+{
+    WriteScope scope(this);
+
+    if(has_subscription(p, c)) {
+        return;
+    }
+
+    p->channels().insert(p->channels().end(), c);
+
+    if(writable_channels(c).insert(c, p)) {
+        on_add_channel(c);
+    }
+}
+
+bool ChannelMap::remove_subscriber(ChannelSubscriber *p, channel_t c)
+{
+    WriteScope scope(this);
+    return writable_channels(c).erase(c, p);
 }
 
 void ChannelMap::unsubscribe_channel(ChannelSubscriber *p, channel_t c)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    WriteScope scope(this);
 
-    if(!is_subscribed(p, c)) {
+    if(!has_subscription(p, c)) {
         return;
     }
 
@@ -78,62 +250,31 @@ void ChannelMap::unsubscribe_channel(ChannelSubscriber *p, channel_t c)
 
 void ChannelMap::subscribe_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
-
-    // Prepare participant and range
-    std::unordered_set<ChannelSubscriber *> participant_set;
-    participant_set.insert(p);
-
-    interval_t interval = interval_t::closed(lo, hi);
+    WriteScope scope(this);
 
     // Update range mappings
-    p->ranges() += interval;
-    m_range_subscriptions += std::make_pair(interval, participant_set);
-
-    // Now, check if anything along this interval is *new*:
-    auto interval_range = m_range_subscriptions.equal_range(interval);
-    for(auto it = interval_range.first; it != interval_range.second; ++it) {
-        if(it->second.size() == 1) {
-            // There's a segment of the interval that has only one element
-            // (our newly added participant!) and thus, we should upstream the
-            // range addition.
-            on_add_range(lo, hi);
-            break;
-        }
+    p->ranges() += interval_t::closed(lo, hi);
+    if(writable_ranges().add(p, lo, hi)) {
+        // There's a segment of the interval that has only one element
+        // (our newly added participant!) and thus, we should upstream the
+        // range addition.
+        on_add_range(lo, hi);
     }
 }
 
 void ChannelMap::unsubscribe_range(ChannelSubscriber *p, channel_t lo, channel_t hi)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    WriteScope scope(this);
 
     // Pre-check: if there are no ranges subscribed anyway, no use doing this:
-    if(m_range_subscriptions.empty()) {
+    if(current_ranges().empty()) {
         return;
     }
 
-    // Prepare participant set
-    std::unordered_set<ChannelSubscriber *> participant_set;
-    participant_set.insert(p);
-
-    // Construct the interval we are removing, bounded to m_range_subscriptions.
-    channel_t lower = m_range_subscriptions.begin()->first.lower();
-    channel_t upper = m_range_subscriptions.rbegin()->first.upper();
-    interval_t interval = interval_t::closed(std::max(lo, lower), std::min(hi, upper));
-
-    // Calculate the ranges that will "go silent" as a result of our removal:
-    auto silent_ranges = boost::icl::interval_set<channel_t>(interval);
-    auto interval_range = m_range_subscriptions.equal_range(interval);
-    for(auto it = interval_range.first; it != interval_range.second; ++it) {
-        if(!it->second.empty() && !(it->second.size() == 1 && *it->second.begin() == p)) {
-            // We aren't the last subscription in this range, don't kill it.
-            silent_ranges -= it->first;
-        }
-    }
-
-    // Update range mappings
-    p->ranges() -= interval;
-    m_range_subscriptions -= std::make_pair(interval, participant_set);
+    // Update range mappings, calculating the ranges that "go silent" as a result of our removal:
+    std::vector<RangeIndex::Range> silent_ranges;
+    p->ranges() -= interval_t::closed(lo, hi);
+    writable_ranges().remove(p, lo, hi, silent_ranges);
 
     // Clobber *channel* subscriptions that fall within the range.
     for(auto it = p->channels().begin(); it != p->channels().end();) {
@@ -150,17 +291,15 @@ void ChannelMap::unsubscribe_range(ChannelSubscriber *p, channel_t lo, channel_t
 
     // Now, clean up any ranges that are now *empty* and should thus be killed:
     for(auto it = silent_ranges.begin(); it != silent_ranges.end(); ++it) {
-        get_closed_bounds(*it, lower, upper);
-
         // Okay, this part of the interval is dead, better request it be
         // sliced off:
-        on_remove_range(lower, upper);
+        on_remove_range(it->first, it->second);
     }
 }
 
 void ChannelMap::unsubscribe_all(ChannelSubscriber* p)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    WriteScope scope(this);
 
     // Unsubscribe from indivually subscribed channels
     auto channels = std::unordered_set<channel_t>(p->channels());
@@ -179,10 +318,8 @@ void ChannelMap::unsubscribe_all(ChannelSubscriber* p)
     }
 }
 
-bool ChannelMap::is_subscribed(ChannelSubscriber *p, channel_t c)
+bool ChannelMap::has_subscription(ChannelSubscriber *p, channel_t c)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
-
     if(p->channels().find(c) != p->channels().end()) {
         return true;
     }
@@ -194,19 +331,87 @@ bool ChannelMap::is_subscribed(ChannelSubscriber *p, channel_t c)
     return false;
 }
 
-void ChannelMap::lookup_channels(const std::vector<channel_t> &cl, std::unordered_set<ChannelSubscriber *> &ps)
+bool ChannelMap::is_subscribed(ChannelSubscriber *p, channel_t c)
 {
-    std::lock_guard<std::recursive_mutex> guard(m_lock);
+    EpochReclaimer::ReadGuard epoch(m_reclaimer);
+    std::unique_lock<std::recursive_mutex> guard(m_lock, std::defer_lock);
+    if(!epoch.pinned()) {
+        // Every reader slot is taken, so keep writers from freeing anything instead.
+        guard.lock();
+    }
 
+    const ChannelTable *shard = m_channel_shards[shard_of(c)].load(std::memory_order_acquire);
+    if(shard != nullptr) {
+        auto subs = shard->find(c);
+        if(subs != nullptr && std::find(subs->begin(), subs->end(), p) != subs->end()) {
+            return true;
+        }
+    }
+
+    const RangeIndex::Subscribers &range = m_range_subscriptions.load(std::memory_order_acquire)->find(c);
+    if(std::binary_search(range.begin(), range.end(), p)) {
+        return true;
+    }
+
+    return false;
+}
+
+void ChannelMap::lookup_channels(const ChannelList &cl, SubscriberList &ps)
+{
+    static thread_local SeenSubscribers seen;
+
+    EpochReclaimer::ReadGuard epoch(m_reclaimer);
+    std::unique_lock<std::recursive_mutex> guard(m_lock, std::defer_lock);
+    if(!epoch.pinned()) {
+        // Every reader slot is taken, so keep writers from freeing anything instead.
+        guard.lock();
+    }
+
+    size_t first = ps.size();
+    const RangeIndex *range_subscriptions = m_range_subscriptions.load(std::memory_order_acquire);
     for(auto it = cl.begin(); it != cl.end(); ++it) {
-        auto subs = m_channel_subscriptions.equal_range(*it);
-        for(auto it2 = subs.first; it2 != subs.second; ++it2) {
-            ps.insert(it2->second);
+        const ChannelTable *shard = m_channel_shards[shard_of(*it)].load(std::memory_order_acquire);
+        if(shard != nullptr) {
+            auto subs = shard->find(*it);
+            if(subs != nullptr) {
+                for(const auto& sub : *subs) {
+                    if(seen.insert(sub)) {
+                        ps.push_back(sub);
+                    }
+                }
+            }
         }
 
-        auto range = boost::icl::find(m_range_subscriptions, *it);
-        if(range != m_range_subscriptions.end()) {
-            ps.insert(range->second.begin(), range->second.end());
+        const RangeIndex::Subscribers &range = range_subscriptions->find(*it);
+        for(const auto& sub : range) {
+            if(seen.insert(sub)) {
+                ps.push_back(sub);
+            }
         }
     }
+
+    // Leave the bitmap clear for the thread's next lookup.
+    for(auto it = ps.begin() + first; it != ps.end(); ++it) {
+        seen.erase(*it);
+    }
+}
+
+void ChannelMap::lookup_group(const ChannelGroup &group, SubscriberList &ps)
+{
+    // The epoch is read before the lookup, so a resolution is never older than its epoch.
+    uint64_t epoch = subscription_epoch();
+
+    std::shared_ptr<const ChannelGroup::Resolution> resolution = std::atomic_load(&group.m_resolution);
+    if(resolution == nullptr || resolution->epoch != epoch) {
+        // Several threads may resolve the group at once; whichever stores last wins,
+        // and at worst the group is resolved again next time.
+        std::shared_ptr<ChannelGroup::Resolution> fresh(new ChannelGroup::Resolution);
+        fresh->epoch = epoch;
+        lookup_channels(group.channels(), fresh->subscribers);
+
+        resolution = std::move(fresh);
+        std::atomic_store(&group.m_resolution, resolution);
+    }
+
+    ps.append(resolution->subscribers.begin(), resolution->subscribers.end());
 }
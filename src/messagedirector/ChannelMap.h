@@ -3,13 +3,31 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
 #include "core/types.h"
-#include <boost/icl/interval_map.hpp>
+#include "util/EpochReclaimer.h"
+#include "ChannelTable.h"
+#include "RangeIndex.h"
+#include "util/SmallVector.h"
+#include <boost/icl/interval_set.hpp>
+
+class ChannelGroup;
 
 class ChannelSubscriber
 {
   public:
-    virtual ~ChannelSubscriber() {}
+    ChannelSubscriber();
+    virtual ~ChannelSubscriber();
+
+    ChannelSubscriber(const ChannelSubscriber&) = delete;
+    ChannelSubscriber& operator=(const ChannelSubscriber&) = delete;
+
+    // subscriber_index returns a small number which is unique among the living subscribers.
+    // Indices are reused once a subscriber is destroyed, so they stay densely packed.
+    inline size_t subscriber_index() const
+    {
+        return m_index;
+    }
 
     inline std::unordered_set<channel_t> &channels()
     {
@@ -21,6 +39,7 @@ class ChannelSubscriber
     }
 
   private:
+    size_t m_index;
     std::unordered_set<channel_t> m_channels; // The set of all individually subscribed channels.
     boost::icl::interval_set<channel_t> m_ranges; // The set of all subscribed channel ranges.
 };
@@ -28,10 +47,20 @@ class ChannelSubscriber
 // ChannelMap is a convenience template. It provides functionality for mapping
 // channels (as channel_t) to objects interested in that channel (represented as
 // the template class).
+// Lookups never take a lock: readers see an immutable snapshot of the subscriptions,
+// while writers serialize on a lock, copy the parts of the snapshot they change, and
+// publish the copies once they are done.  Replaced parts of the snapshot are only
+// deleted once no reader can still be looking at them.
 class ChannelMap
 {
   public:
+    // A datagram's channels and the subscribers it is routed to are collected in these,
+    // which only allocate when a datagram has an unusually long list of either.
+    typedef SmallVector<channel_t, 32> ChannelList;
+    typedef SmallVector<ChannelSubscriber*, 64> SubscriberList;
+
     ChannelMap();
+    virtual ~ChannelMap();
 
     // subscribe_channel adds a single channel to the mapping.
     // (Args) "c": the channel to be added.
@@ -65,8 +94,20 @@ class ChannelMap
     // is_subscribed tests if a given object has a subscription on a channel.
     bool is_subscribed(ChannelSubscriber *p, channel_t c);
 
-    // lookup_channels is the same, but it works on a list of channels.
-    void lookup_channels(const std::vector<channel_t> &cl, std::unordered_set<ChannelSubscriber *> &ps);
+    // lookup_channels appends every subscriber of any of the given channels to ps.
+    // Each subscriber is only appended once, even if it is subscribed to several of the channels.
+    void lookup_channels(const ChannelList &cl, SubscriberList &ps);
+
+    // lookup_group appends every subscriber of any of the group's channels to ps, as if by
+    //     lookup_channels.  The group's subscribers are only looked up again when the
+    //     subscriptions have changed since they were last resolved.
+    void lookup_group(const ChannelGroup &group, SubscriberList &ps);
+
+    // subscription_epoch returns a number which changes whenever any subscription changes.
+    inline uint64_t subscription_epoch() const
+    {
+        return m_subscription_epoch.load(std::memory_order_acquire);
+    }
 
   protected:
     virtual void on_add_channel(channel_t) { }
@@ -78,12 +119,36 @@ class ChannelMap
     virtual void on_remove_range(channel_t, channel_t) { }
 
   private:
-    // Single channel subscriptions
-    std::unordered_multimap<channel_t, ChannelSubscriber *> m_channel_subscriptions;
+    class WriteScope;
+
+    // Single channel subscriptions, split into shards so that a writer only has to copy
+    // the shard holding the channel it changes.  An empty shard may be null.
+    static const size_t channel_shard_bits = 12;
+    static const size_t channel_shard_count = size_t(1) << channel_shard_bits;
+    std::atomic<const ChannelTable*> m_channel_shards[channel_shard_count];
 
     // Range channel subscriptions
-    boost::icl::interval_map<channel_t, std::unordered_set<ChannelSubscriber *> > m_range_subscriptions;
+    std::atomic<const RangeIndex*> m_range_subscriptions;
+
+    // The copies being modified by the current writer, published when it finishes.
+    std::vector<std::pair<size_t, ChannelTable*> > m_pending_shards;
+    RangeIndex *m_pending_ranges;
+    unsigned int m_write_depth;
 
-    // In order to make this object thread-safe...
+    // Incremented after each publish, once the new snapshot is visible to readers.
+    std::atomic<uint64_t> m_subscription_epoch;
+
+    EpochReclaimer m_reclaimer;
+
+    // In order to make writes thread-safe...
     std::recursive_mutex m_lock;
+
+    static size_t shard_of(channel_t c);
+    ChannelTable &writable_channels(channel_t c);
+    RangeIndex &writable_ranges();
+    const RangeIndex &current_ranges();
+    void publish();
+
+    // has_subscription is is_subscribed for writers, who may have unpublished changes.
+    bool has_subscription(ChannelSubscriber *p, channel_t c);
 };
@@ -0,0 +1,115 @@
+#include "ChannelTable.h"
+#include <algorithm>
+#include <functional>
+
+static const size_t min_slot_count = 16;
+
+ChannelTable::ChannelTable() : m_slots(min_slot_count), m_mask(min_slot_count - 1), m_count(0)
+{
+}
+
+size_t ChannelTable::home_of(channel_t c) const
+{
+    // std::hash is the identity for integers, and channels are often sequential or only
+    // differ in their upper bits (e.g. location channels), so mix the bits before masking.
+    uint64_t h = std::hash<channel_t>()(c);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h & m_mask;
+}
+
+size_t ChannelTable::find_slot(channel_t c) const
+{
+    // Returns the slot holding the channel, or the empty slot where it would be inserted.
+    size_t i = home_of(c);
+    while(!m_slots[i].subscribers.empty() && m_slots[i].channel != c) {
+        i = (i + 1) & m_mask;
+    }
+    return i;
+}
+
+const ChannelTable::Subscribers *ChannelTable::find(channel_t c) const
+{
+    const Slot &slot = m_slots[find_slot(c)];
+    if(slot.subscribers.empty()) {
+        return nullptr;
+    }
+    return &slot.subscribers;
+}
+
+bool ChannelTable::insert(channel_t c, ChannelSubscriber *p)
+{
+    Slot *slot = &m_slots[find_slot(c)];
+    if(!slot->subscribers.empty()) {
+        slot->subscribers.push_back(p);
+        return false;
+    }
+
+    // Keep the table at most 3/4 full so probe sequences stay short.
+    if((m_count + 1) * 4 > m_slots.size() * 3) {
+        rehash(m_slots.size() * 2);
+        slot = &m_slots[find_slot(c)];
+    }
+
+    slot->channel = c;
+    slot->subscribers.push_back(p);
+    ++m_count;
+    return true;
+}
+
+bool ChannelTable::erase(channel_t c, ChannelSubscriber *p)
+{
+    size_t i = find_slot(c);
+    Subscribers &subscribers = m_slots[i].subscribers;
+
+    auto it = std::find(subscribers.begin(), subscribers.end(), p);
+    if(it == subscribers.end()) {
+        return false;
+    }
+
+    subscribers.erase_unordered(it);
+    if(!subscribers.empty()) {
+        return false;
+    }
+
+    // The channel is gone; release any heap storage and close the gap it leaves behind
+    // by shifting back the entries after it which would otherwise become unreachable.
+    subscribers = Subscribers();
+    --m_count;
+
+    size_t hole = i;
+    for(size_t j = (i + 1) & m_mask; !m_slots[j].subscribers.empty(); j = (j + 1) & m_mask) {
+        size_t home = home_of(m_slots[j].channel);
+        // Only move the entry if its home isn't cyclically within (hole, j].
+        if(((j - home) & m_mask) >= ((j - hole) & m_mask)) {
+            m_slots[hole].channel = m_slots[j].channel;
+            m_slots[hole].subscribers = std::move(m_slots[j].subscribers);
+            hole = j;
+        }
+    }
+
+    // Give memory back once most channels have been unsubscribed.
+    if(m_slots.size() > min_slot_count && m_count * 8 < m_slots.size()) {
+        rehash(m_slots.size() / 2);
+    }
+
+    return true;
+}
+
+void ChannelTable::rehash(size_t slot_count)
+{
+    std::vector<Slot> old_slots(slot_count);
+    old_slots.swap(m_slots);
+    m_mask = slot_count - 1;
+
+    for(auto& old_slot : old_slots) {
+        if(!old_slot.subscribers.empty()) {
+            Slot &slot = m_slots[find_slot(old_slot.channel)];
+            slot.channel = old_slot.channel;
+            slot.subscribers = std::move(old_slot.subscribers);
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include "core/types.h"
+#include "util/SmallVector.h"
+
+class ChannelSubscriber;
+
+// A ChannelTable maps individual channels to the subscribers interested in them.
+// It is an open-addressing hash table using linear probing, where each slot holds the
+//     channel alongside its subscribers, so a lookup of a channel with a handful of
+//     subscribers touches a single cache line and never chases a node pointer.
+class ChannelTable
+{
+  public:
+    typedef SmallVector<ChannelSubscriber*, 4> Subscribers;
+
+    ChannelTable();
+
+    // find returns the subscribers of a channel, or nullptr if it has none.
+    const Subscribers *find(channel_t c) const;
+
+    // insert adds a subscriber to a channel.
+    // Returns true if the subscriber is the channel's first.
+    bool insert(channel_t c, ChannelSubscriber *p);
+
+    // erase removes a subscriber from a channel.
+    // Returns true only if the subscriber was found and was the channel's last.
+    bool erase(channel_t c, ChannelSubscriber *p);
+
+    // size returns the number of channels with at least one subscriber.
+    inline size_t size() const
+    {
+        return m_count;
+    }
+
+  private:
+    // A slot is empty when it has no subscribers.
+    struct Slot {
+        channel_t channel;
+        Subscribers subscribers;
+    };
+
+    std::vector<Slot> m_slots;
+    size_t m_mask;
+    size_t m_count;
+
+    size_t home_of(channel_t c) const;
+    size_t find_slot(channel_t c) const;
+    void rehash(size_t slot_count);
+};
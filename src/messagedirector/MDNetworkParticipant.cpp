@@ -21,6 +21,13 @@ void MDNetworkParticipant::handle_datagram(DatagramHandle dg, DatagramIterator&)
     m_client->send_datagram(dg);
 }
 
+void MDNetworkParticipant::handle_datagrams(DatagramSpan dgs)
+{
+    logger().trace() << "MDNetworkParticipant sending " << dgs.size()
+                     << " datagrams to downstream MD" << std::endl;
+    m_client->send_datagrams(dgs);
+}
+
 void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
 {
     DatagramIterator dgi(dg);
@@ -29,24 +36,24 @@ void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
         if(channels == 1 && dgi.read_channel() == CONTROL_MESSAGE) {
             uint16_t msg_type = dgi.read_uint16();
             switch(msg_type) {
-                case CONTROL_ADD_CHANNEL: {
-                    subscribe_channel(dgi.read_channel());
-                    break;
-                }
-                case CONTROL_REMOVE_CHANNEL: {
-                    unsubscribe_channel(dgi.read_channel());
-                    break;
-                }
-                case CONTROL_ADD_RANGE: {
-                    channel_t lo = dgi.read_channel();
-                    channel_t hi = dgi.read_channel();
-                    subscribe_range(lo, hi);
+                case CONTROL_ADD_CHANNEL:
+                case CONTROL_REMOVE_CHANNEL:
+                case CONTROL_ADD_RANGE:
+                case CONTROL_REMOVE_RANGE: {
+                    handle_subscription(msg_type, dgi);
                     break;
                 }
-                case CONTROL_REMOVE_RANGE: {
-                    channel_t lo = dgi.read_channel();
-                    channel_t hi = dgi.read_channel();
-                    unsubscribe_range(lo, hi);
+                case CONTROL_SUBSCRIPTION_BATCH: {
+                    uint16_t count = dgi.read_uint16();
+                    for(uint16_t i = 0; i < count; ++i) {
+                        uint16_t change_type = dgi.read_uint16();
+                        if(!handle_subscription(change_type, dgi)) {
+                            // We can't tell how long it is, so the rest of the batch is lost.
+                            logger().error() << "MDNetworkParticipant got unknown message type "
+                                             << change_type << " in a subscription batch" << std::endl;
+                            break;
+                        }
+                    }
                     break;
                 }
                 case CONTROL_ADD_POST_REMOVE: {
@@ -85,6 +92,34 @@ void MDNetworkParticipant::receive_datagram(DatagramHandle dg)
     route_datagram(dg);
 }
 
+bool MDNetworkParticipant::handle_subscription(uint16_t msg_type, DatagramIterator &dgi)
+{
+    switch(msg_type) {
+        case CONTROL_ADD_CHANNEL: {
+            subscribe_channel(dgi.read_channel());
+            return true;
+        }
+        case CONTROL_REMOVE_CHANNEL: {
+            unsubscribe_channel(dgi.read_channel());
+            return true;
+        }
+        case CONTROL_ADD_RANGE: {
+            channel_t lo = dgi.read_channel();
+            channel_t hi = dgi.read_channel();
+            subscribe_range(lo, hi);
+            return true;
+        }
+        case CONTROL_REMOVE_RANGE: {
+            channel_t lo = dgi.read_channel();
+            channel_t hi = dgi.read_channel();
+            unsubscribe_range(lo, hi);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
 void MDNetworkParticipant::receive_disconnect(const uvw::ErrorEvent &evt)
 {
     logger().info() << "Lost connection from "
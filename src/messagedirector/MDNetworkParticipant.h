@@ -13,9 +13,36 @@ class MDNetworkParticipant : public MDParticipantInterface, public NetworkHandle
     }
 
     virtual void handle_datagram(DatagramHandle dg, DatagramIterator &dgi);
+    virtual void handle_datagrams(DatagramSpan dgs);
+    virtual bool accepts_batches() const
+    {
+        // We only forward datagrams downstream; our subscriptions come from the network.
+        return true;
+    }
+    virtual size_t queued_datagrams()
+    {
+        return m_client->queued_datagrams();
+    }
+    virtual size_t drop_queued_datagrams(size_t count)
+    {
+        return m_client->drop_queued_datagrams(count);
+    }
+    virtual IoLoop *get_io_loop()
+    {
+        return m_client->get_io_loop();
+    }
+    virtual void handle_overflow()
+    {
+        // We're terminated once the NetworkClient reports the connection closed.
+        m_client->disconnect(UV_ENOBUFS);
+    }
   private:
     virtual void receive_datagram(DatagramHandle dg);
     virtual void receive_disconnect(const uvw::ErrorEvent &evt);
 
+    // handle_subscription applies a CONTROL_ADD/REMOVE_CHANNEL/RANGE message's arguments,
+    //     returning false if msg_type isn't one of those.
+    bool handle_subscription(uint16_t msg_type, DatagramIterator &dgi);
+
     std::shared_ptr<NetworkClient> m_client;
 };
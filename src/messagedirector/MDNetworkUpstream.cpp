@@ -4,11 +4,50 @@
 #include "core/global.h"
 #include "core/msgtypes.h"
 
-MDNetworkUpstream::MDNetworkUpstream(MessageDirector *md) :
+// The most subscription changes sent in one CONTROL_SUBSCRIPTION_BATCH,
+// which keeps even a batch of ranges well within a datagram.
+static const size_t max_control_batch = 2048;
+
+MDNetworkUpstream::MDNetworkUpstream(MessageDirector *md, unsigned int control_window) :
     m_message_director(md), m_client(std::make_shared<NetworkClient>(this)),
-    m_connector(std::make_shared<NetworkConnector>(g_loop))
+    m_connector(std::make_shared<NetworkConnector>(g_loop)), m_control_window(control_window)
+{
+    if(m_control_window > 0) {
+        m_control_timer = g_loop->resource<uvw::TimerHandle>();
+        m_control_timer->on<uvw::TimerEvent>([self = this](const uvw::TimerEvent&, uvw::TimerHandle&) {
+            self->flush_control();
+        });
+    }
+}
+
+MDNetworkUpstream::~MDNetworkUpstream()
+{
+    // Only upstreams whose loss isn't fatal are ever deleted, on the main thread.
+    assert(std::this_thread::get_id() == g_main_thread_id);
+
+    if(m_control_timer) {
+        m_control_timer->stop();
+        m_control_timer->close();
+    }
+    if(m_connector) {
+        m_connector->destroy();
+    }
+    m_client->disconnect();
+}
+
+void MDNetworkUpstream::set_link_callbacks(UpstreamConnectedCallback connected, UpstreamLostCallback lost)
 {
+    m_connected_callback = connected;
+    m_lost_callback = lost;
+}
 
+void MDNetworkUpstream::lost(const uvw::ErrorEvent &evt)
+{
+    if(m_lost_callback) {
+        m_lost_callback(evt);
+    } else {
+        m_message_director->receive_disconnect(evt);
+    }
 }
 
 void MDNetworkUpstream::connect(const std::string &address)
@@ -22,6 +61,10 @@ void MDNetworkUpstream::connect(const std::string &address)
 void MDNetworkUpstream::on_connect(const std::shared_ptr<uvw::TcpHandle> &socket)
 {
     if(socket == nullptr) {
+        if(m_lost_callback) {
+            m_lost_callback(uvw::ErrorEvent{(int)UV_EADDRNOTAVAIL});
+            return;
+        }
         m_message_director->receive_disconnect(uvw::ErrorEvent{(int)UV_EADDRNOTAVAIL});
         exit(1);
     }
@@ -35,6 +78,10 @@ void MDNetworkUpstream::on_connect(const std::shared_ptr<uvw::TcpHandle> &socket
 
     m_connector->destroy();
     m_connector = nullptr;
+
+    if(m_connected_callback) {
+        m_connected_callback();
+    }
 }
 
 void MDNetworkUpstream::send_datagram(DatagramHandle dg)
@@ -68,13 +115,131 @@ void MDNetworkUpstream::flush_send_queue()
     m_is_sending = false;
 }
 
+std::queue<DatagramHandle> MDNetworkUpstream::take_backlog()
+{
+    std::queue<DatagramHandle> backlog;
+    if(!m_initialized) {
+        std::lock_guard<std::mutex> lock(m_messages_lock);
+        std::swap(backlog, m_messages);
+    }
+    return backlog;
+}
+
 void MDNetworkUpstream::on_connect_error(const uvw::ErrorEvent& evt)
 {
-    m_message_director->receive_disconnect(evt);
+    lost(evt);
+}
+
+void MDNetworkUpstream::queue_control(uint16_t msg_type, channel_t lo, channel_t hi)
+{
+    std::unique_lock<std::mutex> lock(m_control_lock);
+
+    if(msg_type == CONTROL_ADD_CHANNEL || msg_type == CONTROL_REMOVE_CHANNEL) {
+        // Adding a channel and removing it again (or the reverse) cancels out,
+        // unless a range change in between might have touched the channel.
+        uint16_t opposite = msg_type == CONTROL_ADD_CHANNEL ? CONTROL_REMOVE_CHANNEL : CONTROL_ADD_CHANNEL;
+        auto it = m_channel_ops.find(lo);
+        if(it != m_channel_ops.end() && it->second >= m_range_barrier &&
+           m_control_ops[it->second].msg_type == opposite) {
+            m_control_ops[it->second].msg_type = RESERVED_MSG_TYPE;
+            --m_live_control_ops;
+            m_channel_ops.erase(it);
+            return;
+        }
+        m_channel_ops[lo] = m_control_ops.size();
+    } else {
+        // A range only cancels out the change just before it, since anything
+        // in between might overlap it.
+        uint16_t opposite = msg_type == CONTROL_ADD_RANGE ? CONTROL_REMOVE_RANGE : CONTROL_ADD_RANGE;
+        if(!m_control_ops.empty()) {
+            ControlOp &last = m_control_ops.back();
+            if(last.msg_type == opposite && last.lo == lo && last.hi == hi) {
+                last.msg_type = RESERVED_MSG_TYPE;
+                --m_live_control_ops;
+                return;
+            }
+        }
+        m_range_barrier = m_control_ops.size() + 1;
+    }
+
+    bool window_opened = m_control_ops.empty();
+    m_control_ops.push_back(ControlOp{msg_type, lo, hi});
+    ++m_live_control_ops;
+    m_control_pending.store(true, std::memory_order_release);
+
+    if(m_control_ops.size() >= max_control_batch) {
+        flush_control(lock);
+    } else if(window_opened) {
+        // The timer belongs to the main loop, so it's only started there.
+        if(std::this_thread::get_id() == g_main_thread_id) {
+            m_control_timer->start(uvw::TimerHandle::Time{m_control_window}, uvw::TimerHandle::Time{0});
+        } else {
+            TaskQueue::singleton.enqueue_task([self = this]() {
+                self->m_control_timer->start(uvw::TimerHandle::Time{self->m_control_window},
+                                             uvw::TimerHandle::Time{0});
+            });
+        }
+    }
+}
+
+void MDNetworkUpstream::flush_control()
+{
+    std::unique_lock<std::mutex> lock(m_control_lock);
+    flush_control(lock);
+}
+
+void MDNetworkUpstream::flush_control(std::unique_lock<std::mutex> &)
+{
+    if(m_control_ops.empty()) {
+        return;
+    }
+
+    DatagramPtr dg;
+    if(m_live_control_ops == 1) {
+        // A lone change goes out as its usual control message.
+        for(const auto& op : m_control_ops) {
+            if(op.msg_type != RESERVED_MSG_TYPE) {
+                dg = Datagram::create(op.msg_type);
+                dg->add_channel(op.lo);
+                if(op.msg_type == CONTROL_ADD_RANGE || op.msg_type == CONTROL_REMOVE_RANGE) {
+                    dg->add_channel(op.hi);
+                }
+            }
+        }
+    } else if(m_live_control_ops > 1) {
+        dg = Datagram::create(CONTROL_SUBSCRIPTION_BATCH);
+        dg->add_uint16(m_live_control_ops);
+        for(const auto& op : m_control_ops) {
+            if(op.msg_type == RESERVED_MSG_TYPE) {
+                continue;
+            }
+            dg->add_uint16(op.msg_type);
+            dg->add_channel(op.lo);
+            if(op.msg_type == CONTROL_ADD_RANGE || op.msg_type == CONTROL_REMOVE_RANGE) {
+                dg->add_channel(op.hi);
+            }
+        }
+    }
+
+    m_control_ops.clear();
+    m_channel_ops.clear();
+    m_live_control_ops = 0;
+    m_range_barrier = 0;
+    m_control_pending.store(false, std::memory_order_relaxed);
+
+    // N.B. this is sent with the lock still held, so the changes can't be overtaken.
+    if(dg) {
+        send_datagram(dg);
+    }
 }
 
 void MDNetworkUpstream::subscribe_channel(channel_t c)
 {
+    if(m_control_window > 0) {
+        queue_control(CONTROL_ADD_CHANNEL, c);
+        return;
+    }
+
     DatagramPtr dg = Datagram::create(CONTROL_ADD_CHANNEL);
     dg->add_channel(c);
     send_datagram(dg);
@@ -82,6 +247,11 @@ void MDNetworkUpstream::subscribe_channel(channel_t c)
 
 void MDNetworkUpstream::unsubscribe_channel(channel_t c)
 {
+    if(m_control_window > 0) {
+        queue_control(CONTROL_REMOVE_CHANNEL, c);
+        return;
+    }
+
     DatagramPtr dg = Datagram::create(CONTROL_REMOVE_CHANNEL);
     dg->add_channel(c);
     send_datagram(dg);
@@ -89,6 +259,11 @@ void MDNetworkUpstream::unsubscribe_channel(channel_t c)
 
 void MDNetworkUpstream::subscribe_range(channel_t lo, channel_t hi)
 {
+    if(m_control_window > 0) {
+        queue_control(CONTROL_ADD_RANGE, lo, hi);
+        return;
+    }
+
     DatagramPtr dg = Datagram::create(CONTROL_ADD_RANGE);
     dg->add_channel(lo);
     dg->add_channel(hi);
@@ -97,6 +272,11 @@ void MDNetworkUpstream::subscribe_range(channel_t lo, channel_t hi)
 
 void MDNetworkUpstream::unsubscribe_range(channel_t lo, channel_t hi)
 {
+    if(m_control_window > 0) {
+        queue_control(CONTROL_REMOVE_RANGE, lo, hi);
+        return;
+    }
+
     DatagramPtr dg = Datagram::create(CONTROL_REMOVE_RANGE);
     dg->add_channel(lo);
     dg->add_channel(hi);
@@ -105,6 +285,12 @@ void MDNetworkUpstream::unsubscribe_range(channel_t lo, channel_t hi)
 
 void MDNetworkUpstream::handle_datagram(DatagramHandle dg)
 {
+    // Anything routed after a subscription change may be answered on the new
+    // subscriptions, so the changes held back so far have to go out first.
+    if(m_control_pending.load(std::memory_order_acquire)) {
+        flush_control();
+    }
+
     send_datagram(dg);
 }
 
@@ -115,5 +301,5 @@ void MDNetworkUpstream::receive_datagram(DatagramHandle dg)
 
 void MDNetworkUpstream::receive_disconnect(const uvw::ErrorEvent &evt)
 {
-    m_message_director->receive_disconnect(evt);
+    lost(evt);
 }
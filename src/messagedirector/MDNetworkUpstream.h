@@ -1,15 +1,28 @@
 #pragma once
+#include <unordered_map>
 #include "MessageDirector.h"
 #include "net/NetworkClient.h"
 #include "net/NetworkConnector.h"
 
-// All MDUpstreams must be thread-safe. This class does not need a lock, however,
-// because all of its operations are based on local variables and the functions
-// of NetworkClient (which are themselves thread-safe)
+typedef std::function<void()> UpstreamConnectedCallback;
+typedef std::function<void(const uvw::ErrorEvent&)> UpstreamLostCallback;
+
+// All MDUpstreams must be thread-safe. Datagrams go straight to the NetworkClient
+// (which is itself thread-safe); only the subscription changes held back for the
+// control window need a lock of their own.
 class MDNetworkUpstream : public NetworkHandler, public MDUpstream
 {
   public:
-    MDNetworkUpstream(MessageDirector *md);
+    // If control_window is nonzero, subscription changes are held back for up to that many
+    //     milliseconds: changes which undo each other are never sent, and the rest go out
+    //     together in a CONTROL_SUBSCRIPTION_BATCH.
+    MDNetworkUpstream(MessageDirector *md, unsigned int control_window = 0);
+    ~MDNetworkUpstream();
+
+    // set_link_callbacks has the upstream report its connection being established or lost
+    //     (including failing to connect) to the callbacks, instead of the loss being fatal.
+    //     It must be called before connect().
+    void set_link_callbacks(UpstreamConnectedCallback connected, UpstreamLostCallback lost);
 
     void connect(const std::string &address);
     void on_connect(const std::shared_ptr<uvw::TcpHandle> &socket);
@@ -18,6 +31,9 @@ class MDNetworkUpstream : public NetworkHandler, public MDUpstream
     // Queueing interfaces for datagrams pending being sent upstream.
     void send_datagram(DatagramHandle dg);
     void flush_send_queue();
+    // take_backlog hands over the datagrams still waiting for the connection to be established,
+    //     so that they aren't lost along with an upstream which never connected.
+    std::queue<DatagramHandle> take_backlog();
 
     // Interfaces that MDUpstream needs us to implement:
     virtual void subscribe_channel(channel_t c);
@@ -43,4 +59,30 @@ class MDNetworkUpstream : public NetworkHandler, public MDUpstream
     std::queue<DatagramHandle> m_messages;
     bool m_initialized = false;
     bool m_is_sending = false;
+    UpstreamConnectedCallback m_connected_callback;
+    UpstreamLostCallback m_lost_callback;
+
+    void lost(const uvw::ErrorEvent &evt);
+
+    // A ControlOp is a subscription change waiting for the control window to close.
+    struct ControlOp {
+        uint16_t msg_type; // RESERVED_MSG_TYPE once it has been cancelled out.
+        channel_t lo;
+        channel_t hi;      // Only used by ranges.
+    };
+
+    unsigned int m_control_window;
+    std::shared_ptr<uvw::TimerHandle> m_control_timer;
+    std::mutex m_control_lock;
+    std::vector<ControlOp> m_control_ops;
+    size_t m_live_control_ops = 0;
+    // The index of the pending op for each channel; ops before m_range_barrier are
+    // followed by a range change, so they can no longer be cancelled out.
+    std::unordered_map<channel_t, size_t> m_channel_ops;
+    size_t m_range_barrier = 0;
+    std::atomic<bool> m_control_pending {false};
+
+    void queue_control(uint16_t msg_type, channel_t lo, channel_t hi = 0);
+    void flush_control();
+    void flush_control(std::unique_lock<std::mutex> &lock);
 };
@@ -0,0 +1,324 @@
+#include "MDUpstreamGroup.h"
+#include "core/global.h"
+#include "core/msgtypes.h"
+
+// How long to wait before trying to reconnect to a lost upstream.
+static const unsigned int link_retry_interval = 5000; // ms
+
+MDUpstreamGroup::MDUpstreamGroup(MessageDirector *md, const std::vector<std::string> &addresses,
+                                 unsigned int control_window) :
+    m_message_director(md), m_control_window(control_window), m_live(0)
+{
+    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(addresses.size() <= 64);
+
+    for(unsigned int i = 0; i < addresses.size(); ++i) {
+        Link link;
+        link.address = addresses[i];
+        link.upstream = nullptr;
+        link.retired = nullptr;
+        link.retry_timer = g_loop->resource<uvw::TimerHandle>();
+        link.retry_timer->on<uvw::TimerEvent>([self = this, i](const uvw::TimerEvent&, uvw::TimerHandle&) {
+            self->start_link(i);
+        });
+        m_links.push_back(link);
+    }
+}
+
+MDUpstreamGroup::~MDUpstreamGroup()
+{
+    for(auto& link : m_links) {
+        link.retry_timer->stop();
+        link.retry_timer->close();
+        delete link.upstream;
+        delete link.retired;
+    }
+}
+
+void MDUpstreamGroup::connect()
+{
+    // Every upstream is treated as live while it first connects, so that anything sent
+    // in the meantime is queued on it (as with a single upstream) rather than dropped.
+    // They're all put in place before any of them connects, since a connect may fail
+    // straight away and move its channels to the others.
+    std::vector<MDNetworkUpstream*> upstreams;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for(unsigned int i = 0; i < m_links.size(); ++i) {
+            upstreams.push_back(create_link(i));
+            m_live |= uint64_t(1) << i;
+        }
+    }
+
+    // N.B. these may report their links lost straight away, so the lock can't be held.
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        upstreams[i]->connect(m_links[i].address);
+    }
+}
+
+void MDUpstreamGroup::start_link(unsigned int index)
+{
+    assert(std::this_thread::get_id() == g_main_thread_id);
+
+    MDNetworkUpstream *upstream;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        upstream = create_link(index);
+    }
+
+    // N.B. this may report the link lost straight away, so the lock can't be held.
+    upstream->connect(m_links[index].address);
+}
+
+MDNetworkUpstream *MDUpstreamGroup::create_link(unsigned int index)
+{
+    MDNetworkUpstream *upstream = new MDNetworkUpstream(m_message_director, m_control_window);
+    upstream->set_link_callbacks([this, index]() {
+        link_connected(index);
+    }, [this, index](const uvw::ErrorEvent &evt) {
+        link_lost(index, evt);
+    });
+
+    Link &link = m_links[index];
+    delete link.retired;
+    link.retired = nullptr;
+    link.upstream = upstream;
+    return upstream;
+}
+
+void MDUpstreamGroup::link_connected(unsigned int index)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_message_director->logger().info() << "Connected to upstream MD at "
+                                        << m_links[index].address << std::endl;
+
+    uint64_t bit = uint64_t(1) << index;
+    if(!(m_live & bit)) {
+        set_live(m_live | bit);
+    }
+}
+
+void MDUpstreamGroup::link_lost(unsigned int index, const uvw::ErrorEvent &evt)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    Link &link = m_links[index];
+    m_message_director->logger().error() << "Lost upstream MD at " << link.address << ": "
+                                         << evt.what() << std::endl;
+
+    // The upstream can't be deleted from inside its own callback, so that waits for the retry.
+    link.retired = link.upstream;
+    link.upstream = nullptr;
+
+    uint64_t bit = uint64_t(1) << index;
+    if(m_live & bit) {
+        if(m_live == bit) {
+            // There's nowhere left for its channels to go.  This exits, so the lock is let
+            // go first rather than left held for anything still running during shutdown.
+            lock.unlock();
+            m_message_director->receive_disconnect(evt);
+            return;
+        }
+        set_live(m_live & ~bit);
+
+        // A link which failed its first connect still has everything sent to it queued up.
+        // Its post removes have just been moved by set_live, and subscriptions and control
+        // messages for the link itself were sent to every upstream, but the datagrams have
+        // to go to their new owners.
+        std::queue<DatagramHandle> backlog = link.retired->take_backlog();
+        while(!backlog.empty()) {
+            reroute(backlog.front());
+            backlog.pop();
+        }
+    }
+
+    link.retry_timer->start(uvw::TimerHandle::Time{link_retry_interval}, uvw::TimerHandle::Time{0});
+}
+
+unsigned int MDUpstreamGroup::owner(channel_t c, uint64_t live)
+{
+    // Rendezvous hashing: the live link with the highest score for the channel wins, so
+    // losing a link only moves its own share, and it moves back when the link returns.
+    unsigned int best = 0;
+    uint64_t best_score = 0;
+    for(unsigned int i = 0; i < 64 && (live >> i) != 0; ++i) {
+        if(!(live & (uint64_t(1) << i))) {
+            continue;
+        }
+
+        uint64_t score = c ^ (0x9e3779b97f4a7c15ULL * (i + 1));
+        score ^= score >> 33;
+        score *= 0xff51afd7ed558ccdULL;
+        score ^= score >> 33;
+        score *= 0xc4ceb9fe1a85ec53ULL;
+        score ^= score >> 33;
+        if(score >= best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+void MDUpstreamGroup::set_live(uint64_t live)
+{
+    uint64_t old_live = m_live;
+    m_live = live;
+
+    // Links that are new to the group need every subscription:
+    uint64_t added = live & ~old_live;
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        if(!(added & (uint64_t(1) << i))) {
+            continue;
+        }
+        for(const auto& c : m_channels) {
+            m_links[i].upstream->subscribe_channel(c);
+        }
+        for(const auto& range : m_ranges) {
+            m_links[i].upstream->subscribe_range(range.lower(), range.upper());
+        }
+    }
+
+    // Move the post removes of each sender whose owner changed:
+    for(const auto& it : m_post_removes) {
+        unsigned int from = owner(it.first, old_live);
+        unsigned int to = owner(it.first, live);
+        if(from == to) {
+            continue;
+        }
+        if(live & (uint64_t(1) << from)) {
+            DatagramPtr clear = Datagram::create(CONTROL_CLEAR_POST_REMOVES);
+            clear->add_channel(it.first);
+            m_links[from].upstream->handle_datagram(clear);
+        }
+        for(const auto& post_remove : it.second) {
+            send_post_remove(it.first, post_remove);
+        }
+    }
+}
+
+void MDUpstreamGroup::subscribe_channel(channel_t c)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_channels.insert(c);
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        if(m_live & (uint64_t(1) << i)) {
+            m_links[i].upstream->subscribe_channel(c);
+        }
+    }
+}
+
+void MDUpstreamGroup::unsubscribe_channel(channel_t c)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_channels.erase(c);
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        if(m_live & (uint64_t(1) << i)) {
+            m_links[i].upstream->unsubscribe_channel(c);
+        }
+    }
+}
+
+void MDUpstreamGroup::subscribe_range(channel_t lo, channel_t hi)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_ranges += boost::icl::interval<channel_t>::closed(lo, hi);
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        if(m_live & (uint64_t(1) << i)) {
+            m_links[i].upstream->subscribe_range(lo, hi);
+        }
+    }
+}
+
+void MDUpstreamGroup::unsubscribe_range(channel_t lo, channel_t hi)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_ranges -= boost::icl::interval<channel_t>::closed(lo, hi);
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        if(m_live & (uint64_t(1) << i)) {
+            m_links[i].upstream->unsubscribe_range(lo, hi);
+        }
+    }
+}
+
+void MDUpstreamGroup::handle_datagram(DatagramHandle dg)
+{
+    channel_t first;
+    DatagramIterator dgi(dg);
+    try {
+        uint8_t channel_count = dgi.read_uint8();
+        if(channel_count == 0) {
+            return;
+        }
+        first = dgi.read_channel();
+
+        if(channel_count == 1 && first == CONTROL_MESSAGE) {
+            uint16_t msg_type = dgi.read_uint16();
+            if(msg_type == CONTROL_ADD_POST_REMOVE) {
+                channel_t sender = dgi.read_channel();
+                DatagramHandle post_remove = dgi.read_datagram();
+
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_post_removes[sender].push_back(post_remove);
+                send_post_remove(sender, post_remove);
+                return;
+            } else if(msg_type == CONTROL_CLEAR_POST_REMOVES) {
+                channel_t sender = dgi.read_channel();
+
+                std::lock_guard<std::mutex> lock(m_lock);
+                m_post_removes.erase(sender);
+                broadcast(dg);
+                return;
+            }
+
+            // Any other control message concerns the link itself, so every upstream gets it.
+            std::lock_guard<std::mutex> lock(m_lock);
+            broadcast(dg);
+            return;
+        }
+    } catch(const DatagramIteratorEOF &) {
+        m_message_director->logger().error() << "Detected truncated datagram sending upstream.\n";
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_links[owner(first, m_live)].upstream->handle_datagram(dg);
+}
+
+void MDUpstreamGroup::reroute(DatagramHandle dg)
+{
+    channel_t first;
+    DatagramIterator dgi(dg);
+    try {
+        if(dgi.read_uint8() == 0) {
+            return;
+        }
+        first = dgi.read_channel();
+    } catch(const DatagramIteratorEOF &) {
+        // It was checked on the way in, so this can't happen.
+        return;
+    }
+
+    if(first == CONTROL_MESSAGE) {
+        return;
+    }
+    m_links[owner(first, m_live)].upstream->handle_datagram(dg);
+}
+
+void MDUpstreamGroup::send_post_remove(channel_t sender, DatagramHandle post_remove)
+{
+    // Every root fires the post removes it holds when this MD goes away, so each is held
+    // by just one of them: the owner of its sender.
+    DatagramPtr dg = Datagram::create(CONTROL_ADD_POST_REMOVE);
+    dg->add_channel(sender);
+    dg->add_blob(post_remove);
+    m_links[owner(sender, m_live)].upstream->handle_datagram(dg);
+}
+
+void MDUpstreamGroup::broadcast(DatagramHandle dg)
+{
+    for(unsigned int i = 0; i < m_links.size(); ++i) {
+        if(m_live & (uint64_t(1) << i)) {
+            m_links[i].upstream->handle_datagram(dg);
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <boost/icl/interval_set.hpp>
+#include "MDNetworkUpstream.h"
+
+// An MDUpstreamGroup links the MessageDirector to several upstream MDs, splitting the routing
+//     work between them so that no single root MD has to carry the whole cluster.
+// Every root is told every subscription, so each of them can deliver any datagram to every MD
+//     connected to it.  A datagram then goes, whole, through just one root: the owner of its
+//     first recipient, picked by rendezvous hashing over the upstreams which are connected.
+//     However its recipients are spread, each MD (and so each participant) gets it once.
+// Post removes are held by the owner of their sender alone, since every root fires the ones it
+//     holds when this MD goes away.
+// Which root a datagram goes through only spreads the load; it doesn't have to agree with the
+//     choice any other MD makes, so nothing depends on every MD seeing the same links.
+// When an upstream is lost, the datagrams and post removes it owned go to the next root in
+//     their ranking (the lost root will have fired the post removes it held, as a root does for
+//     any MD it loses), and it is reconnected periodically; once it's back, they move back to it.
+//     Until then, this MD misses what other MDs route through that root for its participants.
+//     Only losing every upstream is fatal.
+class MDUpstreamGroup : public MDUpstream
+{
+  public:
+    MDUpstreamGroup(MessageDirector *md, const std::vector<std::string> &addresses,
+                    unsigned int control_window);
+    ~MDUpstreamGroup();
+
+    // connect starts connecting to every upstream.
+    void connect();
+
+    virtual void subscribe_channel(channel_t c);
+    virtual void unsubscribe_channel(channel_t c);
+    virtual void subscribe_range(channel_t lo, channel_t hi);
+    virtual void unsubscribe_range(channel_t lo, channel_t hi);
+    virtual void handle_datagram(DatagramHandle dg);
+
+  private:
+    struct Link {
+        std::string address;
+        MDNetworkUpstream *upstream;
+        MDNetworkUpstream *retired; // Lost, and waiting to be deleted on the next attempt.
+        std::shared_ptr<uvw::TimerHandle> retry_timer;
+    };
+
+    MessageDirector *m_message_director;
+    unsigned int m_control_window;
+    std::vector<Link> m_links;
+
+    // Everything below is guarded by m_lock.
+    std::mutex m_lock;
+    uint64_t m_live; // A bit for each connected link.
+    // The subscriptions, so they can be sent to upstreams as they (re)connect.
+    std::unordered_set<channel_t> m_channels;
+    boost::icl::interval_set<channel_t> m_ranges;
+    // The CONTROL_ADD_POST_REMOVE datagrams for each sender, so they can be
+    //     resent when their sender changes owner.
+    std::unordered_map<channel_t, std::vector<DatagramHandle> > m_post_removes;
+
+    // owner returns the index of the link which routes for channel c, given the live links.
+    static unsigned int owner(channel_t c, uint64_t live);
+
+    void start_link(unsigned int index);
+    // create_link puts a new, unconnected upstream in place for a link.  m_lock must be held.
+    MDNetworkUpstream *create_link(unsigned int index);
+    void link_connected(unsigned int index);
+    void link_lost(unsigned int index, const uvw::ErrorEvent &evt);
+    // set_live subscribes new links to everything and moves post removes to their new owners.
+    void set_live(uint64_t live);
+
+    // reroute sends a datagram queued on a lost link to its new owner.
+    void reroute(DatagramHandle dg);
+    void send_post_remove(channel_t sender, DatagramHandle post_remove);
+    void broadcast(DatagramHandle dg);
+};
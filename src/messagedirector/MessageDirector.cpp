@@ -1,5 +1,6 @@
 #include "MessageDirector.h"
 #include <algorithm>
+#include <chrono>
 #include <functional>
 #include <boost/icl/interval_bounds.hpp>
 
@@ -7,16 +8,50 @@
 #include "core/msgtypes.h"
 #include "config/ConfigVariable.h"
 #include "config/constraints.h"
+#include "util/AllocationCounter.h"
 #include "net/TcpAcceptor.h"
 #include "MDNetworkParticipant.h"
 #include "MDNetworkUpstream.h"
+#include "MDUpstreamGroup.h"
 
 static ConfigGroup md_config("messagedirector");
 static ConfigVariable<std::string> bind_addr("bind", "unspecified", md_config);
 static ConfigVariable<std::string> connect_addr("connect", "unspecified", md_config);
 static ValidAddressConstraint valid_bind_addr(bind_addr);
 static ValidAddressConstraint valid_connect_addr(connect_addr);
+static ConfigVariable<std::vector<std::string> > upstream_addrs("upstreams", std::vector<std::string>(), md_config);
 static ConfigVariable<bool> threaded_mode("threaded", true, md_config);
+static ConfigVariable<unsigned int> routing_threads("threads", 1, md_config);
+static ConfigVariable<unsigned int> control_window("control_window", 0, md_config);
+static ConfigVariable<unsigned int> stats_interval("stats_interval", 0, md_config);
+
+// The number of datagrams that may be waiting to be routed before producers have to wait.
+static const size_t message_queue_size = 65536;
+
+// Set on the routing thread, which has to handle its own datagrams specially when the queue fills.
+static thread_local bool is_routing_thread = false;
+
+static bool is_positive_thread_count(const unsigned int& threads)
+{
+    return threads > 0;
+}
+static ConfigConstraint<unsigned int> threads_is_positive(is_positive_thread_count, routing_threads,
+        "The MessageDirector needs at least one routing thread.");
+
+// The number of datagrams any one participant may have waiting to be handled (0 is unlimited),
+// and what happens to a participant that falls that far behind.
+static ConfigVariable<unsigned int> queue_limit("queue_limit", 0, md_config);
+static ConfigVariable<std::string> queue_overflow("queue_overflow", "disconnect", md_config);
+
+static bool is_overflow_policy(const std::string& policy)
+{
+    return policy == "block" || policy == "drop-oldest" || policy == "disconnect";
+}
+static ConfigConstraint<std::string> overflow_is_policy(is_overflow_policy, queue_overflow,
+        "The MessageDirector's queue_overflow must be one of block, drop-oldest or disconnect.");
+
+// How long delivery blocks on a participant that's over its queue_limit before giving up on it.
+static const std::chrono::milliseconds max_overflow_wait(1000);
 
 static ConfigGroup daemon_config("daemon");
 static ConfigVariable<std::string> daemon_name("name", "<unnamed>", daemon_config);
@@ -25,8 +60,452 @@ static ConfigVariable<std::string> daemon_url("url", "", daemon_config);
 MessageDirector MessageDirector::singleton;
 
 
+// The number of datagrams that may be held back for participants which accept batches,
+// before they're delivered even though there are more datagrams to route.
+static const size_t max_batched_datagrams = 1024;
+
+// A DeliveryBatches holds back the datagrams routed to participants which accept batches,
+// so that each of them gets a whole burst at once when the batches are flushed.
+// Every thread delivering datagrams has its own, and only flushes it from that thread.
+class MessageDirector::DeliveryBatches
+{
+  public:
+    DeliveryBatches(MessageDirector *md) : m_md(md), m_pending(0)
+    {
+    }
+
+    inline bool empty() const
+    {
+        return m_pending == 0;
+    }
+
+    void add(MDParticipantInterface *participant, const DatagramHandle &dg)
+    {
+        if(participant->m_batch.empty()) {
+            m_participants.push_back(participant);
+        }
+        participant->m_batch.push_back(dg);
+
+        if(++m_pending >= max_batched_datagrams) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        for(const auto& participant : m_participants) {
+            try {
+                participant->handle_datagrams(DatagramSpan(participant->m_batch));
+            } catch(const DatagramIteratorEOF &) {
+                m_md->logger().error() << "Detected truncated datagram in handle_datagrams for '"
+                                       << participant->m_name << "'.\n";
+            }
+            participant->m_batch.clear();
+        }
+
+        m_participants.clear();
+        m_pending = 0;
+    }
+
+  private:
+    MessageDirector *m_md;
+    std::vector<MDParticipantInterface*> m_participants;
+    size_t m_pending;
+};
+
+
+// A RoutedDatagram is shared by every worker delivering the same datagram.
+struct MessageDirector::RoutedDatagram {
+    std::atomic<unsigned int> references; // The workers which haven't finished with it yet.
+    const void *sender; // Only used to avoid echoing the datagram back; never dereferenced.
+    DatagramHandle dg;
+    dgsize_t offset;
+    uint64_t epoch; // The subscription epoch the receivers were looked up at.
+    ChannelList channels;
+    ChannelGroupHandle group; // If set, the receivers are looked up from it instead.
+    SubscriberList receivers; // Grouped by the worker which delivers to them.
+};
+
+// The number of spare RoutedDatagrams kept for reuse; any more than that are deleted.
+static const size_t max_pooled_datagrams = 4096;
+
+// A RoutedDatagramPool recycles RoutedDatagrams, so routing on several threads doesn't allocate
+// once the pool holds as many as are usually in flight.  Only the routing thread takes them
+// out, and the last worker to finish with one puts it back.
+class MessageDirector::RoutedDatagramPool
+{
+  public:
+    RoutedDatagramPool() : m_spares(max_pooled_datagrams)
+    {
+    }
+
+    ~RoutedDatagramPool()
+    {
+        RoutedDatagram *routed;
+        while(m_spares.try_pop(routed)) {
+            delete routed;
+        }
+    }
+
+    // acquire returns an empty RoutedDatagram.  Only the routing thread may call it.
+    RoutedDatagram *acquire()
+    {
+        RoutedDatagram *routed;
+        if(!m_spares.try_pop(routed)) {
+            routed = new RoutedDatagram;
+        }
+        return routed;
+    }
+
+    // release drops a reference to routed, putting it back once nobody is using it.
+    void release(RoutedDatagram *routed)
+    {
+        if(routed->references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+
+        routed->dg = nullptr;
+        routed->group = nullptr;
+        routed->channels.clear();
+        routed->receivers.clear();
+        if(!m_spares.try_push(std::move(routed))) {
+            delete routed;
+        }
+    }
+
+  private:
+    MpscRing<RoutedDatagram*> m_spares;
+};
+
+
+// A RoutingWorker is one of the delivery threads used when messagedirector.threads > 1.
+// The routing thread looks up each datagram's receivers once, and passes each worker only
+// the receivers whose routing affinity it owns.  A participant may change its subscriptions
+// while it handles a datagram, so a worker which is still behind on earlier datagrams is
+// passed every datagram (even one with no receivers of its own), and looks its receivers up
+// again if any subscriptions have changed since the routing thread did.  That way a
+// participant's subscriptions still take effect before the next datagram is routed to it,
+// exactly as if there were only one routing thread.
+class MessageDirector::RoutingWorker
+{
+  public:
+    // A Retirement lets a terminated participant be deleted once every worker is done with it.
+    struct Retirement {
+        MDParticipantInterface *participant;
+        RoutingWorker *owner;
+        std::atomic<unsigned int> pending;
+    };
+
+    // capacity is the number of jobs which may be waiting before the routing thread has to wait.
+    RoutingWorker(MessageDirector *md, size_t capacity) : m_md(md), m_jobs(capacity),
+        m_parked(false), m_routed_pushed(0), m_routed_done(0), m_outbound_size(0),
+        m_has_deletions(false), m_batches(md), m_allocations(0),
+        m_thread(&RoutingWorker::run, this)
+    {
+    }
+
+    ~RoutingWorker()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_park_lock);
+            m_shutdown = true;
+            m_cv.notify_one();
+        }
+
+        m_thread.join();
+
+        // Let go of the datagrams the worker didn't get to.
+        Job job;
+        while(m_jobs.try_pop(job)) {
+            if(job.routed != nullptr) {
+                m_md->m_routed_pool->release(job.routed);
+            }
+        }
+    }
+
+    // deliver queues a datagram to be handed to receivers [first, first + count) of routed.
+    // Only the routing thread may call it.
+    void deliver(RoutedDatagram *routed, uint32_t first, uint32_t count)
+    {
+        ++m_routed_pushed;
+        push(Job{routed, first, count, nullptr});
+    }
+
+    // retire queues a terminated participant's retirement behind this worker's pending datagrams.
+    // Only the routing thread may call it.
+    void retire(const std::shared_ptr<Retirement> &retirement)
+    {
+        push(Job{nullptr, 0, 0, retirement});
+    }
+
+    // caught_up returns true if the worker has handled every datagram passed to it, so any
+    // subscriptions its participants changed while handling them are visible to the caller.
+    // Only the routing thread may call it.
+    inline bool caught_up() const
+    {
+        return m_routed_done.load(std::memory_order_acquire) == m_routed_pushed;
+    }
+
+    // allocations returns the number of heap allocations this worker has made looking up receivers.
+    inline uint64_t allocations() const
+    {
+        return m_allocations.load(std::memory_order_relaxed);
+    }
+
+    // backlog returns the number of jobs waiting for this worker.
+    inline size_t backlog() const
+    {
+        return m_jobs.size();
+    }
+
+    // current returns the worker running on the calling thread, or null if it isn't one.
+    static RoutingWorker *&current()
+    {
+        static thread_local RoutingWorker *worker = nullptr;
+        return worker;
+    }
+
+    // outbound_backlog returns the number of datagrams the worker's participants have routed,
+    //     which are waiting for room in the MessageDirector's queue.
+    inline size_t outbound_backlog() const
+    {
+        return m_outbound_size.load(std::memory_order_relaxed);
+    }
+
+    // send queues a datagram routed by one of the worker's participants.  The routing thread
+    //     may be waiting for the worker to make room for more jobs, so the worker can't wait
+    //     for the routing thread to make room in turn; instead, it holds on to the datagrams
+    //     (in order) until there is some.  Only the worker's own thread may call it.
+    void send(QueuedMessage &&msg)
+    {
+        if(m_outbound.empty() && m_md->m_messages.try_push(std::move(msg))) {
+            return;
+        }
+
+        m_outbound.push(std::move(msg));
+        m_outbound_size.store(m_outbound.size(), std::memory_order_relaxed);
+    }
+
+  private:
+    struct Job {
+        RoutedDatagram *routed; // The worker holds a reference to it until the job is done.
+        uint32_t first;
+        uint32_t count;
+        std::shared_ptr<Retirement> retirement;
+    };
+
+    MessageDirector *m_md;
+    bool m_shutdown = false;
+    MpscRing<Job> m_jobs;
+    // The worker only parks on m_cv when it has nothing to do, and the threads feeding it only
+    // take m_park_lock to wake it when m_parked says it may be asleep.
+    std::atomic<bool> m_parked;
+    std::mutex m_park_lock;
+    std::condition_variable m_cv;
+    uint64_t m_routed_pushed; // Only touched by the routing thread.
+    std::atomic<uint64_t> m_routed_done;
+    std::queue<QueuedMessage> m_outbound; // Only touched by the worker's thread.
+    std::atomic<size_t> m_outbound_size;
+    // Participants retired by every worker, which this one has to delete.
+    std::mutex m_deletions_lock;
+    std::vector<MDParticipantInterface*> m_deletions;
+    std::atomic<bool> m_has_deletions;
+    DeliveryBatches m_batches;
+    std::atomic<uint64_t> m_allocations;
+    std::thread m_thread;
+
+    void push(Job job)
+    {
+        while(!m_jobs.try_push(std::move(job))) {
+            // The worker is behind, so make sure it's awake and wait for it to make room.
+            wake();
+            std::this_thread::yield();
+        }
+        wake();
+    }
+
+    void wake()
+    {
+        // Pairs with the fence in run: either we see that it's parked, or it sees our job.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_parked.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(m_park_lock);
+            m_cv.notify_one();
+        }
+    }
+
+    void delete_later(MDParticipantInterface *participant)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_deletions_lock);
+            m_deletions.push_back(participant);
+            m_has_deletions.store(true, std::memory_order_relaxed);
+        }
+        wake();
+    }
+
+    inline bool has_work()
+    {
+        return !m_jobs.empty() || m_has_deletions.load(std::memory_order_relaxed);
+    }
+
+    // flush_outbound moves as many of the held datagrams as there's room for into the
+    //     MessageDirector's queue.
+    void flush_outbound()
+    {
+        bool sent = false;
+        while(!m_outbound.empty() && m_md->m_messages.try_push(std::move(m_outbound.front()))) {
+            m_outbound.pop();
+            sent = true;
+        }
+        m_outbound_size.store(m_outbound.size(), std::memory_order_relaxed);
+
+        if(sent) {
+            m_md->wake_routing_thread();
+        }
+    }
+
+    void run()
+    {
+        current() = this;
+
+        Job job;
+        while(true) {
+            if(!m_outbound.empty()) {
+                flush_outbound();
+            }
+
+            if(m_jobs.try_pop(job)) {
+                if(job.routed != nullptr) {
+                    handle_routed(job);
+                    m_md->m_routed_pool->release(job.routed);
+                    m_routed_done.store(m_routed_done.load(std::memory_order_relaxed) + 1,
+                                        std::memory_order_release);
+                } else {
+                    handle_retirement(job.retirement);
+                    job.retirement = nullptr;
+                }
+                continue;
+            }
+
+            if(m_has_deletions.load(std::memory_order_relaxed)) {
+                std::vector<MDParticipantInterface*> deletions;
+                {
+                    std::lock_guard<std::mutex> lock(m_deletions_lock);
+                    deletions.swap(m_deletions);
+                    m_has_deletions.store(false, std::memory_order_relaxed);
+                }
+                for(const auto& participant : deletions) {
+                    MessageDirector::delete_participant(participant);
+                }
+                continue;
+            }
+
+            if(!m_batches.empty()) {
+                // We've run out of datagrams for now, so hand over the held back ones.
+                m_batches.flush();
+                continue;
+            }
+
+            if(!m_outbound.empty()) {
+                // Nothing to do but wait for the routing thread to catch up.
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_park_lock);
+            m_parked.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            while(!has_work() && !m_shutdown) {
+                m_cv.wait(lock);
+            }
+            m_parked.store(false, std::memory_order_relaxed);
+            if(m_shutdown) {
+                return;
+            }
+        }
+    }
+
+    void handle_routed(const Job &job)
+    {
+        const RoutedDatagram &routed = *job.routed;
+        if(m_md->subscription_epoch() == routed.epoch) {
+            // Nothing has changed since the routing thread looked up the receivers.
+            for(uint32_t i = job.first; i < job.first + job.count; ++i) {
+                if(!deliver_to(routed, static_cast<MDParticipantInterface *>(routed.receivers[i]))) {
+                    return;
+                }
+            }
+            return;
+        }
+
+        uint64_t allocations = thread_allocation_count();
+        SubscriberList receiving_participants;
+        if(routed.group) {
+            m_md->lookup_group(*routed.group, receiving_participants);
+        } else {
+            m_md->lookup_channels(routed.channels, receiving_participants);
+        }
+        m_allocations.store(m_allocations.load(std::memory_order_relaxed) +
+                            thread_allocation_count() - allocations, std::memory_order_relaxed);
+
+        for(const auto& it : receiving_participants) {
+            auto participant = static_cast<MDParticipantInterface *>(it);
+            if(participant == routed.sender || m_md->worker_for(participant) != this) {
+                continue;
+            }
+
+            if(!deliver_to(routed, participant)) {
+                return;
+            }
+        }
+    }
+
+    // deliver_to hands a datagram to one of the worker's participants, returning false if the
+    // datagram turned out to be truncated.
+    bool deliver_to(const RoutedDatagram &routed, MDParticipantInterface *participant)
+    {
+        if(!m_md->make_room(participant, m_batches)) {
+            return true;
+        }
+
+        if(participant->accepts_batches()) {
+            m_batches.add(participant, routed.dg);
+            return true;
+        }
+
+        // N.B. the sender may be gone by now, so it isn't named in truncation errors.
+        return m_md->deliver_datagram(nullptr, participant, routed.dg, routed.offset);
+    }
+
+    void handle_retirement(const std::shared_ptr<Retirement> &retirement)
+    {
+        // The participant unsubscribed before it was retired, so once every worker has
+        // reached its retirement no worker can look it up again.  It is still deleted
+        // on its own worker, since its destructor may touch state shared by its affinity.
+        if(retirement->owner == this) {
+            // Anything held back for the participant has to be delivered first.
+            m_batches.flush();
+        }
+        if(--retirement->pending == 0) {
+            if(retirement->owner == this) {
+                MessageDirector::delete_participant(retirement->participant);
+            } else {
+                retirement->owner->delete_later(retirement->participant);
+            }
+        }
+    }
+};
+
+
 MessageDirector::MessageDirector() :  m_initialized(false), m_net_acceptor(nullptr), m_upstream(nullptr),
-    m_shutdown(false), m_main_is_routing(false), m_thread(nullptr), m_log("msgdir", "Message Director")
+    m_shutdown(false), m_main_is_routing(false), m_thread(nullptr), m_messages(message_queue_size),
+    m_overflow_mark(0), m_routing_parked(false), m_batches(new DeliveryBatches(this)),
+    m_routed_pool(new RoutedDatagramPool),
+    m_queue_limit(0), m_overflow_policy(OVERFLOW_DISCONNECT),
+    m_routed_datagrams(0), m_routing_allocations(0), m_overflow_size(0),
+    m_dropped_datagrams(0), m_overflow_disconnects(0),
+    m_log("msgdir", "Message Director")
 {
 }
 
@@ -60,25 +539,99 @@ void MessageDirector::init_network()
             m_net_acceptor->start();
         }
 
-        // Connect to upstream server and start handling received messages
+        // Connect to upstream server(s) and start handling received messages
+        std::vector<std::string> upstreams = upstream_addrs.get_val();
         if(connect_addr.get_val() != "unspecified") {
+            upstreams.insert(upstreams.begin(), connect_addr.get_val());
+        }
+        if(upstreams.size() == 1) {
             m_log.info() << "Connecting upstream..." << std::endl;
 
-            MDNetworkUpstream *upstream = new MDNetworkUpstream(this);
+            MDNetworkUpstream *upstream = new MDNetworkUpstream(this, control_window.get_val());
 
-            upstream->connect(connect_addr.get_val());
+            upstream->connect(upstreams[0]);
 
             m_upstream = upstream;
+        } else if(upstreams.size() > 1) {
+            if(upstreams.size() > 64) {
+                m_log.fatal() << "Can't connect to more than 64 upstream MDs." << std::endl;
+                exit(1);
+            }
+
+            m_log.info() << "Connecting to " << upstreams.size() << " upstream MDs..." << std::endl;
+
+            MDUpstreamGroup *group = new MDUpstreamGroup(this, upstreams, control_window.get_val());
+
+            group->connect();
+
+            m_upstream = group;
+        }
+
+        m_queue_limit = queue_limit.get_val();
+        if(queue_overflow.get_val() == "block") {
+            m_overflow_policy = OVERFLOW_BLOCK;
+        } else if(queue_overflow.get_val() == "drop-oldest") {
+            m_overflow_policy = OVERFLOW_DROP_OLDEST;
+        } else {
+            m_overflow_policy = OVERFLOW_DISCONNECT;
+        }
+        if(m_overflow_policy == OVERFLOW_BLOCK && !threaded_mode.get_val()) {
+            // The main thread would be waiting on itself to write the participant's datagrams.
+            m_log.warning() << "Participants can't block routing when it isn't threaded; "
+                            "disconnecting them when their queues overflow instead." << std::endl;
+            m_overflow_policy = OVERFLOW_DISCONNECT;
         }
 
         if(threaded_mode.get_val()) {
+            unsigned int num_workers = routing_threads.get_val();
+            if(num_workers > 1) {
+                m_log.info() << "Delivering datagrams on " << num_workers << " threads." << std::endl;
+                // With a queue_limit, no worker may fall further behind than any one participant.
+                size_t capacity = m_queue_limit > 0 ? m_queue_limit : message_queue_size;
+                for(unsigned int i = 0; i < num_workers; ++i) {
+                    m_workers.emplace_back(new RoutingWorker(this, capacity));
+                }
+                m_worker_slices.resize(num_workers);
+            }
+
             m_thread.reset(new std::thread(std::bind(&MessageDirector::routing_thread, this)));
         }
 
+        if(stats_interval.get_val() > 0) {
+            m_stats_timer = g_loop->resource<uvw::TimerHandle>();
+            m_stats_timer->on<uvw::TimerEvent>([self = this](const uvw::TimerEvent&, uvw::TimerHandle&) {
+                self->log_stats();
+            });
+            m_stats_timer->start(uvw::TimerHandle::Time{stats_interval.get_val()},
+                                 uvw::TimerHandle::Time{stats_interval.get_val()});
+        }
+
         m_initialized = true;
     }
 }
 
+void MessageDirector::log_stats()
+{
+    QueueStats stats = queue_stats();
+    m_log.info() << "Queues: " << stats.routing << " datagrams waiting to be routed, "
+                 << stats.delivering << " on the busiest delivery thread, "
+                 << stats.deepest << " on the furthest behind participant; "
+                 << stats.dropped << " dropped and " << stats.disconnects
+                 << " participants disconnected for falling behind.\n";
+
+    log_task_stats("the main loop", IoLoop::main().tasks().stats());
+    for(size_t i = 0; i < IoLoop::thread_count(); ++i) {
+        log_task_stats("I/O thread " + std::to_string(i), IoLoop::thread(i).tasks().stats());
+    }
+}
+
+void MessageDirector::log_task_stats(const std::string &name, const TaskQueue::Stats &stats)
+{
+    m_log.info() << "Tasks on " << name << ": " << stats.depth << " waiting (at most "
+                 << stats.max_depth << "); " << stats.tasks << " run over " << stats.wakeups
+                 << " wakeups, " << stats.heap_tasks << " too large to store inline.\n";
+}
+
 void MessageDirector::shutdown_threading()
 {
     if(!m_thread) {
@@ -87,7 +640,7 @@ void MessageDirector::shutdown_threading()
 
     // Signal routing thread to shut down:
     {
-        std::lock_guard<std::mutex> lock(m_messages_lock);
+        std::lock_guard<std::mutex> lock(m_park_lock);
         m_shutdown = true;
         m_cv.notify_one();
     }
@@ -95,24 +648,32 @@ void MessageDirector::shutdown_threading()
     // Wait for it to do so:
     m_thread->join();
     m_thread.reset();
+
+    // The delivery workers can only be fed by the routing thread, so they go last:
+    m_workers.clear();
 }
 
 void MessageDirector::route_datagram(MDParticipantInterface *p, DatagramHandle dg)
 {
-    std::unique_lock<std::mutex> lock(m_messages_lock);
+    queue_message(QueuedMessage{p, dg, nullptr});
+    wake_router();
+}
 
-    // We need to hold the lock to push the datagram into the message queue, and to signal the MD thread (if in threaded mode).
-    m_messages.push(std::make_pair(p, dg));
+void MessageDirector::route_datagram(MDParticipantInterface *p, const ChannelGroupHandle &group,
+                                     DatagramHandle dg)
+{
+    queue_message(QueuedMessage{p, dg, group});
+    wake_router();
+}
 
+void MessageDirector::wake_router()
+{
     if(m_thread) {
-        // If in threaded mode, ring the bell to let the MD thread know we have a datagram to process and return.
-        m_cv.notify_one();
+        // If in threaded mode, ring the bell (if the MD thread is asleep) and return.
+        wake_routing_thread();
         return;
     }
 
-    // We don't need to hold the message lock past this point, as we're not in threaded mode.
-    lock.unlock();
-
     if(std::this_thread::get_id() != g_main_thread_id) {
         // We aren't working in threaded mode, but we aren't in the main thread
         // either. For safety, we should post this down to the main thread.
@@ -125,6 +686,65 @@ void MessageDirector::route_datagram(MDParticipantInterface *p, DatagramHandle d
     }
 }
 
+void MessageDirector::queue_message(QueuedMessage msg)
+{
+    // The thread draining the queue can't wait for itself to make room, so when it routes
+    // a datagram while the queue is full (or still has overflow pending), it sets it aside.
+    bool is_consumer = m_thread ? is_routing_thread : std::this_thread::get_id() == g_main_thread_id;
+    if(is_consumer) {
+        if(m_overflow.empty()) {
+            if(m_messages.try_push(std::move(msg))) {
+                return;
+            }
+            m_overflow_mark = m_messages.enqueue_position();
+        }
+        m_overflow.push(std::move(msg));
+        m_overflow_size.store(m_overflow.size(), std::memory_order_relaxed);
+        return;
+    }
+
+    if(RoutingWorker::current() != nullptr) {
+        RoutingWorker::current()->send(std::move(msg));
+        return;
+    }
+
+    while(!m_messages.try_push(std::move(msg))) {
+        // The queue is full, so make sure the consumer is draining it and wait our turn.
+        if(m_thread) {
+            wake_routing_thread();
+        }
+        std::this_thread::yield();
+    }
+}
+
+bool MessageDirector::pop_message(QueuedMessage &msg)
+{
+    if(!m_overflow.empty() && m_messages.dequeue_position() >= m_overflow_mark) {
+        msg = std::move(m_overflow.front());
+        m_overflow.pop();
+        m_overflow_size.store(m_overflow.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    return m_messages.try_pop(msg);
+}
+
+bool MessageDirector::has_message()
+{
+    return !m_messages.empty() || (!m_overflow.empty() &&
+                                   m_messages.dequeue_position() >= m_overflow_mark);
+}
+
+void MessageDirector::wake_routing_thread()
+{
+    // Pairs with the fence in routing_thread: either we see that it's parked, or it sees our message.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_routing_parked.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(m_park_lock);
+        m_cv.notify_one();
+    }
+}
+
 void MessageDirector::flush_queue()
 {
     // We want to be sure this is being invoked from within the main thread.
@@ -136,20 +756,15 @@ void MessageDirector::flush_queue()
     }
 
     m_main_is_routing = true;
-    
-    {
-        std::unique_lock<std::mutex> lock(m_messages_lock);
 
-        while(!m_messages.empty()) {
-            // Get and process the datagram:
-            auto msg = m_messages.front();
-            m_messages.pop();
-
-            lock.unlock();
-            process_datagram(msg.first, msg.second);
-            lock.lock();
+    // Get and process each datagram, then deliver any that were held back:
+    QueuedMessage msg;
+    do {
+        while(pop_message(msg)) {
+            process_datagram(msg.sender, msg.dg, msg.group);
         }
-    }
+        m_batches->flush();
+    } while(has_message());
 
     // We're done flushing, we can now be invoked from others.
     m_main_is_routing = false;
@@ -158,46 +773,65 @@ void MessageDirector::flush_queue()
 // This function runs in a thread; it loops until it's told to shut down:
 void MessageDirector::routing_thread()
 {
-    std::unique_lock<std::mutex> lock(m_messages_lock);
+    is_routing_thread = true;
 
-    while(true) {
-        // Wait for something interesting to handle...
-        while(m_messages.empty() && !m_shutdown) {
-            m_cv.wait(lock);
+    QueuedMessage msg;
+    while(!m_shutdown) {
+        // Get and process the message:
+        if(pop_message(msg)) {
+            process_datagram(msg.sender, msg.dg, msg.group);
+            continue;
         }
 
-        if(m_shutdown) {
-            // Ehh, we've been told to shut off:
-            return;
+        // We've run out of datagrams for now, so hand over the held back ones.
+        if(!m_batches->empty()) {
+            m_batches->flush();
+            continue;
         }
 
-        // Get and process the message:
-        auto msg = m_messages.front();
-        m_messages.pop();
-
-        lock.unlock();
-        process_datagram(msg.first, msg.second);
-        lock.lock();
+        // Nothing to handle, so wait for something interesting to arrive...
+        std::unique_lock<std::mutex> lock(m_park_lock);
+        m_routing_parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while(!has_message() && !m_shutdown) {
+            m_cv.wait(lock);
+        }
+        m_routing_parked.store(false, std::memory_order_relaxed);
     }
+
+    m_batches->flush();
 }
 
-void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle dg)
+void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle dg,
+                                       const ChannelGroupHandle &group)
 {
     m_log.trace() << "Processing datagram...." << std::endl;
 
-    std::vector<channel_t> channels;
+    // Routing should never need the heap; count any allocations made outside of the
+    // participants' (and upstream's) handlers, so routing_stats() can prove it.
+    uint64_t allocations = thread_allocation_count();
+    uint64_t handler_allocations = 0;
+
+    ChannelList channels;
+    ChannelGroupHandle receivers;
     DatagramIterator dgi(dg);
     try {
-        // Unpack channels to send messages to
         uint8_t channel_count = dgi.read_uint8();
-        auto receive_log = m_log.trace();
-        receive_log << "Receivers: ";
-        for(uint8_t i = 0; i < channel_count; ++i) {
-            channel_t channel = dgi.read_channel();
-            receive_log << channel << ", ";
-            channels.push_back(channel);
+        if(group && channel_count == group->channels().size()) {
+            // The group already knows its channels, so we only need to find the payload.
+            dgi.skip(channel_count * sizeof(channel_t));
+            receivers = group;
+        } else {
+            if(group) {
+                m_log.error() << "Datagram routed to a channel group doesn't have the group's "
+                              "header; looking up its channels instead.\n";
+            }
+
+            // Unpack channels to send messages to
+            for(uint8_t i = 0; i < channel_count; ++i) {
+                channels.push_back(dgi.read_channel());
+            }
         }
-        receive_log << "\n";
     } catch(const DatagramIteratorEOF &) {
         // Log error with receivers output
         if(p) {
@@ -210,36 +844,116 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
         return;
     }
 
-    // Find the participants that need to receive the message
-    std::unordered_set<ChannelSubscriber*> receiving_participants;
-    lookup_channels(channels, receiving_participants);
-    if(p) {
-        receiving_participants.erase(p);
+    if(m_log.trace_enabled()) {
+        auto receive_log = m_log.trace();
+        receive_log << "Receivers: ";
+        for(const auto& channel : receivers ? receivers->channels() : channels) {
+            receive_log << channel << ", ";
+        }
+        receive_log << "\n";
     }
 
-    // Send the datagram to each participant
-    for(const auto& it : receiving_participants) {
-        auto participant = static_cast<MDParticipantInterface *>(it);
-        DatagramIterator msg_dgi(dg, dgi.tell());
+    if(!m_workers.empty()) {
+        // Workers still handling earlier datagrams may yet change their participants'
+        // subscriptions, so see which of them have caught up before looking anything up.
+        for(size_t i = 0; i < m_workers.size(); ++i) {
+            m_worker_slices[i].caught_up = m_workers[i]->caught_up();
+            m_worker_slices[i].count = 0;
+        }
 
-        try {
-            participant->handle_datagram(dg, msg_dgi);
-        } catch(const DatagramIteratorEOF &) {
-            // Log error with receivers output
-            if(p) {
-                m_log.error() << "Detected truncated datagram in handle_datagram for '"
-                              << participant->m_name << "' from participant '" << p->m_name << "'.\n";
-            } else {
-                m_log.error() << "Detected truncated datagram in handle_datagram for '"
-                              << participant->m_name << "' from unknown participant.\n";
+        RoutedDatagram *routed = m_routed_pool->acquire();
+        routed->sender = p;
+        routed->dg = dg;
+        routed->offset = dgi.tell();
+        routed->epoch = subscription_epoch();
+        routed->channels = std::move(channels);
+        routed->group = receivers;
+
+        SubscriberList receiving_participants;
+        if(receivers) {
+            lookup_group(*receivers, receiving_participants);
+        } else {
+            lookup_channels(routed->channels, receiving_participants);
+        }
+
+        // Group the receivers by the worker which owns them:
+        m_receiver_workers.clear();
+        for(const auto& it : receiving_participants) {
+            auto participant = static_cast<MDParticipantInterface *>(it);
+            uint32_t worker = participant == p ? no_worker : worker_index(participant);
+            m_receiver_workers.push_back(worker);
+            if(worker != no_worker) {
+                ++m_worker_slices[worker].count;
+            }
+        }
+        uint32_t first = 0;
+        for(auto& slice : m_worker_slices) {
+            slice.first = first;
+            first += slice.count;
+        }
+        routed->receivers.reserve(first);
+        for(size_t i = 0; i < m_worker_slices.size(); ++i) {
+            for(size_t j = 0; j < receiving_participants.size(); ++j) {
+                if(m_receiver_workers[j] == i) {
+                    routed->receivers.push_back(receiving_participants[j]);
+                }
+            }
+        }
+
+        // Every worker has to hold its reference before the first of them can drop one.
+        unsigned int references = 1;
+        for(const auto& slice : m_worker_slices) {
+            if(slice.count > 0 || !slice.caught_up) {
+                ++references;
+            }
+        }
+        routed->references.store(references, std::memory_order_relaxed);
+        for(size_t i = 0; i < m_workers.size(); ++i) {
+            const WorkerSlice &slice = m_worker_slices[i];
+            if(slice.count > 0 || !slice.caught_up) {
+                m_workers[i]->deliver(routed, slice.first, slice.count);
+            }
+        }
+        m_routed_pool->release(routed);
+    } else {
+        // Find the participants that need to receive the message
+        SubscriberList receiving_participants;
+        if(receivers) {
+            lookup_group(*receivers, receiving_participants);
+        } else {
+            lookup_channels(channels, receiving_participants);
+        }
+
+        // Send the datagram to each participant
+        for(const auto& it : receiving_participants) {
+            auto participant = static_cast<MDParticipantInterface *>(it);
+            if(participant == p) {
+                continue;
+            }
+
+            if(!make_room(participant, *m_batches)) {
+                continue;
+            }
+
+            if(participant->accepts_batches()) {
+                m_batches->add(participant, dg);
+                continue;
+            }
+
+            uint64_t before = thread_allocation_count();
+            bool delivered = deliver_datagram(p, participant, dg, dgi.tell());
+            handler_allocations += thread_allocation_count() - before;
+            if(!delivered) {
+                return;
             }
-            return;
         }
     }
 
     // Send message upstream, if necessary
     if(p && m_upstream) {
+        uint64_t before = thread_allocation_count();
         m_upstream->handle_datagram(dg);
+        handler_allocations += thread_allocation_count() - before;
         m_log.trace() << "...routing upstream." << std::endl;
     } else if(!p) {
         // If there is no participant, then it came from the upstream
@@ -249,6 +963,13 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
         m_log.trace() << "...not routing upstream: There is none." << std::endl;
     }
 
+    // Only one thread routes at a time, so the counters don't need to be updated atomically.
+    m_routed_datagrams.store(m_routed_datagrams.load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+    m_routing_allocations.store(m_routing_allocations.load(std::memory_order_relaxed) +
+                                thread_allocation_count() - allocations - handler_allocations,
+                                std::memory_order_relaxed);
+
     // N.B. Participants may reach end-of-life after receiving a datagram, or may
     // be terminated in another thread (for example if a network socket closes);
     // either way, process any received terminates after processing a datagram.
@@ -256,6 +977,137 @@ void MessageDirector::process_datagram(MDParticipantInterface *p, DatagramHandle
 }
 
 
+MessageDirector::RoutingStats MessageDirector::routing_stats() const
+{
+    RoutingStats stats;
+    stats.datagrams = m_routed_datagrams.load(std::memory_order_relaxed);
+    stats.allocations = m_routing_allocations.load(std::memory_order_relaxed);
+    for(const auto& worker : m_workers) {
+        stats.allocations += worker->allocations();
+    }
+    return stats;
+}
+
+MessageDirector::QueueStats MessageDirector::queue_stats()
+{
+    QueueStats stats;
+    stats.routing = m_messages.size() + m_overflow_size.load(std::memory_order_relaxed);
+    stats.delivering = 0;
+    for(const auto& worker : m_workers) {
+        stats.routing += worker->outbound_backlog();
+        stats.delivering = std::max(stats.delivering, worker->backlog());
+    }
+
+    stats.deepest = 0;
+    {
+        // Participants are only deleted after they've been removed from m_participants.
+        std::lock_guard<std::mutex> lock(m_participants_lock);
+        for(const auto& participant : m_participants) {
+            stats.deepest = std::max(stats.deepest, participant->queued_datagrams());
+        }
+    }
+
+    stats.dropped = m_dropped_datagrams.load(std::memory_order_relaxed);
+    stats.disconnects = m_overflow_disconnects.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool MessageDirector::make_room(MDParticipantInterface *participant, DeliveryBatches &batches)
+{
+    if(m_queue_limit == 0) {
+        return true;
+    }
+
+    size_t queued = participant->queued_datagrams() + participant->m_batch.size();
+    if(queued < m_queue_limit) {
+        return true;
+    }
+
+    if(!participant->m_batch.empty()) {
+        // Hand over whatever is held back for the participant, so that the
+        // policy only has to deal with the participant's own queue.
+        batches.flush();
+        queued = participant->queued_datagrams();
+    }
+
+    switch(m_overflow_policy) {
+    case OVERFLOW_BLOCK: {
+        // Wait for the participant to catch up.  This holds up every datagram behind it,
+        // and in turn the participants routing them, which is the point; but one that
+        // doesn't catch up in time is disconnected rather than stalling the whole node.
+        auto deadline = std::chrono::steady_clock::now() + max_overflow_wait;
+        while(queued >= m_queue_limit && std::chrono::steady_clock::now() < deadline) {
+            if(participant->is_terminated() || m_shutdown) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            queued = participant->queued_datagrams();
+        }
+        break;
+    }
+    case OVERFLOW_DROP_OLDEST:
+        if(queued >= m_queue_limit) {
+            size_t dropped = participant->drop_queued_datagrams(queued - m_queue_limit + 1);
+            m_dropped_datagrams.fetch_add(dropped, std::memory_order_relaxed);
+            queued -= dropped;
+        }
+        break;
+    case OVERFLOW_DISCONNECT:
+        break;
+    }
+
+    if(queued < m_queue_limit) {
+        return true;
+    }
+
+    if(!participant->m_overflowed) {
+        m_log.warning() << "Participant '" << participant->m_name << "' has " << queued
+                        << " datagrams waiting (queue_limit is " << m_queue_limit
+                        << "); disconnecting it.\n";
+        m_overflow_disconnects.fetch_add(1, std::memory_order_relaxed);
+        participant->m_overflowed = true;
+        participant->handle_overflow();
+    }
+    return false;
+}
+
+bool MessageDirector::deliver_datagram(MDParticipantInterface *p, MDParticipantInterface *participant,
+                                       DatagramHandle dg, dgsize_t offset)
+{
+    DatagramIterator msg_dgi(dg, offset);
+
+    try {
+        participant->handle_datagram(dg, msg_dgi);
+    } catch(const DatagramIteratorEOF &) {
+        // Log error with receivers output
+        if(p) {
+            m_log.error() << "Detected truncated datagram in handle_datagram for '"
+                          << participant->m_name << "' from participant '" << p->m_name << "'.\n";
+        } else {
+            m_log.error() << "Detected truncated datagram in handle_datagram for '"
+                          << participant->m_name << "' from unknown participant.\n";
+        }
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t MessageDirector::worker_index(MDParticipantInterface *participant)
+{
+    // Pointers are aligned, so mix the bits before picking a worker:
+    uint64_t key = reinterpret_cast<uintptr_t>(participant->get_routing_affinity());
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return uint32_t(key % m_workers.size());
+}
+
+MessageDirector::RoutingWorker *MessageDirector::worker_for(MDParticipantInterface *participant)
+{
+    return m_workers[worker_index(participant)].get();
+}
+
 void MessageDirector::process_terminates()
 {
     std::unordered_set<MDParticipantInterface*> terminating_participants;
@@ -265,9 +1117,38 @@ void MessageDirector::process_terminates()
         terminating_participants = std::move(m_terminated_participants);
     }
 
+    if(m_workers.empty() && !terminating_participants.empty()) {
+        // Anything held back for the participants has to be delivered before they're deleted.
+        m_batches->flush();
+    }
+
     for(const auto& it : terminating_participants) {
-        delete it;
+        if(!m_workers.empty()) {
+            // Workers may still have datagrams queued for the participant,
+            // so it is only deleted once all of them have caught up.
+            std::shared_ptr<RoutingWorker::Retirement> retirement(new RoutingWorker::Retirement{
+                it, worker_for(it), {(unsigned int)m_workers.size()}
+            });
+            for(const auto& worker : m_workers) {
+                worker->retire(retirement);
+            }
+        } else {
+            delete_participant(it);
+        }
+    }
+}
+
+void MessageDirector::delete_participant(MDParticipantInterface *p)
+{
+    IoLoop *io_loop = p->get_io_loop();
+    if(io_loop != nullptr && !io_loop->in_thread()) {
+        io_loop->tasks().enqueue_task([p]() {
+            delete p;
+        });
+        return;
     }
+
+    delete p;
 }
 
 void MessageDirector::on_add_channel(channel_t c)
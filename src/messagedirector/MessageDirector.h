@@ -10,10 +10,12 @@
 #include <condition_variable>
 #include <boost/icl/interval_map.hpp>
 #include "ChannelMap.h"
+#include "ChannelGroup.h"
 #include "core/global.h"
 #include "util/Datagram.h"
 #include "util/DatagramIterator.h"
-#include "util/TaskQueue.h"
+#include "util/MpscRing.h"
+#include "util/IoLoop.h"
 #include "net/NetworkAcceptor.h"
 
 class MDParticipantInterface;
@@ -37,6 +39,36 @@ class MessageDirector final : public ChannelMap
     // Message on the CONTROL_MESSAGE channel are processed internally by the MessageDirector.
     void route_datagram(MDParticipantInterface *p, DatagramHandle dg);
 
+    // route_datagram to a ChannelGroup routes a datagram created by the group's create_datagram,
+    //     resolving its receivers from the group's cache instead of looking up each channel.
+    void route_datagram(MDParticipantInterface *p, const ChannelGroupHandle &group, DatagramHandle dg);
+
+    // RoutingStats describes the work the MessageDirector has done routing datagrams.
+    struct RoutingStats {
+        uint64_t datagrams;   // The number of datagrams routed.
+        uint64_t allocations; // The heap allocations made routing them, not counting any
+                              // made by the participants (or upstream) handling them.
+    };
+
+    // routing_stats returns the MessageDirector's statistics since it was started.
+    // Allocations are only counted in builds with ASTRON_COUNT_ALLOCATIONS (astron_md_bench);
+    //     elsewhere they're always 0.  Routing doesn't allocate once it's warmed up, except
+    //     with multiple routing threads when more than a few thousand datagrams are in flight.
+    RoutingStats routing_stats() const;
+
+    // QueueStats describes the datagrams waiting in the MessageDirector and its participants.
+    struct QueueStats {
+        size_t routing;       // Datagrams waiting to be routed.
+        size_t delivering;    // Datagrams waiting on the busiest delivery thread.
+        size_t deepest;       // The most datagrams any one participant has waiting to be handled.
+        uint64_t dropped;     // Datagrams dropped from participants that fell behind.
+        uint64_t disconnects; // Participants disconnected for falling behind.
+    };
+
+    // queue_stats returns a snapshot of the MessageDirector's queues; the counters
+    // are totals since it was started.  They're logged every messagedirector.stats_interval.
+    QueueStats queue_stats();
+
     // logger returns the MessageDirector log category.
     inline LogCategory& logger()
     {
@@ -66,21 +98,87 @@ class MessageDirector final : public ChannelMap
     std::unordered_set<MDParticipantInterface*> m_terminated_participants;
 
     // Threading stuff:
-    bool m_shutdown;
+    class DeliveryBatches;
+    struct RoutedDatagram;
+    class RoutedDatagramPool;
+    class RoutingWorker;
+    std::atomic<bool> m_shutdown;
     bool m_main_is_routing;
     std::unique_ptr<std::thread> m_thread;
+    std::vector<std::unique_ptr<RoutingWorker> > m_workers;
+    // The share of the receivers of the datagram being routed which each worker delivers to;
+    //     only used by the routing thread.
+    struct WorkerSlice {
+        uint32_t first;
+        uint32_t count;
+        bool caught_up; // Whether the worker had handled everything before the datagram.
+    };
+    static const uint32_t no_worker = UINT32_MAX;
+    std::vector<WorkerSlice> m_worker_slices;
+    SmallVector<uint32_t, 64> m_receiver_workers; // The worker of each receiver, or no_worker.
     std::mutex m_participants_lock;
     std::mutex m_terminated_lock;
-    std::mutex m_messages_lock;
-    std::queue<std::pair<MDParticipantInterface *, DatagramHandle>> m_messages;
+    struct QueuedMessage {
+        MDParticipantInterface *sender;
+        DatagramHandle dg;
+        ChannelGroupHandle group; // Only set for datagrams routed to a ChannelGroup.
+    };
+    MpscRing<QueuedMessage> m_messages;
+    // Messages the routing thread routes to itself while m_messages is full.  They may only
+    // be processed once everything it queued before them (up to m_overflow_mark) has been.
+    std::queue<QueuedMessage> m_overflow;
+    size_t m_overflow_mark;
+    // The routing thread only parks on m_cv when m_messages is empty, and producers only
+    // take m_park_lock to wake it when m_routing_parked says it may be asleep.
+    std::atomic<bool> m_routing_parked;
+    std::mutex m_park_lock;
     std::condition_variable m_cv;
-    
+    // Deliveries held back by the routing thread (or the main thread when not threaded).
+    std::unique_ptr<DeliveryBatches> m_batches;
+    // Recycles the datagrams shared with the workers; they're stopped before it's destroyed.
+    std::unique_ptr<RoutedDatagramPool> m_routed_pool;
+
+    // What to do when a participant has messagedirector.queue_limit datagrams waiting.
+    enum OverflowPolicy {
+        OVERFLOW_BLOCK,
+        OVERFLOW_DROP_OLDEST,
+        OVERFLOW_DISCONNECT,
+    };
+    size_t m_queue_limit;
+    OverflowPolicy m_overflow_policy;
+
+    // Statistics, only written by the thread routing datagrams.
+    std::atomic<uint64_t> m_routed_datagrams;
+    std::atomic<uint64_t> m_routing_allocations;
+    std::atomic<size_t> m_overflow_size;
+    // Written by every thread delivering datagrams.
+    std::atomic<uint64_t> m_dropped_datagrams;
+    std::atomic<uint64_t> m_overflow_disconnects;
+
+    void queue_message(QueuedMessage msg);
+    void wake_router();
+    bool pop_message(QueuedMessage &msg);
+    bool has_message();
+    void wake_routing_thread();
     void flush_queue();
-    void process_datagram(MDParticipantInterface *p, DatagramHandle dg);
+    void process_datagram(MDParticipantInterface *p, DatagramHandle dg, const ChannelGroupHandle &group);
+    bool deliver_datagram(MDParticipantInterface *p, MDParticipantInterface *participant,
+                          DatagramHandle dg, dgsize_t offset);
+    bool make_room(MDParticipantInterface *participant, DeliveryBatches &batches);
+    uint32_t worker_index(MDParticipantInterface *participant);
+    RoutingWorker *worker_for(MDParticipantInterface *participant);
     void process_terminates();
+    // delete_participant deletes a terminated participant, on its own loop's thread if it has one.
+    static void delete_participant(MDParticipantInterface *participant);
     void routing_thread();
     void shutdown_threading();
 
+    // Logs queue_stats, and the task queues' stats, every messagedirector.stats_interval,
+    // if one is set.
+    std::shared_ptr<uvw::TimerHandle> m_stats_timer;
+    void log_stats();
+    void log_task_stats(const std::string &name, const TaskQueue::Stats &stats);
+
     LogCategory m_log;
 
     friend class MDParticipantInterface;
@@ -116,6 +214,67 @@ class MDParticipantInterface : public ChannelSubscriber
     // Implementations of handle_datagram should be non-blocking operations.
     virtual void handle_datagram(DatagramHandle dg, DatagramIterator &dgi) = 0;
 
+    // handle_datagrams handles a burst of datagrams routed to the participant, in order.
+    // By default, each of them is passed on to handle_datagram.
+    virtual void handle_datagrams(DatagramSpan dgs)
+    {
+        for(const auto& dg : dgs) {
+            DatagramIterator dgi(dg);
+            dgi.seek_payload();
+            handle_datagram(dg, dgi);
+        }
+    }
+
+    // accepts_batches returns true if the MessageDirector may hold back the datagrams routed
+    //     to the participant, and deliver them with handle_datagrams once it runs out of
+    //     datagrams to route.  Since later datagrams are routed before the held back ones
+    //     are handled, only participants which never change their subscriptions while
+    //     handling a datagram (e.g. ones that just forward them) should accept batches.
+    virtual bool accepts_batches() const
+    {
+        return false;
+    }
+
+    // queued_datagrams returns the number of datagrams delivered to the participant which
+    //     it hasn't finished handling yet (e.g. ones still waiting to be written to a socket).
+    //     The MessageDirector keeps it under messagedirector.queue_limit, if one is set.
+    virtual size_t queued_datagrams()
+    {
+        return 0;
+    }
+
+    // drop_queued_datagrams discards up to count of the participant's oldest queued
+    //     datagrams, returning how many it dropped.
+    virtual size_t drop_queued_datagrams(size_t)
+    {
+        return 0;
+    }
+
+    // handle_overflow is called when the participant has fallen more than
+    //     messagedirector.queue_limit datagrams behind and is to be disconnected.
+    //     No more datagrams are delivered to it while it's still too far behind.
+    virtual void handle_overflow()
+    {
+        terminate();
+    }
+
+    // get_routing_affinity returns a key shared by every participant that touches the same
+    //     unsynchronized state as this one (e.g. a StateServer and its objects).  When the
+    //     MessageDirector runs multiple routing threads, participants with the same affinity
+    //     are always handled on the same thread.
+    virtual const void *get_routing_affinity() const
+    {
+        return this;
+    }
+
+    // get_io_loop returns the loop the participant's network connection (if it has one) is
+    //     handled on.  A terminated participant is deleted from that loop's thread, so that
+    //     it can't be deleted out from under one of its own network callbacks.
+    virtual IoLoop *get_io_loop()
+    {
+        return nullptr;
+    }
+
     // post_remove tells the MDParticipant to handle all of its post remove packets.
     inline void post_remove()
     {
@@ -150,6 +309,10 @@ class MDParticipantInterface : public ChannelSubscriber
     {
         MessageDirector::singleton.route_datagram(this, dg);
     }
+    inline void route_datagram(const ChannelGroupHandle &group, DatagramHandle dg)
+    {
+        MessageDirector::singleton.route_datagram(this, group, dg);
+    }
     inline void subscribe_channel(channel_t c)
     {
         logger().trace() << "MDParticipant '" << m_name << "' subscribed channel: " << c << std::endl;
@@ -209,6 +372,8 @@ class MDParticipantInterface : public ChannelSubscriber
   private:
     // The messages to be distributed on unexpected disconnect.
     std::unordered_map<channel_t, std::vector<DatagramHandle> > m_post_removes;
+    std::vector<DatagramHandle> m_batch; // Datagrams held back for handle_datagrams.
+    bool m_overflowed = false; // Set once handle_overflow has been called.
     std::atomic<bool> m_is_terminated {false};
     std::string m_name;
     std::string m_url;
@@ -220,6 +385,7 @@ class MDParticipantInterface : public ChannelSubscriber
 class MDUpstream
 {
   public:
+    virtual ~MDUpstream() {}
     virtual void subscribe_channel(channel_t c) = 0;
     virtual void unsubscribe_channel(channel_t c) = 0;
     virtual void subscribe_range(channel_t lo, channel_t hi) = 0;
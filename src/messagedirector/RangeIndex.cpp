@@ -0,0 +1,214 @@
+#include "RangeIndex.h"
+#include <algorithm>
+
+static bool same_subscribers(const RangeIndex::Subscribers &a, const RangeIndex::Subscribers &b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+RangeIndex::RangeIndex() : m_block_starts(1, channel_t(0))
+{
+    // Start with a single empty segment covering every channel.
+    std::shared_ptr<Block> block = std::make_shared<Block>();
+    block->starts.push_back(channel_t(0));
+    block->subscribers.push_back(Subscribers());
+    m_blocks.push_back(block);
+}
+
+const RangeIndex::Subscribers &RangeIndex::find(channel_t c) const
+{
+    const Block &block = *m_blocks[block_of(c)];
+    size_t i = std::upper_bound(block.starts.begin(), block.starts.end(), c) - block.starts.begin() - 1;
+    return block.subscribers[i];
+}
+
+bool RangeIndex::empty() const
+{
+    return m_blocks.size() == 1 && m_blocks[0]->starts.size() == 1 && m_blocks[0]->subscribers[0].empty();
+}
+
+size_t RangeIndex::segment_count() const
+{
+    size_t count = 0;
+    for(const auto& block : m_blocks) {
+        count += block->starts.size();
+    }
+    return count;
+}
+
+size_t RangeIndex::block_of(channel_t c) const
+{
+    return std::upper_bound(m_block_starts.begin(), m_block_starts.end(), c) - m_block_starts.begin() - 1;
+}
+
+RangeIndex::Block &RangeIndex::writable_block(size_t b)
+{
+    // The block may still be shared with a copy of the index (e.g. a snapshot being read).
+    if(m_blocks[b].use_count() > 1) {
+        m_blocks[b] = std::make_shared<Block>(*m_blocks[b]);
+    }
+    return *m_blocks[b];
+}
+
+void RangeIndex::split_at(channel_t c)
+{
+    // Makes sure a segment starts at c, splitting the one containing it if needed.
+    size_t b = block_of(c);
+    const Block &current = *m_blocks[b];
+    auto it = std::upper_bound(current.starts.begin(), current.starts.end(), c);
+    size_t i = it - current.starts.begin() - 1;
+    if(current.starts[i] == c) {
+        return;
+    }
+
+    Block &block = writable_block(b);
+    block.starts.insert(block.starts.begin() + i + 1, c);
+    block.subscribers.insert(block.subscribers.begin() + i + 1, block.subscribers[i]);
+
+    if(block.starts.size() > max_block_size) {
+        // Split the block in half.
+        size_t half = block.starts.size() / 2;
+        std::shared_ptr<Block> upper = std::make_shared<Block>();
+        upper->starts.assign(block.starts.begin() + half, block.starts.end());
+        upper->subscribers.assign(std::make_move_iterator(block.subscribers.begin() + half),
+                                  std::make_move_iterator(block.subscribers.end()));
+        block.starts.resize(half);
+        block.subscribers.resize(half);
+
+        m_block_starts.insert(m_block_starts.begin() + b + 1, upper->starts[0]);
+        m_blocks.insert(m_blocks.begin() + b + 1, upper);
+    }
+}
+
+void RangeIndex::merge_at(channel_t c)
+{
+    // If a segment starts at c and has the same subscribers as the one before it, join them.
+    if(c == channel_t(0)) {
+        return;
+    }
+
+    size_t b = block_of(c);
+    const Block &current = *m_blocks[b];
+    auto it = std::lower_bound(current.starts.begin(), current.starts.end(), c);
+    if(it == current.starts.end() || *it != c) {
+        return;
+    }
+    size_t i = it - current.starts.begin();
+
+    const Subscribers &prev = i > 0 ? current.subscribers[i - 1] : m_blocks[b - 1]->subscribers.back();
+    if(!same_subscribers(prev, current.subscribers[i])) {
+        return;
+    }
+
+    Block &block = writable_block(b);
+    block.starts.erase(block.starts.begin() + i);
+    block.subscribers.erase(block.subscribers.begin() + i);
+
+    if(block.starts.empty()) {
+        m_block_starts.erase(m_block_starts.begin() + b);
+        m_blocks.erase(m_blocks.begin() + b);
+        return;
+    }
+    m_block_starts[b] = block.starts[0];
+
+    // Fold small blocks into their successor, so blocks don't stay mostly empty.
+    if(b + 1 < m_blocks.size() && block.starts.size() + m_blocks[b + 1]->starts.size() <= max_block_size / 2) {
+        const Block &next = *m_blocks[b + 1];
+        block.starts.insert(block.starts.end(), next.starts.begin(), next.starts.end());
+        block.subscribers.insert(block.subscribers.end(), next.subscribers.begin(), next.subscribers.end());
+        m_block_starts.erase(m_block_starts.begin() + b + 1);
+        m_blocks.erase(m_blocks.begin() + b + 1);
+    }
+}
+
+template<typename Visitor>
+void RangeIndex::visit(channel_t lo, channel_t hi, Visitor visitor)
+{
+    // Calls visitor(start, subscribers) for each segment starting within [lo, hi].
+    for(size_t b = block_of(lo); b < m_blocks.size() && m_block_starts[b] <= hi; ++b) {
+        Block &block = writable_block(b);
+        size_t i = std::lower_bound(block.starts.begin(), block.starts.end(), lo) - block.starts.begin();
+        for(; i < block.starts.size() && block.starts[i] <= hi; ++i) {
+            visitor(block.starts[i], block.subscribers[i]);
+        }
+    }
+}
+
+bool RangeIndex::add(ChannelSubscriber *p, channel_t lo, channel_t hi)
+{
+    split_at(lo);
+    if(hi != CHANNEL_MAX) {
+        split_at(hi + 1);
+    }
+
+    bool is_new = false;
+    std::vector<channel_t> boundaries;
+    visit(lo, hi, [&](channel_t start, Subscribers &subs) {
+        auto it = std::lower_bound(subs.begin(), subs.end(), p);
+        if(it == subs.end() || *it != p) {
+            subs.insert(it, p);
+        }
+        is_new = is_new || subs.size() == 1;
+        boundaries.push_back(start);
+    });
+
+    if(hi != CHANNEL_MAX) {
+        boundaries.push_back(hi + 1);
+    }
+    for(const auto& boundary : boundaries) {
+        merge_at(boundary);
+    }
+
+    return is_new;
+}
+
+void RangeIndex::remove(ChannelSubscriber *p, channel_t lo, channel_t hi, std::vector<Range> &silent_ranges)
+{
+    if(empty()) {
+        return;
+    }
+
+    // Only consider the span between the lowest and highest subscribed channels.
+    const Block &first_block = *m_blocks.front();
+    if(first_block.subscribers[0].empty()) {
+        lo = std::max(lo, first_block.starts.size() > 1 ? first_block.starts[1] : m_block_starts[1]);
+    }
+    const Block &last_block = *m_blocks.back();
+    if(last_block.subscribers.back().empty()) {
+        hi = std::min(hi, channel_t(last_block.starts.back() - 1));
+    }
+    if(lo > hi) {
+        return;
+    }
+
+    split_at(lo);
+    if(hi != CHANNEL_MAX) {
+        split_at(hi + 1);
+    }
+
+    std::vector<channel_t> boundaries;
+    bool prev_silent = false;
+    visit(lo, hi, [&](channel_t start, Subscribers &subs) {
+        auto it = std::lower_bound(subs.begin(), subs.end(), p);
+        if(it != subs.end() && *it == p) {
+            subs.erase(it);
+        }
+
+        // Close off the previous silent range, if this segment doesn't continue it.
+        if(prev_silent && !subs.empty()) {
+            silent_ranges.back().second = start - 1;
+        }
+        if(!prev_silent && subs.empty()) {
+            silent_ranges.push_back(Range(start, hi));
+        }
+        prev_silent = subs.empty();
+        boundaries.push_back(start);
+    });
+
+    if(hi != CHANNEL_MAX) {
+        boundaries.push_back(hi + 1);
+    }
+    for(const auto& boundary : boundaries) {
+        merge_at(boundary);
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "core/types.h"
+#include "util/SmallVector.h"
+
+class ChannelSubscriber;
+
+// A RangeIndex maps ranges of channels to the subscribers interested in them.
+// The whole channel space is split into contiguous segments, each holding the sorted set
+//     of subscribers for every channel in it.  Adjacent segments with the same subscribers
+//     are always merged, so there are never more than two segments per subscribed range.
+// Segments are stored as a two-level B+-tree: sorted blocks of up to max_block_size segments,
+//     found by binary searching the sorted array of block starts, so lookups stay within
+//     contiguous memory and an update only shifts the segments of one block.
+// Copies of a RangeIndex share their blocks, and a block is only copied once it is modified,
+//     so taking a snapshot of the index before changing it is cheap.
+class RangeIndex
+{
+  public:
+    typedef SmallVector<ChannelSubscriber*, 4> Subscribers;
+    typedef std::pair<channel_t, channel_t> Range;
+
+    RangeIndex();
+
+    // find returns the subscribers of the segment containing a channel.
+    const Subscribers &find(channel_t c) const;
+
+    // empty returns true if no channel has any range subscribers.
+    bool empty() const;
+
+    // add subscribes p to the inclusive range [lo, hi].
+    // Returns true if part of the range has no subscribers other than p.
+    bool add(ChannelSubscriber *p, channel_t lo, channel_t hi);
+
+    // remove unsubscribes p from the inclusive range [lo, hi].  Each part of the range which
+    //     is left without any subscribers (within the span of all subscribed ranges) is
+    //     appended to silent_ranges.
+    void remove(ChannelSubscriber *p, channel_t lo, channel_t hi, std::vector<Range> &silent_ranges);
+
+    // segment_count returns the number of segments the channel space is split into.
+    size_t segment_count() const;
+
+  private:
+    static const size_t max_block_size = 64;
+
+    // subscribers[i] holds the subscribers of [starts[i], starts[i + 1]), or up to the
+    // start of the next block for the last segment.
+    struct Block {
+        std::vector<channel_t> starts;
+        std::vector<Subscribers> subscribers;
+    };
+
+    std::vector<channel_t> m_block_starts;
+    std::vector<std::shared_ptr<Block> > m_blocks;
+
+    size_t block_of(channel_t c) const;
+    Block &writable_block(size_t b);
+    void split_at(channel_t c);
+    void merge_at(channel_t c);
+    template<typename Visitor>
+    void visit(channel_t lo, channel_t hi, Visitor visitor);
+};
@@ -1,7 +1,29 @@
 #include "core/global.h"
 #include "NetworkAcceptor.h"
 #include "address_utils.h"
+#include "util/IoLoop.h"
+#include <algorithm>
+#include <cstring>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
 
+static LogCategory acceptor_log("acceptor", "Network Acceptor");
+
+// uvw binds an Addr as IPv4 unless told otherwise, so IPv6 addresses must ask for it.
+static bool is_ipv6(const uvw::Addr &addr)
+{
+    return addr.ip.find(':') != std::string::npos;
+}
+
+static void bind_address(uvw::TcpHandle &handle, const uvw::Addr &addr)
+{
+    if(is_ipv6(addr)) {
+        handle.bind<uvw::IPv6>(addr);
+    } else {
+        handle.bind<uvw::IPv4>(addr);
+    }
+}
 
 NetworkAcceptor::NetworkAcceptor(AcceptorErrorCallback err_callback) :
     m_loop(g_loop),
@@ -17,9 +39,6 @@ void NetworkAcceptor::bind(const std::string &address,
 {
     assert(std::this_thread::get_id() == g_main_thread_id);
 
-    m_acceptor = m_loop->resource<uvw::TcpHandle>();
-    m_acceptor->simultaneousAccepts(true);
-
     std::vector<uvw::Addr> addresses = resolve_address(address, default_port, m_loop);
 
     if(addresses.size() == 0) {
@@ -27,14 +46,70 @@ void NetworkAcceptor::bind(const std::string &address,
         return;
     }
 
+    if(m_listener_count > 1) {
+        size_t listeners = std::min<size_t>(m_listener_count, IoLoop::thread_count());
+#ifndef SO_REUSEPORT
+        listeners = 0;
+#endif
+        if(listeners >= 2) {
+            if(listeners < m_listener_count) {
+                acceptor_log.warning() << "Only opening " << listeners << " listeners on "
+                                       << address << ", one for each I/O thread.\n";
+            }
+
+            m_listeners.resize(listeners);
+            for(size_t i = 0; i < listeners; ++i) {
+                IoLoop::thread(i).tasks().enqueue_task([this, i, addresses]() {
+                    open_listener(i, addresses);
+                });
+            }
+            return;
+        }
+
+        acceptor_log.warning() << "Opening " << m_listener_count << " listeners on " << address
+                               << " needs SO_REUSEPORT and as many I/O threads; "
+                               "opening one instead.\n";
+    }
+
+    m_acceptor = m_loop->resource<uvw::TcpHandle>();
+    m_acceptor->simultaneousAccepts(true);
+
     // Setup listen/error event handlers.
-    start_accept();
+    start_accept(m_acceptor);
 
     for (uvw::Addr& addr : addresses) {
-        m_acceptor->bind(addr);
+        bind_address(*m_acceptor, addr);
     }
 }
 
+void NetworkAcceptor::open_listener(size_t index, const std::vector<uvw::Addr> &addresses)
+{
+#ifdef SO_REUSEPORT
+    // Creating the handle with an address family creates its socket straight away,
+    // so SO_REUSEPORT can be set on it before it's bound.
+    int family = is_ipv6(addresses.front()) ? AF_INET6 : AF_INET;
+    std::shared_ptr<uvw::TcpHandle> listener = IoLoop::current().loop()->resource<uvw::TcpHandle>(family);
+    if(listener == nullptr) {
+        this->m_err_callback(uvw::ErrorEvent{(int)UV_EADDRNOTAVAIL});
+        return;
+    }
+
+    int on = 1;
+    if(setsockopt(listener->fileno(), SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+        acceptor_log.error() << "Couldn't set SO_REUSEPORT on a listener: " << strerror(errno) << "\n";
+    }
+
+    m_listeners[index] = listener;
+
+    // Setup listen/error event handlers.
+    start_accept(listener);
+
+    for (const uvw::Addr& addr : addresses) {
+        bind_address(*listener, addr);
+    }
+#endif
+}
+
 void NetworkAcceptor::start()
 {
     assert(std::this_thread::get_id() == g_main_thread_id);
@@ -45,9 +120,16 @@ void NetworkAcceptor::start()
     }
 
     m_started = true;
-    
+
     // Queue listener for loop.
-    m_acceptor->listen();
+    if(m_acceptor != nullptr) {
+        m_acceptor->listen();
+    }
+    for(size_t i = 0; i < m_listeners.size(); ++i) {
+        IoLoop::thread(i).tasks().enqueue_task([this, i]() {
+            m_listeners[i]->listen();
+        });
+    }
 }
 
 void NetworkAcceptor::stop()
@@ -61,5 +143,12 @@ void NetworkAcceptor::stop()
 
     m_started = false;
 
-    m_acceptor->close();
+    if(m_acceptor != nullptr) {
+        m_acceptor->close();
+    }
+    for(size_t i = 0; i < m_listeners.size(); ++i) {
+        IoLoop::thread(i).tasks().enqueue_task([this, i]() {
+            m_listeners[i]->close();
+        });
+    }
 }
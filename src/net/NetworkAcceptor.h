@@ -1,5 +1,7 @@
 #pragma once
 #include <thread>
+#include <atomic>
+#include <vector>
 #include "deps/uvw/uvw.hpp"
 
 typedef std::function<void(const uvw::ErrorEvent& evt)> AcceptorErrorCallback;
@@ -21,16 +23,34 @@ class NetworkAcceptor
         m_haproxy_mode = haproxy_mode;
     }
 
+    // set_listeners sets how many listening sockets bind() opens. With more than one, each
+    // is opened with SO_REUSEPORT on a different I/O thread's loop, so that the kernel spreads
+    // incoming connections (and the work of accepting them) across those threads. There
+    // can't be more listeners than I/O threads; with none, a single listener is opened.
+    inline void set_listeners(unsigned int count)
+    {
+        m_listener_count = count;
+    }
+
   protected:
     std::unique_ptr<std::thread> m_thread;
     std::shared_ptr<uvw::Loop> m_loop;
     std::shared_ptr<uvw::TcpHandle> m_acceptor;
+    // With SO_REUSEPORT, the listeners, each of which belongs to (and is only touched from)
+    // the I/O thread of the same index. m_acceptor isn't used.
+    std::vector<std::shared_ptr<uvw::TcpHandle> > m_listeners;
+    unsigned int m_listener_count = 1;
 
-    bool m_started = false;
+    std::atomic<bool> m_started; // Read by handle_accept on the I/O threads.
     bool m_haproxy_mode = false;
     AcceptorErrorCallback m_err_callback;
 
     NetworkAcceptor(AcceptorErrorCallback err_callback);
 
-    virtual void start_accept() = 0;
+    // start_accept sets up the listen/error event handlers for a listening socket.
+    virtual void start_accept(const std::shared_ptr<uvw::TcpHandle> &acceptor) = 0;
+
+  private:
+    // open_listener opens the SO_REUSEPORT listener for the calling I/O thread.
+    void open_listener(size_t index, const std::vector<uvw::Addr> &addresses);
 };
@@ -1,4 +1,5 @@
 #include "NetworkClient.h"
+#include <algorithm>
 #include <stdexcept>
 #include "core/global.h"
 #include "config/ConfigVariable.h"
@@ -7,6 +8,7 @@ NetworkClient::NetworkClient(NetworkHandler *handler) : m_handler(handler), m_so
                                                         m_async_timer(), m_send_queue(),
                                                         m_disconnect_error(UV_EOF)
 {
+    m_cork_timer.client = this;
 }
 
 NetworkClient::~NetworkClient()
@@ -16,11 +18,6 @@ NetworkClient::~NetworkClient()
     assert(!is_connected(lock));
 
     shutdown(lock);
-
-    if(m_send_buf != nullptr) {
-        delete [] m_send_buf;
-        m_send_buf = nullptr;
-    }
 }
 
 void NetworkClient::shutdown(std::unique_lock<std::mutex> &lock)
@@ -33,7 +30,7 @@ void NetworkClient::shutdown(std::unique_lock<std::mutex> &lock)
     auto async_timer = m_async_timer;
 
     lock.unlock();
-    TaskQueue::singleton.enqueue_task([=]() {
+    m_io_loop->tasks().enqueue_task([=]() {
         socket->close();
         async_timer->stop();
         async_timer->close();
@@ -55,15 +52,16 @@ void NetworkClient::initialize(const std::shared_ptr<uvw::TcpHandle>& socket,
         throw std::logic_error("Trying to set a socket of a network client whose socket was already set.");
     }
 
-    // This function should ONLY run in the main thread. libuv is not thread-safe.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    // This function should ONLY run in the socket's loop's thread. libuv is not thread-safe.
+    m_io_loop = &IoLoop::of(socket->loop());
+    assert(m_io_loop->in_thread());
 
     m_socket = socket;
 
     m_socket->noDelay(true);
     m_socket->keepAlive(true, uvw::TcpHandle::Time{60});
 
-    m_async_timer = g_loop->resource<uvw::TimerHandle>();
+    m_async_timer = m_io_loop->loop()->resource<uvw::TimerHandle>();
 
     m_remote = remote;
     m_local = local;
@@ -81,99 +79,243 @@ void NetworkClient::initialize(const std::shared_ptr<uvw::TcpHandle>& socket,
         lock.lock();
     }
 
-    // NOT protected by a lock, make sure it runs in main!
+    // NOT protected by a lock, make sure it runs in our loop's thread!
     start_receive();
 }
 
 void NetworkClient::send_datagram(DatagramHandle dg)
 {
+    send_datagrams(DatagramSpan(&dg, 1));
+}
+
+void NetworkClient::send_datagram(DatagramHandle header, DatagramHandle body,
+                                  dgsize_t body_offset)
+{
+    OutgoingDatagram dg(std::move(header), std::move(body), body_offset);
+    queue_datagrams(&dg, &dg + 1);
+}
+
+void NetworkClient::send_datagrams(DatagramSpan dgs)
+{
+    queue_datagrams(dgs.begin(), dgs.end());
+}
+
+void NetworkClient::send_datagrams(const std::vector<OutgoingDatagram> &dgs)
+{
+    queue_datagrams(dgs.begin(), dgs.end());
+}
+
+template<typename It>
+void NetworkClient::queue_datagrams(It begin, It end)
+{
+    std::shared_ptr<NetworkClient> write_owner;
     std::unique_lock<std::mutex> lock(m_mutex);
 
-    // If we aren't connected, stop here.
-    if(!is_connected(lock)) {
+    // If we aren't connected (or are on our way out), stop here.
+    if(!is_connected(lock) || m_local_disconnect) {
         return;
     }
 
-    // Put the packet in our outgoing send queue
-    m_send_queue.push_back(dg);
+    // Put the packets in our outgoing send queue, checking our quota as we go
+    for(It it = begin; it != end; ++it) {
+        m_send_queue.emplace_back(*it);
+        m_total_queue_size += m_send_queue.back().size();
+    }
 
-    // Check our quota, disconnect if it's too much
-    m_total_queue_size += dg->size();
+    // Disconnect if it's too much
     if(m_total_queue_size > m_max_queue_size && m_max_queue_size != 0) {
-        disconnect(UV_ENOBUFS, lock);
+        write_owner = disconnect(UV_ENOBUFS, lock);
         return;
     }
 
-    // Poke the main thread to flush its buffer (it's fine if this is called
-    // twice, it checks if it's already sending)
-    if(g_main_thread_id != std::this_thread::get_id()) {
-        lock.unlock();
-        TaskQueue::singleton.enqueue_task([self = shared_from_this()] () {
+    // Poke our loop's thread to flush its buffer
+    write_owner = request_flush(lock);
+}
+
+size_t NetworkClient::drop_queued_datagrams(size_t count)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    count = std::min(count, m_send_queue.size());
+    for(size_t i = 0; i < count; ++i) {
+        m_total_queue_size -= m_send_queue[i].size();
+    }
+    m_send_queue.erase(m_send_queue.begin(), m_send_queue.begin() + count);
+    if(m_send_queue.empty()) {
+        m_corked = false;
+    }
+
+    // A disconnect waiting on the dropped datagrams won't be finished by a write anymore.
+    if(m_local_disconnect && !m_is_sending && m_total_queue_size == 0) {
+        shutdown(lock);
+    }
+
+    return count;
+}
+
+std::shared_ptr<NetworkClient> NetworkClient::request_flush(std::unique_lock<std::mutex> &lock)
+{
+    if(m_io_loop->in_thread()) {
+        if(!m_flush_policy.cork) {
+            return flush_send_queue(lock);
+        }
+
+        // A write in progress is followed by a flush when it finishes anyway.
+        if(m_flush_deferred || m_is_sending) {
+            return nullptr;
+        }
+        m_flush_deferred = true;
+
+        m_io_loop->defer([self = shared_from_this()]() {
+            std::shared_ptr<NetworkClient> write_owner;
             std::unique_lock<std::mutex> lock(self->m_mutex);
-            self->flush_send_queue(lock);
+            self->m_flush_deferred = false;
+            write_owner = self->corked_flush(lock);
         });
-    } else {
-        flush_send_queue(lock);
+        return nullptr;
     }
+
+    // A pending flush will send everything queued by the time it runs,
+    // so a burst of datagrams only needs to post one.
+    if(m_flush_queued) {
+        return nullptr;
+    }
+    m_flush_queued = true;
+
+    lock.unlock();
+    m_io_loop->tasks().enqueue_task([self = shared_from_this()] () {
+        std::shared_ptr<NetworkClient> write_owner;
+        std::unique_lock<std::mutex> lock(self->m_mutex);
+        self->m_flush_queued = false;
+        write_owner = self->request_flush(lock);
+    });
+    return nullptr;
 }
 
-void NetworkClient::defragment_input(std::unique_lock<std::mutex>& lock)
+std::shared_ptr<NetworkClient> NetworkClient::corked_flush(std::unique_lock<std::mutex> &lock)
 {
-    while(m_data_buf.size() > sizeof(dgsize_t)) {
-        // Enough data to know the expected length of the datagram.
-        dgsize_t data_size = *reinterpret_cast<dgsize_t*>(&m_data_buf[0]);
-        if(m_data_buf.size() >= data_size + sizeof(dgsize_t)) {
-            size_t overread_size = (m_data_buf.size() - data_size - sizeof(dgsize_t));
-            DatagramPtr dg = Datagram::create(reinterpret_cast<const uint8_t*>(&m_data_buf[sizeof(dgsize_t)]), data_size);
-            if(0 < overread_size) {
-                // Splice leftover data to new m_data_buf based on expected datagram length.
-                m_data_buf = std::vector<uint8_t>(reinterpret_cast<uint8_t*>(&m_data_buf[sizeof(dgsize_t) + data_size]),
-                                                  reinterpret_cast<uint8_t*>(&m_data_buf[sizeof(dgsize_t) + data_size + overread_size]));
-            } else {
-                // No overread, buffer is empty.
-                m_data_buf = std::vector<uint8_t>();
-            }
+    assert(m_io_loop->in_thread());
+
+    if(m_flush_policy.max_delay > 0 && m_total_queue_size < m_flush_policy.min_bytes &&
+       !m_local_disconnect && is_connected(lock)) {
+        uint64_t now = (uint64_t)m_io_loop->loop()->now().count();
+        if(!m_corked) {
+            m_corked = true;
+            m_corked_since = now;
+        }
 
-            lock.unlock();
-            m_handler->receive_datagram(dg);
-            lock.lock();
+        if(now - m_corked_since < m_flush_policy.max_delay) {
+            // Wait for more, until the queue's first datagram has waited as long as it may.
+            if(!m_cork_timer.scheduled()) {
+                m_cork_owner = shared_from_this();
+                m_io_loop->timers().schedule(&m_cork_timer,
+                                             m_corked_since + m_flush_policy.max_delay - now);
+            }
+            return nullptr;
         }
-        else {
-            return;
+    }
+
+    return flush_send_queue(lock);
+}
+
+void NetworkClient::CorkTimer::expire()
+{
+    std::shared_ptr<NetworkClient> self, write_owner;
+    {
+        std::unique_lock<std::mutex> lock(client->m_mutex);
+
+        // This keeps the client alive until we've let go of its lock.
+        self = std::move(client->m_cork_owner);
+
+        // Flush the queue being held back, unless it's been flushed already.
+        if(client->m_corked) {
+            write_owner = client->flush_send_queue(lock);
         }
     }
 }
 
-void NetworkClient::process_datagram(const std::unique_ptr<char[]>& data, size_t size)
+// Datagrams at least this long are sliced out of the read buffer rather than copied.
+// A slice keeps the whole buffer (64KiB, as libuv suggests) alive for as long as the datagram
+// lives, so shorter datagrams are copied out; that way a buffer is never pinned by anything less
+// than a sixteenth of its size.
+static const size_t min_slice_size = 4096;
+
+// frame_size returns the size of the datagram a length-tagged frame carries.
+static inline dgsize_t frame_size(const uint8_t *frame)
+{
+    dgsize_t size;
+    memcpy(&size, frame, sizeof(dgsize_t));
+    return swap_le(size);
+}
+
+void NetworkClient::process_datagram(const std::shared_ptr<const uint8_t>& block,
+                                     const uint8_t *data, size_t size)
 {
     std::unique_lock<std::mutex> lock(m_mutex);
 
-    // This function should ONLY run in the main thread. It's a libuv event.
-    assert(std::this_thread::get_id() == g_main_thread_id);
-
-    if(m_data_buf.size() == 0 && size >= sizeof(dgsize_t)) {
-        // Fast-path mode: Check if we have just enough data from the stream for a single datagram.
-        // Should occur in most cases, as we're expecting <= the average TCP MSS for most datagrams.
-        dgsize_t datagram_size = *reinterpret_cast<dgsize_t*>(data.get());
-        if(datagram_size == size - sizeof(dgsize_t)) {
-            // Yep. Dispatch to receive_datagram and early-out.
-            DatagramPtr dg = Datagram::create(reinterpret_cast<const uint8_t*>(data.get() + sizeof(dgsize_t)), datagram_size);
-            lock.unlock();
-            m_handler->receive_datagram(dg);
-            return;
+    // This function should ONLY run in our loop's thread. It's a libuv event.
+    assert(m_io_loop->in_thread());
+
+    // First finish off the datagram left incomplete by the previous read, if there is one;
+    // it's the only one which has to be copied together.
+    while(!m_data_buf.empty() && size > 0) {
+        size_t wanted = sizeof(dgsize_t);
+        if(m_data_buf.size() >= sizeof(dgsize_t)) {
+            wanted += frame_size(&m_data_buf[0]);
         }
+
+        size_t take = std::min(wanted - m_data_buf.size(), size);
+        m_data_buf.insert(m_data_buf.end(), data, data + take);
+        data += take;
+        size -= take;
+
+        if(m_data_buf.size() < sizeof(dgsize_t)
+           || m_data_buf.size() < sizeof(dgsize_t) + frame_size(&m_data_buf[0])) {
+            continue;
+        }
+
+        DatagramPtr dg = Datagram::create(&m_data_buf[sizeof(dgsize_t)],
+                                          m_data_buf.size() - sizeof(dgsize_t));
+        m_data_buf.clear();
+
+        lock.unlock();
+        m_handler->receive_datagram(dg);
+        lock.lock();
     }
 
-    m_data_buf.insert(m_data_buf.end(), data.get(), data.get() + size);
-    defragment_input(lock);
+    // Then every complete datagram in the read, which are usually the whole of it:
+    while(size >= sizeof(dgsize_t)) {
+        dgsize_t data_size = frame_size(data);
+        if(size - sizeof(dgsize_t) < data_size) {
+            break;
+        }
+
+        DatagramPtr dg;
+        if(block != nullptr && data_size >= min_slice_size) {
+            dg = Datagram::create_slice(block, data + sizeof(dgsize_t), data_size);
+        } else {
+            dg = Datagram::create(data + sizeof(dgsize_t), data_size);
+        }
+        data += sizeof(dgsize_t) + data_size;
+        size -= sizeof(dgsize_t) + data_size;
+
+        lock.unlock();
+        m_handler->receive_datagram(dg);
+        lock.lock();
+    }
+
+    // Keep whatever's left over for the next read.
+    if(size > 0) {
+        m_data_buf.assign(data, data + size);
+    }
 }
 
 void NetworkClient::start_receive()
 {
     // Sets up all the handlers needed for the NetworkClient instance and starts receiving data from the stream.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_io_loop->in_thread());
 
-    m_socket->on<uvw::DataEvent>([self = shared_from_this()](const uvw::DataEvent &event, uvw::TcpHandle &) {
+    m_socket->on<uvw::DataEvent>([self = shared_from_this()](uvw::DataEvent &event, uvw::TcpHandle &) {
         if(self->m_haproxy_handler != nullptr) {
             size_t bytes_consumed = self->m_haproxy_handler->consume(reinterpret_cast<const uint8_t*>(event.data.get()), event.length);
             if(bytes_consumed < event.length || bytes_consumed == 0) {
@@ -198,13 +340,21 @@ void NetworkClient::start_receive()
                 ssize_t bytes_left = bytes_consumed > 0 ? event.length - bytes_consumed : 0;
                 if(0 < bytes_left) {
                     // Feed any left-over bytes (if any) back to process_datagram.
-                    std::unique_ptr<char[]> overread_bytes = std::make_unique<char[]>(bytes_left);
-                    memcpy(overread_bytes.get(), event.data.get() + bytes_consumed, bytes_left);
-                    self->process_datagram(overread_bytes, bytes_left);
+                    self->process_datagram(nullptr,
+                                           reinterpret_cast<const uint8_t*>(event.data.get()) + bytes_consumed,
+                                           bytes_left);
                 } 
             }
+        } else if(event.length >= min_slice_size) {
+            // Take over the read buffer, so the long datagrams in it can be sliced out of it.
+            const uint8_t *data = reinterpret_cast<const uint8_t*>(event.data.release());
+            std::shared_ptr<const uint8_t> block(data, [](const uint8_t *p) {
+                delete [] reinterpret_cast<const char*>(p);
+            });
+            self->process_datagram(block, data, event.length);
         } else {
-            self->process_datagram(event.data, event.length);
+            self->process_datagram(nullptr, reinterpret_cast<const uint8_t*>(event.data.get()),
+                                   event.length);
         }
     });
 
@@ -220,10 +370,6 @@ void NetworkClient::start_receive()
         self->handle_disconnect(UV_EOF);
     });
 
-    m_socket->on<uvw::WriteEvent>([self = shared_from_this()](const uvw::WriteEvent&, uvw::TcpHandle &) {
-        self->send_finished();
-    });
-
     m_async_timer->on<uvw::TimerEvent>([self = shared_from_this()](const uvw::TimerEvent&, uvw::TimerHandle &) {
         self->send_expired();
     });
@@ -231,11 +377,11 @@ void NetworkClient::start_receive()
     m_socket->read();
 }
 
-void NetworkClient::disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock)
+std::shared_ptr<NetworkClient> NetworkClient::disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock)
 {
     if(m_local_disconnect || m_disconnect_handled) {
         // We've already set the error code and closed the socket; wait.
-        return;
+        return nullptr;
     }
 
     m_local_disconnect = true;
@@ -244,25 +390,18 @@ void NetworkClient::disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock
     if(!m_is_sending && m_total_queue_size == 0) {
         // Nothing left to send out, shutdown the socket immediately.
         shutdown(lock);
-    } else {
-        // Let flush_send_queue execute first:
-        // The send_finished callback is responsible for closing the socket at the end of the flush.
-        if(g_main_thread_id != std::this_thread::get_id()) {
-            lock.unlock();
-            TaskQueue::singleton.enqueue_task([self = shared_from_this()] () {
-                std::unique_lock<std::mutex> lock(self->m_mutex);
-                self->flush_send_queue(lock);
-            });
-        } else {
-            flush_send_queue(lock);
-        }
+        return nullptr;
     }
+
+    // Let flush_send_queue execute first:
+    // The send_finished callback is responsible for closing the socket at the end of the flush.
+    return request_flush(lock);
 }
 
 void NetworkClient::handle_disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock)
 {
-    // This function should ONLY run in the main thread. It's a libuv event.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    // This function should ONLY run in our loop's thread. It's a libuv event.
+    assert(m_io_loop->in_thread());
 
     if(m_disconnect_handled) {
         return;
@@ -285,58 +424,48 @@ void NetworkClient::handle_disconnect(uv_errno_t ec, std::unique_lock<std::mutex
     lock.lock();
 }
 
-void NetworkClient::flush_send_queue(std::unique_lock<std::mutex> &lock)
+std::shared_ptr<NetworkClient> NetworkClient::flush_send_queue(std::unique_lock<std::mutex> &lock)
 {
-    // libuv is NOT thread-safe. This function must ONLY be called in the main
+    // libuv is NOT thread-safe. This function must ONLY be called in our loop's
     // thread.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(m_io_loop->in_thread());
 
     // If we aren't connected, stop here
     if(!is_connected(lock)) {
-        return;
+        return nullptr;
     }
 
-    // Are we sending already?
-    if(m_is_sending) {
-        return;
+    // Are we sending already?  (Or still waiting on an expired write to let go of its buffers?)
+    if(m_is_sending || m_write_owner != nullptr) {
+        return nullptr;
     }
 
     // Do we have anything to send?
     if(!m_send_queue.size()) {
         assert(m_total_queue_size == 0);
-        return;
+        return nullptr;
     }
 
-    auto socket = m_socket;
-
-    // Figure out how big of a send buffer we need
-    size_t buffer_size = 0;
-    for(auto dg : m_send_queue) {
-        buffer_size += sizeof(dgsize_t) + dg->size();
-    }
-    assert(m_send_buf == nullptr);
-    m_send_buf = new char[buffer_size];
-
-    // Fill the send buffer with our data:
-    char *send_ptr = &m_send_buf[0];
-    for(auto dg : m_send_queue) {
-        // Add the size tag:
-        dgsize_t len = swap_le(dg->size());
-        memcpy(send_ptr, (char*)&len, sizeof(dgsize_t));
-        send_ptr += sizeof(dgsize_t);
-
-        // Add the data:
-        memcpy(send_ptr, dg->get_data(), dg->size());
-        send_ptr += dg->size();
-
-        // Discount it from our send queue:
-        m_total_queue_size -= dg->size();
+    // Each datagram goes out straight from its own buffer, after its size tag, so they have to
+    // be kept alive until the write completes.  Nothing else may touch these until then.
+    m_sending.swap(m_send_queue);
+    m_corked = false;
+    m_send_sizes.resize(m_sending.size());
+    m_send_bufs.reserve(m_sending.size() * 3);
+    for(size_t i = 0; i < m_sending.size(); ++i) {
+        const OutgoingDatagram &dg = m_sending[i];
+        m_send_sizes[i] = swap_le((dgsize_t)dg.size());
+        m_send_bufs.push_back(uv_buf_init(reinterpret_cast<char*>(&m_send_sizes[i]),
+                                          sizeof(dgsize_t)));
+        m_send_bufs.push_back(uv_buf_init(const_cast<char*>(
+                reinterpret_cast<const char*>(dg.header->get_data())), dg.header->size()));
+        if(dg.body != nullptr && dg.body->size() > dg.body_offset) {
+            m_send_bufs.push_back(uv_buf_init(const_cast<char*>(
+                    reinterpret_cast<const char*>(dg.body->get_data() + dg.body_offset)),
+                    dg.body->size() - dg.body_offset));
+        }
     }
-    assert(send_ptr == &m_send_buf[buffer_size]);
-
-    // Clean up our m_send_queue:
-    assert(m_total_queue_size == 0);
-    m_send_queue.clear();
+    m_total_queue_size = 0;
 
     // Start async timeout, a value of 0 indicates the writes shouldn't timeout (used in debugging)
     if(m_write_timeout > 0) {
@@ -346,30 +475,66 @@ void NetworkClient::flush_send_queue(std::unique_lock<std::mutex> &lock)
 
     // Bombs away!
     m_is_sending = true;
-    lock.unlock();
-    socket->write(m_send_buf, buffer_size);
-    lock.lock();
+    m_write_owner = shared_from_this();
+    m_write_req.data = this;
+    int err = uv_write(&m_write_req, reinterpret_cast<uv_stream_t*>(m_socket->raw()),
+                       m_send_bufs.data(), m_send_bufs.size(), &NetworkClient::write_callback);
+    if(err < 0) {
+        m_is_sending = false;
+        m_async_timer->stop();
+        std::shared_ptr<NetworkClient> write_owner = write_done();
+        handle_disconnect((uv_errno_t)err, lock);
+        return write_owner;
+    }
+    return nullptr;
 }
 
-void NetworkClient::send_finished()
+void NetworkClient::write_callback(uv_write_t *req, int status)
 {
-    std::unique_lock<std::mutex> lock(m_mutex);
+    NetworkClient *client = static_cast<NetworkClient*>(req->data);
+
+    // This keeps the client alive until we're done with it, so it's declared before the lock:
+    // it may be the last reference, and the lock has to be let go of first.
+    std::shared_ptr<NetworkClient> self, write_owner;
+    std::unique_lock<std::mutex> lock(client->m_mutex);
+    self = client->write_done();
+
+    if(!client->m_is_sending) {
+        // The write already expired; send_expired has cleaned up after it.
+        return;
+    }
 
-    // This function should ONLY run in the main thread. It's a libuv event.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    if(status < 0) {
+        client->m_is_sending = false;
+        if(status != UV_ECANCELED) {
+            client->handle_disconnect((uv_errno_t)status, lock);
+        }
+        return;
+    }
+
+    write_owner = client->send_finished(lock);
+}
+
+std::shared_ptr<NetworkClient> NetworkClient::write_done()
+{
+    m_sending.clear();
+    m_send_sizes.clear();
+    m_send_bufs.clear();
+    return std::move(m_write_owner);
+}
+
+std::shared_ptr<NetworkClient> NetworkClient::send_finished(std::unique_lock<std::mutex> &lock)
+{
+    // This function should ONLY run in our loop's thread. It's a libuv event.
+    assert(m_io_loop->in_thread());
 
     // Mark ourselves as "not sending"
     assert(m_is_sending);
     m_is_sending = false;
 
-    // Discard the buffer we just used:
-    assert(m_send_buf != nullptr);
-    delete [] m_send_buf;
-    m_send_buf = nullptr;
-
     // If we aren't connected, stop here
     if(!is_connected(lock)) {
-        return;
+        return nullptr;
     }
 
     // Cancel the outstanding timeout:
@@ -378,31 +543,29 @@ void NetworkClient::send_finished()
     // If we've had a local disconnect and there are no pending buffers to send, stop here
     if(m_local_disconnect && m_total_queue_size == 0) {
         shutdown(lock);
-        return;
+        return nullptr;
     }
 
     // Flush more items out of the queue:
-    flush_send_queue(lock);
+    return flush_send_queue(lock);
 }
 
 void NetworkClient::send_expired()
 {
+    std::shared_ptr<NetworkClient> write_owner;
     std::unique_lock<std::mutex> lock(m_mutex);
 
-    // This function should ONLY run in the main thread. It's a libuv event.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    // This function should ONLY run in our loop's thread. It's a libuv event.
+    assert(m_io_loop->in_thread());
 
     // We need to clean up after ourselves before invoking disconnect:
     // Otherwise we might inadvertedly end up hitting flush_send_queue, and we don't want to do that here.
+    // The buffers being written stay alive until the write is cancelled by the disconnect.
     assert(m_is_sending);
     m_is_sending = false;
 
-    assert(m_send_buf != nullptr);
-    delete[] m_send_buf;
-    m_send_buf = nullptr;
-
     m_total_queue_size = 0;
     m_send_queue.clear();
 
-    disconnect(UV_ETIMEDOUT, lock);
+    write_owner = disconnect(UV_ETIMEDOUT, lock);
 }
@@ -4,7 +4,7 @@
 #include <mutex>
 #include "deps/uvw/uvw.hpp"
 #include "util/Datagram.h"
-#include "util/TaskQueue.h"
+#include "util/IoLoop.h"
 #include "HAProxyHandler.h"
 
 // NOTES:
@@ -14,11 +14,50 @@
 //
 // To begin receiving, pass it an ASIO socket via initialize().
 //
+// A NetworkClient belongs to the IoLoop its socket is on: the NetworkHandler's
+// callbacks are all made from that loop's thread, which may not be the main thread.
+//
 // You must not destruct your NetworkHandler implementor until
 // receive_disconnect is called!
 
 class NetworkClient;
 
+// An OutgoingDatagram is a datagram to be sent as a header followed by the rest of a body
+//     datagram, from body_offset on.  The body is sent straight from its own buffer, so one body
+//     can be shared by every connection a broadcast goes out on, each adding only its own header.
+struct OutgoingDatagram {
+    OutgoingDatagram(DatagramHandle dg) : header(std::move(dg)), body(), body_offset(0)
+    {
+    }
+    OutgoingDatagram(DatagramHandle header, DatagramHandle body, dgsize_t body_offset) :
+        header(std::move(header)), body(std::move(body)), body_offset(body_offset)
+    {
+    }
+
+    // size returns the size of the datagram as sent.
+    inline size_t size() const
+    {
+        return header->size() + (body != nullptr ? body->size() - body_offset : 0);
+    }
+
+    DatagramHandle header;
+    DatagramHandle body; // May be null, for a datagram which is all header.
+    dgsize_t body_offset;
+};
+
+// A FlushPolicy decides when the datagrams sent on a NetworkClient are written to its socket.
+//     By default, each is written as soon as it's sent (or the write in progress finishes).
+struct FlushPolicy {
+    // If cork is set, datagrams sent from the socket's loop are held back until the loop has
+    //     handled the events it is handling now, so that a burst of them (e.g. the field updates
+    //     of one batch from the MD) goes out in a single write instead of many small ones.
+    bool cork = false;
+    // If max_delay (in ms) is also set, a corked write of fewer than min_bytes is held back
+    //     for longer, waiting for more datagrams, until max_delay has passed since the first.
+    unsigned int max_delay = 0;
+    size_t min_bytes = 0;
+};
+
 class NetworkHandler
 {
 protected:
@@ -68,14 +107,41 @@ public:
         m_max_queue_size = max_bytes;
     }
 
+    inline void set_flush_policy(const FlushPolicy &policy)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_flush_policy = policy;
+    }
+
     // send_datagram immediately sends the datagram over TCP (blocking).
     void send_datagram(DatagramHandle dg);
 
+    // send_datagram(header, body) sends header followed by the rest of body from body_offset,
+    //     as a single datagram, without copying the body.
+    void send_datagram(DatagramHandle header, DatagramHandle body, dgsize_t body_offset);
+
+    // send_datagrams sends a burst of datagrams, in order, as if by send_datagram,
+    //     but queues them all at once so that they go out in a single write.
+    void send_datagrams(DatagramSpan dgs);
+    void send_datagrams(const std::vector<OutgoingDatagram> &dgs);
+
+    // queued_datagrams returns the number of datagrams waiting for the socket to take them.
+    inline size_t queued_datagrams()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_send_queue.size();
+    }
+
+    // drop_queued_datagrams discards up to count of the oldest datagrams that haven't started
+    //     being written yet, returning how many were dropped.
+    size_t drop_queued_datagrams(size_t count);
+
     // disconnect closes the TCP connection without informing the NetworkHandler.
     inline void disconnect(uv_errno_t ec)
     {
+        std::shared_ptr<NetworkClient> write_owner;
         std::unique_lock<std::mutex> lock(m_mutex);
-        disconnect(ec, lock);
+        write_owner = disconnect(ec, lock);
     }
 
     inline void disconnect()
@@ -117,6 +183,13 @@ public:
         return m_is_local;
     }
 
+    // get_io_loop returns the loop our socket is on, or nullptr if we haven't been initialized.
+    inline IoLoop *get_io_loop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_io_loop;
+    }
+
     inline const std::vector<uint8_t>& get_tlvs()
     {
         std::unique_lock<std::mutex> lock(m_mutex);
@@ -135,16 +208,31 @@ private:
                     const uvw::Addr &local,
                     const bool haproxy_mode,
                     std::unique_lock<std::mutex> &lock);
-    void disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock);
+    std::shared_ptr<NetworkClient> disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock);
 
     /* This cleans up all libuv handles */
     void shutdown(std::unique_lock<std::mutex> &lock);
 
     /* Asynchronous call loop */
-    // flush_send_queue is called to try and flush m_send_queue to the socket
-    void flush_send_queue(std::unique_lock<std::mutex> &lock);
+    // flush_send_queue is called to try and flush m_send_queue to the socket.
+    // If the write can't be started, it hands back the reference which was to keep the client
+    //     alive during the write.  That may be the last one, so it (like the one returned by
+    //     each of the functions below that can flush) must be let go of after the lock is.
+    std::shared_ptr<NetworkClient> flush_send_queue(std::unique_lock<std::mutex> &lock);
+    // request_flush flushes m_send_queue on our loop's thread, as the flush policy allows:
+    // from there, immediately or by deferring the flush to the end of the loop iteration;
+    // from elsewhere, by posting a task (with the lock released) unless one is already pending.
+    std::shared_ptr<NetworkClient> request_flush(std::unique_lock<std::mutex> &lock);
+    // corked_flush is the deferred flush of a corked queue.  It holds back a short queue while
+    // the policy's max_delay allows, and flushes anything else.
+    std::shared_ptr<NetworkClient> corked_flush(std::unique_lock<std::mutex> &lock);
+    // write_callback is called by libuv when a write has completed (or failed, or been cancelled).
+    static void write_callback(uv_write_t *req, int status);
+    // write_done releases the datagrams of the write which has just completed, returning the
+    //     reference which kept the client alive during the write.
+    std::shared_ptr<NetworkClient> write_done();
     // send_finished is called when an async_send has completed
-    void send_finished();
+    std::shared_ptr<NetworkClient> send_finished(std::unique_lock<std::mutex> &lock);
     // send_expired is called when an async_send has expired
     void send_expired();
 
@@ -153,8 +241,14 @@ private:
 
     void handle_disconnect(uv_errno_t ec, std::unique_lock<std::mutex> &lock);
 
-    void defragment_input(std::unique_lock<std::mutex> &lock);
-    void process_datagram(const std::unique_ptr<char[]>& data, size_t length);
+    // queue_datagrams adds datagrams to m_send_queue and requests a flush.
+    template<typename It>
+    void queue_datagrams(It begin, It end);
+
+    // process_datagram splits the data read from the socket into datagrams. If block is set,
+    //     data lies within it and the long datagrams are sliced out of it rather than copied.
+    void process_datagram(const std::shared_ptr<const uint8_t>& block,
+                          const uint8_t *data, size_t length);
 
     inline bool is_connected(std::unique_lock<std::mutex>&)
     {   
@@ -162,15 +256,39 @@ private:
     }
 
     bool m_is_sending = false;
-    char *m_send_buf = nullptr;
+    bool m_flush_queued = false;
+    bool m_flush_deferred = false;
+
+    // A corked queue which is being held back: since when, and the timer which flushes it.
+    class CorkTimer : public WheelTimer
+    {
+      public:
+        NetworkClient *client;
+
+      protected:
+        virtual void expire();
+    };
+    bool m_corked = false;
+    uint64_t m_corked_since = 0;
+    CorkTimer m_cork_timer;
+    std::shared_ptr<NetworkClient> m_cork_owner; // Set while the cork timer is scheduled.
+
+    // The write in progress: the datagrams being written, their size tags, and the buffers
+    //     handed to libuv: a size tag, header and (if any) body for each datagram.
+    uv_write_t m_write_req;
+    std::shared_ptr<NetworkClient> m_write_owner; // Set until the write completes.
+    std::vector<OutgoingDatagram> m_sending;
+    std::vector<dgsize_t> m_send_sizes;
+    std::vector<uv_buf_t> m_send_bufs;
 
     NetworkHandler *m_handler;
+    IoLoop *m_io_loop = nullptr; // The loop our socket is on; set by initialize.
     std::shared_ptr<uvw::TcpHandle> m_socket;
     std::shared_ptr<uvw::TimerHandle> m_async_timer;
     std::unique_ptr<HAProxyHandler> m_haproxy_handler;
     uvw::Addr m_remote;
     uvw::Addr m_local;
-    std::vector<uint8_t> m_data_buf;
+    std::vector<uint8_t> m_data_buf; // The start of a datagram split across reads.
 
     // HAProxy specific:
     std::vector<uint8_t> m_tlv_buf;
@@ -179,7 +297,8 @@ private:
     uint64_t m_total_queue_size = 0;
     uint64_t m_max_queue_size = 0;
     unsigned int m_write_timeout = 0;
-    std::vector<DatagramHandle> m_send_queue;
+    FlushPolicy m_flush_policy;
+    std::vector<OutgoingDatagram> m_send_queue;
 
     std::mutex m_mutex;
 
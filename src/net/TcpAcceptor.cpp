@@ -1,4 +1,5 @@
 #include "TcpAcceptor.h"
+#include "util/IoLoop.h"
 
 TcpAcceptor::TcpAcceptor(TcpAcceptorCallback &callback, AcceptorErrorCallback& err_callback) :
     NetworkAcceptor(err_callback),
@@ -6,15 +7,25 @@ TcpAcceptor::TcpAcceptor(TcpAcceptorCallback &callback, AcceptorErrorCallback& e
 {
 }
 
-void TcpAcceptor::start_accept()
+void TcpAcceptor::start_accept(const std::shared_ptr<uvw::TcpHandle> &acceptor)
 {
-    m_acceptor->on<uvw::ListenEvent>([this](const uvw::ListenEvent &, uvw::TcpHandle &srv) {
+    acceptor->on<uvw::ListenEvent>([this](const uvw::ListenEvent &, uvw::TcpHandle &srv) {
         std::shared_ptr<uvw::TcpHandle> client = srv.loop().resource<uvw::TcpHandle>();
         srv.accept(*client);
-        handle_accept(client);
+
+        if(!m_listeners.empty()) {
+            // The kernel has already picked an I/O thread for the connection.
+            handle_accept(client);
+            return;
+        }
+
+        // Spread the connections across the I/O threads' loops (if there are any):
+        IoLoop::next().adopt(client, [this](const std::shared_ptr<uvw::TcpHandle> &socket) {
+            handle_accept(socket);
+        });
     });
 
-    m_acceptor->on<uvw::ErrorEvent>([this](const uvw::ErrorEvent &evt, uvw::TcpHandle &) {
+    acceptor->on<uvw::ErrorEvent>([this](const uvw::ErrorEvent &evt, uvw::TcpHandle &) {
         // Inform the error callback:
         this->m_err_callback(evt);
     });
@@ -13,7 +13,7 @@ class TcpAcceptor : public NetworkAcceptor
   private:
     TcpAcceptorCallback m_callback;
 
-    virtual void start_accept();
+    virtual void start_accept(const std::shared_ptr<uvw::TcpHandle> &acceptor);
     void handle_accept(const std::shared_ptr<uvw::TcpHandle>& socket);
     void handle_endpoints(const std::shared_ptr<uvw::TcpHandle>& socket, const uvw::Addr& remote, const uvw::Addr& local);
 };
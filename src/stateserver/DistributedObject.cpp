@@ -86,6 +86,14 @@ DistributedObject::~DistributedObject()
     }
 }
 
+// is_client_visible returns whether clients (or, with also_owner, the object's owner)
+// are sent the field's value along with the object.
+static bool is_client_visible(const Field *field, bool also_owner)
+{
+    return field->has_keyword("broadcast") || field->has_keyword("clrecv")
+           || (also_owner && field->has_keyword("ownrecv"));
+}
+
 void DistributedObject::append_required_data(DatagramPtr dg, bool client_only, bool also_owner)
 {
     dg->add_doid(m_do_id);
@@ -94,9 +102,8 @@ void DistributedObject::append_required_data(DatagramPtr dg, bool client_only, b
     size_t field_count = m_dclass->get_num_fields();
     for(size_t i = 0; i < field_count; ++i) {
         const Field *field = m_dclass->get_field(i);
-        if(field->has_keyword("required") && !field->as_molecular() && (!client_only
-                || field->has_keyword("broadcast") || field->has_keyword("clrecv")
-                || (also_owner && field->has_keyword("ownrecv")))) {
+        if(field->has_keyword("required") && !field->as_molecular()
+           && (!client_only || is_client_visible(field, also_owner))) {
             dg->add_data(m_required_fields[field]);
         }
     }
@@ -107,8 +114,7 @@ void DistributedObject::append_other_data(DatagramPtr dg, bool client_only, bool
     if(client_only) {
         vector<const Field*> broadcast_fields;
         for(auto it = m_ram_fields.begin(); it != m_ram_fields.end(); ++it) {
-            if(it->first->has_keyword("broadcast") || it->first->has_keyword("clrecv")
-               || (also_owner && it->first->has_keyword("ownrecv"))) {
+            if(is_client_visible(it->first, also_owner)) {
                 broadcast_fields.push_back(it->first);
             }
         }
@@ -127,16 +133,46 @@ void DistributedObject::append_other_data(DatagramPtr dg, bool client_only, bool
     }
 }
 
+size_t DistributedObject::entry_data_size(bool client_only, bool also_owner, bool with_other) const
+{
+    // The field values are kept packed, so their sizes are exactly what will be sent.
+    size_t size = sizeof(doid_t) + sizeof(doid_t) + sizeof(zone_t) + sizeof(uint16_t);
+    size_t field_count = m_dclass->get_num_fields();
+    for(size_t i = 0; i < field_count; ++i) {
+        const Field *field = m_dclass->get_field(i);
+        if(field->has_keyword("required") && !field->as_molecular()
+           && (!client_only || is_client_visible(field, also_owner))) {
+            auto it = m_required_fields.find(field);
+            if(it != m_required_fields.end()) {
+                size += it->second.size();
+            }
+        }
+    }
+
+    if(with_other) {
+        size += sizeof(uint16_t);
+        for(const auto& it : m_ram_fields) {
+            if(!client_only || is_client_visible(it.first, also_owner)) {
+                size += sizeof(uint16_t) + it.second.size();
+            }
+        }
+    }
+    return size;
+}
+
 
 
 void DistributedObject::send_interest_entry(channel_t location, uint32_t context)
 {
-    DatagramPtr dg = Datagram::create(location, m_do_id, m_ram_fields.size() ?
-                                      STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER :
-                                      STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED);
+    bool with_other = !m_ram_fields.empty();
+    DatagramPtr dg = Datagram::create_with_capacity(Datagram::server_header_size()
+                     + sizeof(uint32_t) + entry_data_size(true, false, with_other));
+    dg->add_server_header(location, m_do_id, with_other ?
+                          STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED_OTHER :
+                          STATESERVER_OBJECT_ENTER_INTEREST_WITH_REQUIRED);
     dg->add_uint32(context);
     append_required_data(dg, true);
-    if(m_ram_fields.size()) {
+    if(with_other) {
         append_other_data(dg, true);
     }
     route_datagram(dg);
@@ -144,11 +180,14 @@ void DistributedObject::send_interest_entry(channel_t location, uint32_t context
 
 void DistributedObject::send_location_entry(channel_t location)
 {
-    DatagramPtr dg = Datagram::create(location, m_do_id, m_ram_fields.size() ?
-                                      STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED_OTHER :
-                                      STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED);
+    bool with_other = !m_ram_fields.empty();
+    DatagramPtr dg = Datagram::create_with_capacity(Datagram::server_header_size()
+                     + entry_data_size(true, false, with_other));
+    dg->add_server_header(location, m_do_id, with_other ?
+                          STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED_OTHER :
+                          STATESERVER_OBJECT_ENTER_LOCATION_WITH_REQUIRED);
     append_required_data(dg, true);
-    if(m_ram_fields.size()) {
+    if(with_other) {
         append_other_data(dg, true);
     }
     route_datagram(dg);
@@ -156,11 +195,14 @@ void DistributedObject::send_location_entry(channel_t location)
 
 void DistributedObject::send_ai_entry(channel_t ai)
 {
-    DatagramPtr dg = Datagram::create(ai, m_do_id, m_ram_fields.size() ?
-                                      STATESERVER_OBJECT_ENTER_AI_WITH_REQUIRED_OTHER :
-                                      STATESERVER_OBJECT_ENTER_AI_WITH_REQUIRED);
+    bool with_other = !m_ram_fields.empty();
+    DatagramPtr dg = Datagram::create_with_capacity(Datagram::server_header_size()
+                     + entry_data_size(false, false, with_other));
+    dg->add_server_header(ai, m_do_id, with_other ?
+                          STATESERVER_OBJECT_ENTER_AI_WITH_REQUIRED_OTHER :
+                          STATESERVER_OBJECT_ENTER_AI_WITH_REQUIRED);
     append_required_data(dg);
-    if(m_ram_fields.size()) {
+    if(with_other) {
         append_other_data(dg);
     }
     route_datagram(dg);
@@ -168,11 +210,14 @@ void DistributedObject::send_ai_entry(channel_t ai)
 
 void DistributedObject::send_owner_entry(channel_t owner)
 {
-    DatagramPtr dg = Datagram::create(owner, m_do_id, m_ram_fields.size() ?
-                                      STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED_OTHER :
-                                      STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED);
+    bool with_other = !m_ram_fields.empty();
+    DatagramPtr dg = Datagram::create_with_capacity(Datagram::server_header_size()
+                     + entry_data_size(true, true, with_other));
+    dg->add_server_header(owner, m_do_id, with_other ?
+                          STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED_OTHER :
+                          STATESERVER_OBJECT_ENTER_OWNER_WITH_REQUIRED);
     append_required_data(dg, true, true);
-    if(m_ram_fields.size()) {
+    if(with_other) {
         append_other_data(dg, true, true);
     }
     route_datagram(dg);
@@ -386,26 +431,58 @@ bool DistributedObject::handle_one_update(DatagramIterator &dgi, channel_t sende
         save_field(field, data);
     }
 
-    unordered_set<channel_t> targets;
+    unsigned int targets = 0;
     if(field->has_keyword("broadcast")) {
-        targets.insert(location_as_channel(m_parent_id, m_zone_id));
+        targets |= UPDATE_LOCATION;
     }
     if(field->has_keyword("airecv") && m_ai_channel && m_ai_channel != sender) {
-        targets.insert(m_ai_channel);
+        targets |= UPDATE_AI;
     }
     if(field->has_keyword("ownrecv") && m_owner_channel && m_owner_channel != sender) {
-        targets.insert(m_owner_channel);
+        targets |= UPDATE_OWNER;
     }
-    if(targets.size()) { // TODO: Review this for efficiency?
-        DatagramPtr dg = Datagram::create(targets, sender, STATESERVER_OBJECT_SET_FIELD);
+    if(targets) {
+        const ChannelGroupHandle &group = update_group(targets);
+        DatagramPtr dg = group->create_datagram(sender, STATESERVER_OBJECT_SET_FIELD,
+                         sizeof(doid_t) + sizeof(uint16_t) + data.size());
         dg->add_doid(m_do_id);
         dg->add_uint16(field_id);
         dg->add_data(data);
-        route_datagram(dg);
+        route_datagram(group, dg);
     }
     return true;
 }
 
+const ChannelGroupHandle &DistributedObject::update_group(unsigned int targets)
+{
+    channel_t location = location_as_channel(m_parent_id, m_zone_id);
+    if(location != m_update_groups_location || m_ai_channel != m_update_groups_ai ||
+       m_owner_channel != m_update_groups_owner) {
+        for(auto& group : m_update_groups) {
+            group.reset();
+        }
+        m_update_groups_location = location;
+        m_update_groups_ai = m_ai_channel;
+        m_update_groups_owner = m_owner_channel;
+    }
+
+    ChannelGroupHandle &group = m_update_groups[targets];
+    if(!group) {
+        unordered_set<channel_t> channels;
+        if(targets & UPDATE_LOCATION) {
+            channels.insert(location);
+        }
+        if(targets & UPDATE_AI) {
+            channels.insert(m_ai_channel);
+        }
+        if(targets & UPDATE_OWNER) {
+            channels.insert(m_owner_channel);
+        }
+        group = ChannelGroup::create(channels);
+    }
+    return group;
+}
+
 bool DistributedObject::handle_one_get(DatagramPtr out, uint16_t field_id,
                                        bool succeed_if_unset, bool is_subfield)
 {
@@ -551,11 +628,12 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         break;
     }
     case STATESERVER_OBJECT_CHANGING_LOCATION: {
-        doid_t child_id = dgi.read_doid();
-        doid_t new_parent = dgi.read_doid();
-        zone_t new_zone = dgi.read_zone();
-        doid_t r_do_id = dgi.read_doid();
-        zone_t r_zone = dgi.read_zone();
+        DatagramRegion header = dgi.read_region(sizeof(doid_t) * 3 + sizeof(zone_t) * 2);
+        doid_t child_id = header.read_doid();
+        doid_t new_parent = header.read_doid();
+        zone_t new_zone = header.read_zone();
+        doid_t r_do_id = header.read_doid();
+        zone_t r_zone = header.read_zone();
         if(new_parent == m_do_id) {
             if(m_do_id == r_do_id) {
                 if(new_zone == r_zone) {
@@ -653,7 +731,9 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
         if(dgi.read_doid() != m_do_id) {
             return;    // Not meant for this object!
         }
-        DatagramPtr dg = Datagram::create(sender, m_do_id, STATESERVER_OBJECT_GET_ALL_RESP);
+        DatagramPtr dg = Datagram::create_with_capacity(Datagram::server_header_size()
+                         + sizeof(uint32_t) + entry_data_size(false, false, true));
+        dg->add_server_header(sender, m_do_id, STATESERVER_OBJECT_GET_ALL_RESP);
         dg->add_uint32(context);
         append_required_data(dg);
         append_other_data(dg);
@@ -690,8 +770,9 @@ void DistributedObject::handle_datagram(DatagramHandle, DatagramIterator &dgi)
 
         // Read our requested fields into a sorted set
         set<uint16_t> requested_fields;
+        DatagramRegion field_ids = dgi.read_region(field_count * sizeof(uint16_t));
         for(int i = 0; i < field_count; ++i) {
-            uint16_t field_id = dgi.read_uint16();
+            uint16_t field_id = field_ids.read_uint16();
             if(!requested_fields.insert(field_id).second) {
                 const dclass::Field* field = m_dclass->get_field_by_id(field_id);
                 if(field != nullptr) {
@@ -16,6 +16,12 @@ class DistributedObject : public MDParticipantInterface
 
     virtual void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
 
+    // Objects modify their StateServer's object table, so they share its routing thread.
+    virtual const void *get_routing_affinity() const
+    {
+        return m_stateserver;
+    }
+
     inline doid_t get_id() const
     {
         return m_do_id;
@@ -57,8 +63,24 @@ class DistributedObject : public MDParticipantInterface
     std::unordered_map<zone_t, std::unordered_set<doid_t>> m_zone_objects;
     LogCategory *m_log;
 
+    // Field updates are broadcast to some combination of the object's location, AI and owner,
+    // so there is a ChannelGroup for each combination (indexed by UpdateTargets), built when
+    // first needed.  They're all dropped whenever any of those channels changes.
+    enum UpdateTargets {
+        UPDATE_LOCATION = 1 << 0,
+        UPDATE_AI = 1 << 1,
+        UPDATE_OWNER = 1 << 2,
+    };
+    ChannelGroupHandle m_update_groups[8];
+    channel_t m_update_groups_location = INVALID_CHANNEL;
+    channel_t m_update_groups_ai = INVALID_CHANNEL;
+    channel_t m_update_groups_owner = INVALID_CHANNEL;
+
     void append_required_data(DatagramPtr dg, bool client_only = false, bool also_owner = false);
     void append_other_data(DatagramPtr dg, bool client_only = false, bool also_owner = false);
+    // entry_data_size returns how many bytes append_required_data (and, if with_other,
+    // append_other_data) will add, so entry datagrams can be allocated at the right size.
+    size_t entry_data_size(bool client_only, bool also_owner, bool with_other) const;
 
     void send_interest_entry(channel_t location, uint32_t context);
     void send_location_entry(channel_t location);
@@ -75,6 +97,7 @@ class DistributedObject : public MDParticipantInterface
 
     void save_field(const dclass::Field *field, const std::vector<uint8_t> &data);
     bool handle_one_update(DatagramIterator &dgi, channel_t sender);
+    const ChannelGroupHandle &update_group(unsigned int targets);
     bool handle_one_get(DatagramPtr out, uint16_t field_id,
                         bool succeed_if_unset = false, bool is_subfield = false);
 };
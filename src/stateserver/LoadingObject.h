@@ -16,6 +16,12 @@ class LoadingObject final : public MDParticipantInterface
 
     void begin();
     void handle_datagram(DatagramHandle in_dg, DatagramIterator &dgi);
+
+    // Loaders hand objects and datagrams straight to their DBSS, so they share its routing thread.
+    virtual const void *get_routing_affinity() const
+    {
+        return static_cast<StateServer*>(m_dbss);
+    }
   private:
     DBStateServer *m_dbss;
     doid_t m_do_id;
@@ -0,0 +1,361 @@
+// MDBenchmark measures how fast the MessageDirector routes datagrams between local participants.
+// It is built as astron_md_bench when BUILD_BENCHMARKS is enabled, and prints its results as
+// a single JSON object on stdout, so runs can be compared before deploying routing changes.
+//
+// Each receiving participant subscribes to its own block of channels (and optionally ranges),
+// and one or more senders route datagrams whose targets are spread over all of them.  Every
+// datagram carries the time it was routed, so each delivery adds a latency sample.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "core/global.h"
+#include "core/msgtypes.h"
+#include "messagedirector/MessageDirector.h"
+#include "util/AllocationCounter.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+// The channels receivers subscribe to individually, and to as ranges, start at these.
+static const channel_t single_channel_base = 1000000;
+static const channel_t range_channel_base = channel_t(1) << 40;
+
+// The message type of benchmark datagrams; nothing but the receivers look at it.
+static const uint16_t BENCH_MESSAGE = 0xBE7C;
+
+// The number of different target lists the senders cycle through.
+static const size_t num_patterns = 4096;
+
+struct BenchOptions {
+    unsigned int participants = 16;
+    unsigned int channels = 16;     // Individually subscribed channels per participant.
+    unsigned int ranges = 0;        // Subscribed ranges per participant.
+    unsigned int range_width = 1000;
+    unsigned int fanout = 1;        // Target channels per datagram.
+    unsigned int threads = 1;       // messagedirector.threads; 0 routes on the sending thread.
+    unsigned int senders = 1;
+    unsigned int datagrams = 1000000;
+    unsigned int payload = 64;      // Bytes of payload after the timestamp.
+    unsigned int rate = 0;          // Datagrams per second over all senders; 0 sends flat out.
+    unsigned int queue_limit = 0;   // messagedirector.queue_limit; also bounds each worker's queue.
+};
+
+static std::atomic<uint64_t> delivered(0);
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               bench_clock::now().time_since_epoch()).count();
+}
+
+// A BenchReceiver subscribes to its share of the channels and records the latency of
+// every datagram it receives.  It is only ever handled by one routing thread at a time.
+class BenchReceiver : public MDParticipantInterface
+{
+  public:
+    BenchReceiver(const BenchOptions &opts, unsigned int index)
+    {
+        for(unsigned int i = 0; i < opts.channels; ++i) {
+            subscribe_channel(single_channel_base + channel_t(index) * opts.channels + i);
+        }
+        for(unsigned int i = 0; i < opts.ranges; ++i) {
+            channel_t lo = range_channel_base + (channel_t(index) * opts.ranges + i) * opts.range_width;
+            subscribe_range(lo, lo + opts.range_width - 1);
+        }
+        m_latencies.reserve(size_t(opts.datagrams) * opts.fanout / opts.participants + 1);
+    }
+
+    virtual void handle_datagram(DatagramHandle, DatagramIterator &dgi)
+    {
+        dgi.skip(sizeof(channel_t)); // sender
+        if(dgi.read_uint16() != BENCH_MESSAGE) {
+            return;
+        }
+
+        m_latencies.push_back(now_ns() - dgi.read_uint64());
+        delivered.fetch_add(1, std::memory_order_release);
+    }
+
+    inline const std::vector<uint64_t> &latencies() const
+    {
+        return m_latencies;
+    }
+
+  private:
+    std::vector<uint64_t> m_latencies;
+};
+
+// A BenchSender routes datagrams on behalf of one sending thread.
+class BenchSender : public MDParticipantInterface
+{
+  public:
+    virtual void handle_datagram(DatagramHandle, DatagramIterator&)
+    {
+    }
+
+    inline void send(DatagramHandle dg)
+    {
+        route_datagram(dg);
+    }
+};
+
+// A Pattern is one list of targets, and the number of receivers it reaches.
+struct Pattern {
+    std::vector<channel_t> targets;
+    size_t receivers;
+};
+
+// make_patterns spreads the targets evenly over the receivers' single and range channels,
+// alternating between the two when there are ranges.
+static std::vector<Pattern> make_patterns(const BenchOptions &opts)
+{
+    std::mt19937_64 gen(7199);
+    uint64_t num_singles = std::max<uint64_t>(uint64_t(opts.participants) * opts.channels, 1);
+    uint64_t num_ranges = std::max<uint64_t>(uint64_t(opts.participants) * opts.ranges, 1);
+    std::uniform_int_distribution<uint64_t> single_dist(0, num_singles - 1);
+    std::uniform_int_distribution<uint64_t> range_dist(0, num_ranges - 1);
+    std::uniform_int_distribution<uint64_t> offset_dist(0, opts.range_width - 1);
+
+    std::vector<Pattern> patterns(num_patterns);
+    for(auto& pattern : patterns) {
+        std::unordered_set<unsigned int> receivers;
+        for(unsigned int i = 0; i < opts.fanout; ++i) {
+            bool use_range = opts.ranges > 0 && (opts.channels == 0 || i % 2 == 1);
+            if(use_range) {
+                uint64_t range = range_dist(gen);
+                pattern.targets.push_back(range_channel_base + range * opts.range_width + offset_dist(gen));
+                receivers.insert(range / opts.ranges);
+            } else {
+                uint64_t channel = single_dist(gen);
+                pattern.targets.push_back(single_channel_base + channel);
+                receivers.insert(channel / opts.channels);
+            }
+        }
+        pattern.receivers = receivers.size();
+    }
+    return patterns;
+}
+
+static DatagramHandle make_datagram(const Pattern &pattern, const std::string &payload)
+{
+    DatagramPtr dg = Datagram::create();
+    dg->add_uint8(pattern.targets.size());
+    for(const auto& target : pattern.targets) {
+        dg->add_channel(target);
+    }
+    dg->add_channel(0);
+    dg->add_uint16(BENCH_MESSAGE);
+    dg->add_uint64(now_ns());
+    dg->add_data(payload);
+    return dg;
+}
+
+static uint64_t percentile(std::vector<uint64_t> &samples, double fraction)
+{
+    if(samples.empty()) {
+        return 0;
+    }
+
+    size_t n = std::min(samples.size() - 1, size_t(fraction * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+    return samples[n];
+}
+
+static void print_usage(std::ostream &out)
+{
+    BenchOptions defaults;
+    out << "Usage: astron_md_bench [options]\n"
+        << "  --participants N  receiving participants (" << defaults.participants << ")\n"
+        << "  --channels N      channels subscribed by each participant (" << defaults.channels << ")\n"
+        << "  --ranges N        ranges subscribed by each participant (" << defaults.ranges << ")\n"
+        << "  --range-width N   channels in each range (" << defaults.range_width << ")\n"
+        << "  --fanout N        target channels per datagram (" << defaults.fanout << ")\n"
+        << "  --threads N       routing threads; 0 routes on the sender (" << defaults.threads << ")\n"
+        << "  --senders N       sending threads (" << defaults.senders << ")\n"
+        << "  --datagrams N     datagrams to route (" << defaults.datagrams << ")\n"
+        << "  --payload N       payload bytes per datagram (" << defaults.payload << ")\n"
+        << "  --rate N          datagrams per second, or 0 to send flat out (" << defaults.rate << ")\n"
+        << "  --queue-limit N   the MD's queue_limit, or 0 for none (" << defaults.queue_limit << ")\n"
+        << "Without a rate, the latencies mostly measure how long datagrams wait in the queue.\n";
+}
+
+static bool parse_options(int argc, char *argv[], BenchOptions &opts)
+{
+    struct {
+        const char *name;
+        unsigned int *value;
+    } flags[] = {
+        {"--participants", &opts.participants},
+        {"--channels", &opts.channels},
+        {"--ranges", &opts.ranges},
+        {"--range-width", &opts.range_width},
+        {"--fanout", &opts.fanout},
+        {"--threads", &opts.threads},
+        {"--senders", &opts.senders},
+        {"--datagrams", &opts.datagrams},
+        {"--payload", &opts.payload},
+        {"--rate", &opts.rate},
+        {"--queue-limit", &opts.queue_limit},
+    };
+
+    for(int i = 1; i < argc; ++i) {
+        bool found = false;
+        for(const auto& flag : flags) {
+            if(strcmp(argv[i], flag.name) == 0 && i + 1 < argc) {
+                *flag.value = strtoul(argv[++i], nullptr, 10);
+                found = true;
+                break;
+            }
+        }
+        if(!found) {
+            std::cerr << "Unrecognized option \"" << argv[i] << "\".\n";
+            return false;
+        }
+    }
+
+    if(opts.participants == 0 || (opts.channels == 0 && opts.ranges == 0) || opts.range_width == 0) {
+        std::cerr << "Every participant needs at least one channel or range to subscribe to.\n";
+        return false;
+    }
+    if(opts.fanout == 0 || opts.fanout > 255) {
+        std::cerr << "The fan-out must be between 1 and 255 channels.\n";
+        return false;
+    }
+    if(opts.senders == 0 || (opts.threads == 0 && opts.senders > 1)) {
+        std::cerr << "There must be one sender, or several when routing on threads.\n";
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchOptions opts;
+    if(!parse_options(argc, argv, opts)) {
+        print_usage(std::cerr);
+        return 1;
+    }
+
+    // Keep the MessageDirector's informational output off stdout, which is for the results.
+    g_logger->set_min_severity(LSEVERITY_WARNING);
+    g_main_thread_id = std::this_thread::get_id();
+
+    std::stringstream config;
+    config << "messagedirector:\n"
+           << "    threaded: " << (opts.threads > 0 ? "true" : "false") << "\n"
+           << "    threads: " << std::max(opts.threads, 1u) << "\n"
+           << "    queue_limit: " << opts.queue_limit << "\n";
+    g_config->load(config);
+    MessageDirector::singleton.init_network();
+
+    auto setup_start = bench_clock::now();
+    std::vector<BenchReceiver*> receivers;
+    for(unsigned int i = 0; i < opts.participants; ++i) {
+        receivers.push_back(new BenchReceiver(opts, i));
+    }
+    double setup_ms = std::chrono::duration<double, std::milli>(bench_clock::now() - setup_start).count();
+
+    std::vector<Pattern> patterns = make_patterns(opts);
+    uint64_t expected = 0;
+    for(unsigned int i = 0; i < opts.datagrams; ++i) {
+        expected += patterns[i % num_patterns].receivers;
+    }
+
+    MessageDirector::RoutingStats stats_before = MessageDirector::singleton.routing_stats();
+    auto start = bench_clock::now();
+
+    std::string payload(opts.payload, '\0');
+    std::vector<std::thread> threads;
+    for(unsigned int s = 0; s < opts.senders; ++s) {
+        auto send = [&opts, &patterns, &payload, &start, s]() {
+            BenchSender *sender = new BenchSender;
+            for(unsigned int i = s; i < opts.datagrams; i += opts.senders) {
+                if(opts.rate > 0) {
+                    // Datagram i is due i/rate seconds after the start, whichever thread sends it.
+                    auto due = start + std::chrono::nanoseconds(uint64_t(i) * 1000000000 / opts.rate);
+                    while(bench_clock::now() < due) {
+                        std::this_thread::yield();
+                    }
+                }
+                sender->send(make_datagram(patterns[i % num_patterns], payload));
+            }
+        };
+        if(opts.senders == 1) {
+            // A single sender runs on the main thread, which is the one that routes when unthreaded.
+            send();
+        } else {
+            threads.emplace_back(send);
+        }
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    // Wait for every delivery, giving up if routing stalls for a whole second.
+    uint64_t last_delivered = 0;
+    auto last_progress = bench_clock::now();
+    while(delivered.load(std::memory_order_acquire) < expected) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        uint64_t current = delivered.load(std::memory_order_acquire);
+        if(current != last_delivered) {
+            last_delivered = current;
+            last_progress = bench_clock::now();
+        } else if(bench_clock::now() - last_progress > std::chrono::seconds(1)) {
+            break;
+        }
+    }
+
+    double elapsed_s = std::chrono::duration<double>(bench_clock::now() - start).count();
+    uint64_t total_delivered = delivered.load(std::memory_order_acquire);
+    MessageDirector::RoutingStats stats_after = MessageDirector::singleton.routing_stats();
+    uint64_t allocations = stats_after.allocations - stats_before.allocations;
+    uint64_t routed = stats_after.datagrams - stats_before.datagrams;
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(total_delivered);
+    for(const auto& receiver : receivers) {
+        latencies.insert(latencies.end(), receiver->latencies().begin(), receiver->latencies().end());
+    }
+    uint64_t max_latency = latencies.empty() ? 0 : *std::max_element(latencies.begin(), latencies.end());
+
+    std::cout << "{\n"
+              << "  \"benchmark\": \"astron_md_bench\",\n"
+              << "  \"config\": {"
+              << "\"participants\": " << opts.participants
+              << ", \"channels_per_participant\": " << opts.channels
+              << ", \"ranges_per_participant\": " << opts.ranges
+              << ", \"range_width\": " << opts.range_width
+              << ", \"fanout\": " << opts.fanout
+              << ", \"threads\": " << opts.threads
+              << ", \"senders\": " << opts.senders
+              << ", \"datagrams\": " << opts.datagrams
+              << ", \"payload_bytes\": " << opts.payload
+              << ", \"rate\": " << opts.rate
+              << ", \"queue_limit\": " << opts.queue_limit << "},\n"
+              << "  \"complete\": " << (total_delivered == expected ? "true" : "false") << ",\n"
+              << "  \"setup_ms\": " << setup_ms << ",\n"
+              << "  \"elapsed_s\": " << elapsed_s << ",\n"
+              << "  \"routed_datagrams\": " << routed << ",\n"
+              << "  \"datagrams_per_sec\": " << opts.datagrams / elapsed_s << ",\n"
+              << "  \"deliveries\": " << total_delivered << ",\n"
+              << "  \"expected_deliveries\": " << expected << ",\n"
+              << "  \"deliveries_per_sec\": " << total_delivered / elapsed_s << ",\n"
+              << "  \"latency_us\": {"
+              << "\"p50\": " << percentile(latencies, 0.50) / 1000.0
+              << ", \"p99\": " << percentile(latencies, 0.99) / 1000.0
+              << ", \"p999\": " << percentile(latencies, 0.999) / 1000.0
+              << ", \"max\": " << max_latency / 1000.0 << "},\n"
+              << "  \"routing_allocations\": " << allocations << ",\n"
+              << "  \"allocations_per_datagram\": " << (routed ? double(allocations) / routed : 0.0) << "\n"
+              << "}" << std::endl;
+
+    return total_delivered == expected ? 0 : 2;
+}
@@ -0,0 +1,182 @@
+// RangeIndexBenchmark compares the MessageDirector's RangeIndex against the
+// boost::icl::interval_map based range subscriptions it replaced.
+// It is built as astron_range_bench when BUILD_BENCHMARKS is enabled.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+#include <vector>
+#include <boost/icl/interval_map.hpp>
+#include "messagedirector/ChannelMap.h"
+#include "messagedirector/RangeIndex.h"
+
+typedef boost::icl::discrete_interval<channel_t> interval_t;
+typedef std::chrono::steady_clock bench_clock;
+
+// IclRanges mirrors how ChannelMap used boost::icl before RangeIndex.
+class IclRanges
+{
+  public:
+    bool add(ChannelSubscriber *p, channel_t lo, channel_t hi)
+    {
+        std::unordered_set<ChannelSubscriber *> participant_set;
+        participant_set.insert(p);
+
+        interval_t interval = interval_t::closed(lo, hi);
+        m_map += std::make_pair(interval, participant_set);
+
+        auto interval_range = m_map.equal_range(interval);
+        for(auto it = interval_range.first; it != interval_range.second; ++it) {
+            if(it->second.size() == 1) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void remove(ChannelSubscriber *p, channel_t lo, channel_t hi, std::vector<RangeIndex::Range> &silent)
+    {
+        if(m_map.empty()) {
+            return;
+        }
+
+        std::unordered_set<ChannelSubscriber *> participant_set;
+        participant_set.insert(p);
+
+        channel_t lower = m_map.begin()->first.lower();
+        channel_t upper = m_map.rbegin()->first.upper();
+        interval_t interval = interval_t::closed(std::max(lo, lower), std::min(hi, upper));
+        if(boost::icl::is_empty(interval)) {
+            // ChannelMap didn't check for this, but ICL asserts on it.
+            return;
+        }
+
+        auto silent_ranges = boost::icl::interval_set<channel_t>(interval);
+        auto interval_range = m_map.equal_range(interval);
+        for(auto it = interval_range.first; it != interval_range.second; ++it) {
+            if(!it->second.empty() && !(it->second.size() == 1 && *it->second.begin() == p)) {
+                silent_ranges -= it->first;
+            }
+        }
+
+        m_map -= std::make_pair(interval, participant_set);
+
+        for(auto it = silent_ranges.begin(); it != silent_ranges.end(); ++it) {
+            silent.push_back(RangeIndex::Range(boost::icl::first(*it), boost::icl::last(*it)));
+        }
+    }
+
+    size_t count(channel_t c) const
+    {
+        auto range = boost::icl::find(m_map, c);
+        return range != m_map.end() ? range->second.size() : 0;
+    }
+
+  private:
+    boost::icl::interval_map<channel_t, std::unordered_set<ChannelSubscriber*> > m_map;
+};
+
+// RangeIndexRanges adapts RangeIndex to the same interface.
+class RangeIndexRanges
+{
+  public:
+    bool add(ChannelSubscriber *p, channel_t lo, channel_t hi)
+    {
+        return m_index.add(p, lo, hi);
+    }
+
+    void remove(ChannelSubscriber *p, channel_t lo, channel_t hi, std::vector<RangeIndex::Range> &silent)
+    {
+        m_index.remove(p, lo, hi, silent);
+    }
+
+    size_t count(channel_t c) const
+    {
+        return m_index.find(c).size();
+    }
+
+  private:
+    RangeIndex m_index;
+};
+
+struct Operation {
+    ChannelSubscriber *subscriber;
+    channel_t lo;
+    channel_t hi;
+};
+
+static double elapsed_ms(bench_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count();
+}
+
+template<typename Ranges>
+static void run(const char *name, const std::vector<Operation> &ops, const std::vector<channel_t> &probes)
+{
+    Ranges ranges;
+    std::vector<RangeIndex::Range> silent;
+
+    auto start = bench_clock::now();
+    for(const auto& op : ops) {
+        ranges.add(op.subscriber, op.lo, op.hi);
+    }
+    double add_ms = elapsed_ms(start);
+
+    start = bench_clock::now();
+    size_t hits = 0;
+    for(const auto& c : probes) {
+        hits += ranges.count(c);
+    }
+    double lookup_ms = elapsed_ms(start);
+
+    start = bench_clock::now();
+    for(const auto& op : ops) {
+        ranges.remove(op.subscriber, op.lo, op.hi, silent);
+    }
+    double remove_ms = elapsed_ms(start);
+
+    std::cout << name << ": "
+              << ops.size() << " adds in " << add_ms << " ms, "
+              << probes.size() << " lookups in " << lookup_ms << " ms ("
+              << (lookup_ms * 1e6 / probes.size()) << " ns each, " << hits << " hits), "
+              << ops.size() << " removes in " << remove_ms << " ms, "
+              << silent.size() << " silent ranges" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    // Usage: astron_range_bench [num_ranges] [num_subscribers] [num_lookups]
+    size_t num_ranges = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+    size_t num_subscribers = argc > 2 ? strtoul(argv[2], nullptr, 10) : 64;
+    size_t num_lookups = argc > 3 ? strtoul(argv[3], nullptr, 10) : 1000000;
+
+    // Subscribers are only ever compared by address, so they don't need to exist.
+    std::vector<ChannelSubscriber*> subscribers;
+    for(size_t i = 0; i < num_subscribers; ++i) {
+        subscribers.push_back(reinterpret_cast<ChannelSubscriber*>(uintptr_t(i + 1) * 64));
+    }
+
+    // Model DBSS-style roles: each subscriber owns a handful of large doid ranges,
+    // some of which overlap with other subscribers'.
+    std::mt19937_64 gen(7199);
+    std::uniform_int_distribution<uint64_t> start_dist(1000000, 1000000 + num_ranges * 1000);
+    std::uniform_int_distribution<uint64_t> length_dist(1, 5000);
+    std::uniform_int_distribution<size_t> subscriber_dist(0, num_subscribers - 1);
+
+    std::vector<Operation> ops;
+    for(size_t i = 0; i < num_ranges; ++i) {
+        channel_t lo = start_dist(gen);
+        ops.push_back(Operation{subscribers[subscriber_dist(gen)], lo, lo + length_dist(gen)});
+    }
+
+    std::vector<channel_t> probes;
+    std::uniform_int_distribution<uint64_t> probe_dist(0, 1000000 + num_ranges * 1000 + 5000);
+    for(size_t i = 0; i < num_lookups; ++i) {
+        probes.push_back(probe_dist(gen));
+    }
+
+    run<IclRanges>("boost::icl::interval_map", ops, probes);
+    run<RangeIndexRanges>("RangeIndex", ops, probes);
+    return 0;
+}
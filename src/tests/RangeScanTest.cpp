@@ -0,0 +1,251 @@
+// RangeScanTest checks the SIMD kernels behind dclass::scan_range against a plain scalar scan.
+// Each SimdLevel the CPU supports is forced in turn, and every numeric type is scanned on random
+// arrays of every length up to several vectors, so that each kernel sees short arrays it must
+// leave to the scalar scan, whole vectors, and an overlapping last vector.  The integers cluster
+// around zero and around the sign bit, which covers the signed comparisons and the sign flip the
+// unsigned 64-bit kernels rely on; the floats include zeros, infinities and NaNs.
+// It is built as astron_range_scan_test and run by ctest.
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include <vector>
+#include "util/range_scan.h"
+
+using dclass::Number;
+
+// The longest array scanned, which is four AVX2 vectors of the smallest type and then some.
+static const size_t max_count = 140;
+// The number of random arrays scanned for each length, type and level.
+static const unsigned int arrays_per_count = 40;
+
+typedef std::mt19937_64 Random;
+
+static bool chance(Random &rng, unsigned int one_in)
+{
+    return rng() % one_in == 0;
+}
+
+// random_integer returns a number which is usually close to zero or to the sign bit,
+// and otherwise any number at all.
+template<typename T>
+static T random_integer(Random &rng, uint64_t base)
+{
+    if(chance(rng, 4)) {
+        return T(rng());
+    }
+    return T(base + (rng() % 9) - 4);
+}
+
+template<typename T>
+static T random_float(Random &rng)
+{
+    switch(rng() % 12) {
+    case 0:
+        return T(0.0);
+    case 1:
+        return T(-0.0);
+    case 2:
+        return std::numeric_limits<T>::infinity();
+    case 3:
+        return -std::numeric_limits<T>::infinity();
+    case 4:
+        return std::numeric_limits<T>::denorm_min();
+    case 5:
+        return std::numeric_limits<T>::lowest();
+    default:
+        return T(int(rng() % 2001) - 1000) / T(8);
+    }
+}
+
+// random_array fills an array with count random numbers of type T.
+template<typename T>
+static std::vector<T> random_array(Random &rng, size_t count,
+                                   typename std::enable_if<std::is_integral<T>::value>::type* = 0)
+{
+    // Each array sticks to one neighbourhood, so that its minimum and maximum are close together
+    // and any lane the kernels get wrong shows.
+    uint64_t base = chance(rng, 2) ? 0 : uint64_t(1) << (sizeof(T) * 8 - 1);
+    std::vector<T> values(count);
+    for(T &value : values) {
+        value = random_integer<T>(rng, base);
+    }
+    return values;
+}
+
+template<typename T>
+static std::vector<T> random_array(Random &rng, size_t count,
+                                   typename std::enable_if<std::is_floating_point<T>::value>::type* = 0)
+{
+    std::vector<T> values(count);
+    for(T &value : values) {
+        value = random_float<T>(rng);
+    }
+    if(chance(rng, 4)) {
+        // The last number is only seen by a kernel's overlapping last vector, so put it there often.
+        size_t at = chance(rng, 2) ? count - 1 : rng() % count;
+        values[at] = chance(rng, 2) ? std::numeric_limits<T>::quiet_NaN()
+                                    : -std::numeric_limits<T>::quiet_NaN();
+    }
+    return values;
+}
+
+// The type a Number holds the range of a T in.
+template<typename T>
+using Widened = typename std::conditional<std::is_floating_point<T>::value, double,
+                typename std::conditional<std::is_signed<T>::value, int64_t, uint64_t>::type>::type;
+
+// Floats are compared by value, because either zero may be the minimum of 0.0 and -0.0.
+static bool same_number(const Number &a, const Number &b)
+{
+    if(a.type == Number::FLOAT && b.type == Number::FLOAT) {
+        return a.floating == b.floating;
+    }
+    return a == b;
+}
+
+static void print_number(const Number &n)
+{
+    switch(n.type) {
+    case Number::INT:
+        std::cerr << n.integer;
+        break;
+    case Number::UINT:
+        std::cerr << n.uinteger;
+        break;
+    case Number::FLOAT:
+        std::cerr << n.floating;
+        break;
+    default:
+        std::cerr << "none";
+        break;
+    }
+}
+
+template<typename T>
+static void print_array(const std::vector<T> &values)
+{
+    for(T value : values) {
+        std::cerr << ' ' << Widened<T>(value);
+    }
+    std::cerr << std::endl;
+}
+
+// How the scans turned out, to show that both outcomes were compared.
+static unsigned int scanned = 0, unordered = 0;
+
+// test_type scans random arrays of T with scan_range and with a scalar loop, returning the
+// number of arrays they disagreed on.
+template<typename T>
+static unsigned int test_type(dclass::Type type, const char *name, Random &rng)
+{
+    unsigned int failures = 0;
+    for(size_t count = 1; count <= max_count; ++count) {
+        for(unsigned int i = 0; i < arrays_per_count && failures < 5; ++i) {
+            std::vector<T> values = random_array<T>(rng, count);
+
+            bool ordered = true;
+            T lo = values[0], hi = values[0];
+            for(T value : values) {
+                if(value != value) {
+                    ordered = false;
+                }
+                if(value < lo) {
+                    lo = value;
+                }
+                if(value > hi) {
+                    hi = value;
+                }
+            }
+            Number expected_min = Number(Widened<T>(lo));
+            Number expected_max = Number(Widened<T>(hi));
+
+            Number min, max;
+            bool result = dclass::scan_range(type, (const uint8_t*)values.data(), count, min, max);
+            if(result != ordered ||
+               (ordered && (!same_number(min, expected_min) || !same_number(max, expected_max)))) {
+                std::cerr << name << ": scan of " << count << " numbers differs:";
+                print_array(values);
+                std::cerr << "    scan_range: ";
+                if(result) {
+                    print_number(min);
+                    std::cerr << " to ";
+                    print_number(max);
+                } else {
+                    std::cerr << "unordered";
+                }
+                std::cerr << std::endl << "    scalar: ";
+                if(ordered) {
+                    print_number(expected_min);
+                    std::cerr << " to ";
+                    print_number(expected_max);
+                } else {
+                    std::cerr << "unordered";
+                }
+                std::cerr << std::endl;
+                ++failures;
+            } else if(ordered) {
+                ++scanned;
+            } else {
+                ++unordered;
+            }
+        }
+    }
+    return failures;
+}
+
+static unsigned int test_level(Random &rng)
+{
+    using namespace dclass;
+
+    unsigned int failed_types = 0;
+    failed_types += test_type<int8_t>(T_INT8, "int8", rng) > 0;
+    failed_types += test_type<int16_t>(T_INT16, "int16", rng) > 0;
+    failed_types += test_type<int32_t>(T_INT32, "int32", rng) > 0;
+    failed_types += test_type<int64_t>(T_INT64, "int64", rng) > 0;
+    failed_types += test_type<uint8_t>(T_CHAR, "char", rng) > 0;
+    failed_types += test_type<uint8_t>(T_UINT8, "uint8", rng) > 0;
+    failed_types += test_type<uint16_t>(T_UINT16, "uint16", rng) > 0;
+    failed_types += test_type<uint32_t>(T_UINT32, "uint32", rng) > 0;
+    failed_types += test_type<uint64_t>(T_UINT64, "uint64", rng) > 0;
+    failed_types += test_type<float>(T_FLOAT32, "float32", rng) > 0;
+    failed_types += test_type<double>(T_FLOAT64, "float64", rng) > 0;
+    return failed_types;
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    Random rng(seed);
+
+    static const struct {
+        dclass::SimdLevel level;
+        const char *name;
+    } levels[] = {
+        {dclass::SIMD_NONE, "scalar"},
+        {dclass::SIMD_SSE42, "SSE4.2"},
+        {dclass::SIMD_AVX2, "AVX2"},
+    };
+
+    unsigned int failed_types = 0;
+    for(const auto &level : levels) {
+        if(level.level > dclass::supported_simd_level()) {
+            std::cout << level.name << ": not supported by this CPU, skipped." << std::endl;
+            continue;
+        }
+
+        dclass::set_simd_level(level.level);
+        scanned = unordered = 0;
+        unsigned int failed = test_level(rng);
+        std::cout << level.name << ": " << scanned << " arrays scanned, " << unordered
+                  << " unordered; " << failed << " types failed." << std::endl;
+        failed_types += failed;
+    }
+    dclass::set_simd_level(dclass::supported_simd_level());
+
+    std::cout << "Seed " << seed << ": " << failed_types << " types failed." << std::endl;
+    return failed_types == 0 ? 0 : 1;
+}
@@ -0,0 +1,318 @@
+// UnpackPlanTest checks that DatagramIterator unpacks and skips a field by its UnpackPlan with
+// exactly the same result as by walking its DistributedType: the same data copied out, the same
+// amount read, or the same exception thrown.  Constraint violations must have the same message
+// too, but running off the end of the data needn't: the plan takes bigger steps, so it may
+// report trying to read further.
+// It is built as astron_unpack_plan_test and run by ctest on test/files/test.dc, along with a few
+// fields of its own which cover the ops that file doesn't.  Each field is given randomized
+// packed data, most of it well-formed, some out of range, malformed or cut short.
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "dclass/dc/File.h"
+#include "dclass/dc/Class.h"
+#include "dclass/file/read.h"
+#include "util/DatagramIterator.h"
+
+// The number of random samples of packed data tried for each field.
+static const unsigned int samples_per_field = 5000;
+
+// Fields covering the ops and constraints test.dc has no use for.
+static const char coverage_dc[] =
+    "struct Ranged {\n"
+    "    uint8(1-9) a;\n"
+    "    int16/10(-5-5) b;\n"
+    "};\n"
+    "struct Plain {\n"
+    "    uint16 a;\n"
+    "    string b;\n"
+    "};\n"
+    "dclass UnpackPlanCoverage {\n"
+    "    repeated(Ranged fixed[3]) broadcast;\n"
+    "    listed(Ranged list[]) broadcast;\n"
+    "    counted(uint32 counted[2-4]) broadcast;\n"
+    "    nested(Plain plains[], Plain[2]) broadcast;\n"
+    "    sized(blob(2-6) b, string(4) s, string(0-3) t) broadcast;\n"
+    "    ranges(float64(-1-1) f, int32(-100-100) i[4], uint64(5-50) u, char c) broadcast;\n"
+    "    grid(uint8(0-10) rows[2][3], int8 signs[]) broadcast;\n"
+    "};\n";
+
+typedef std::mt19937_64 Random;
+
+static bool chance(Random &rng, unsigned int one_in)
+{
+    return rng() % one_in == 0;
+}
+
+static void pack_le(std::vector<uint8_t> &out, uint64_t value, size_t size)
+{
+    for(size_t i = 0; i < size; ++i) {
+        out.push_back(uint8_t(value >> (8 * i)));
+    }
+}
+
+static void pack_size(std::vector<uint8_t> &out, size_t size)
+{
+    pack_le(out, size, sizeof(dgsize_t));
+}
+
+// pack_random appends packed data for a value of type to out.  Values are usually valid,
+// with small numbers (so that they tend to fall within ranges) and printable strings.
+static void pack_random(const dclass::DistributedType *type, std::vector<uint8_t> &out, Random &rng)
+{
+    using namespace dclass;
+
+    switch(type->get_type()) {
+    case T_FLOAT32: {
+        float value = float(int(rng() % 41) - 20) / 10;
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        pack_le(out, chance(rng, 4) ? rng() : bits, 4);
+        break;
+    }
+    case T_FLOAT64: {
+        double value = double(int(rng() % 41) - 20) / 10;
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        if(chance(rng, 8)) {
+            bits = 0x7ff8000000000001ULL; // NaN
+        } else if(chance(rng, 4)) {
+            bits = rng();
+        }
+        pack_le(out, bits, 8);
+        break;
+    }
+    case T_INT8: case T_INT16: case T_INT32: case T_INT64:
+    case T_UINT8: case T_UINT16: case T_UINT32: case T_UINT64:
+    case T_CHAR: {
+        int64_t value = int64_t(rng() % 241) - 120;
+        pack_le(out, chance(rng, 4) ? rng() : uint64_t(value), type->get_size());
+        break;
+    }
+    case T_STRING:
+    case T_VARSTRING:
+    case T_BLOB:
+    case T_VARBLOB: {
+        size_t length = type->has_fixed_size() ? type->get_size() : rng() % 20;
+        if(!type->has_fixed_size()) {
+            pack_size(out, length);
+        }
+        bool text = (type->get_type() == T_STRING || type->get_type() == T_VARSTRING);
+        for(size_t i = 0; i < length; ++i) {
+            out.push_back(text && !chance(rng, 50) ? uint8_t('a' + rng() % 26) : uint8_t(rng()));
+        }
+        break;
+    }
+    case T_ARRAY: {
+        const ArrayType *array = type->as_array();
+        for(size_t i = 0; i < array->get_array_size(); ++i) {
+            pack_random(array->get_element_type(), out, rng);
+        }
+        break;
+    }
+    case T_VARARRAY: {
+        const ArrayType *array = type->as_array();
+        std::vector<uint8_t> elements;
+        size_t count = rng() % 7;
+        for(size_t i = 0; i < count; ++i) {
+            pack_random(array->get_element_type(), elements, rng);
+        }
+        size_t length = elements.size();
+        if(chance(rng, 10)) {
+            // A length which doesn't add up to a whole number of elements.
+            length = rng() % (length + 4);
+        }
+        pack_size(out, length);
+        out.insert(out.end(), elements.begin(), elements.end());
+        break;
+    }
+    case T_STRUCT: {
+        const Struct *dstruct = type->as_struct();
+        for(unsigned int i = 0; i < dstruct->get_num_fields(); ++i) {
+            pack_random(dstruct->get_field(i)->get_type(), out, rng);
+        }
+        break;
+    }
+    case T_METHOD: {
+        const Method *method = type->as_method();
+        for(unsigned int i = 0; i < method->get_num_parameters(); ++i) {
+            pack_random(method->get_parameter(i)->get_type(), out, rng);
+        }
+        break;
+    }
+    default: {
+        break;
+    }
+    }
+}
+
+// An Outcome is what unpacking or skipping a field did: the exception it threw, if any,
+// and otherwise the data it copied out and how far it read.
+struct Outcome {
+    std::string error;
+    std::vector<uint8_t> buffer;
+    dgsize_t offset = 0;
+
+    bool operator==(const Outcome &other) const
+    {
+        return error == other.error && buffer == other.buffer && offset == other.offset;
+    }
+};
+
+template<typename F>
+static Outcome run(DatagramHandle dg, F f)
+{
+    Outcome outcome;
+    DatagramIterator dgi(dg);
+    try {
+        f(dgi, outcome.buffer);
+        outcome.offset = dgi.tell();
+    } catch(const DatagramIteratorEOF &) {
+        outcome.error = "DatagramIteratorEOF";
+    } catch(const FieldConstraintViolation &e) {
+        outcome.error = std::string("FieldConstraintViolation: ") + e.what();
+    }
+    if(!outcome.error.empty()) {
+        // Either may have copied out a different part of the value before it gave up.
+        outcome.buffer.clear();
+    }
+    return outcome;
+}
+
+static void print_outcome(const char *name, const Outcome &outcome)
+{
+    std::cerr << "    " << name << ": ";
+    if(!outcome.error.empty()) {
+        std::cerr << outcome.error << std::endl;
+    } else {
+        std::cerr << outcome.buffer.size() << " bytes unpacked, read to "
+                  << outcome.offset << std::endl;
+    }
+}
+
+static bool compare(const dclass::Field *field, const char *what, const std::vector<uint8_t> &data,
+                    const Outcome &plan, const Outcome &dtype)
+{
+    if(plan == dtype) {
+        return true;
+    }
+
+    std::cerr << field->get_name() << ": " << what << " differs on " << data.size() << " bytes:";
+    for(uint8_t byte : data) {
+        std::cerr << ' ' << std::hex << unsigned(byte) << std::dec;
+    }
+    std::cerr << std::endl;
+    print_outcome("plan", plan);
+    print_outcome("dtype", dtype);
+    return false;
+}
+
+// How the samples turned out when unpacked, to show that every outcome was compared.
+static unsigned int unpacked = 0, violations = 0, truncated = 0;
+
+// test_field tries the field's plan against its type on random data, returning the failures.
+static unsigned int test_field(const dclass::Field *field, Random &rng)
+{
+    const dclass::UnpackPlan *plan = field->get_plan();
+    unsigned int failures = 0;
+    for(unsigned int i = 0; i < samples_per_field && failures < 5; ++i) {
+        std::vector<uint8_t> data;
+        pack_random(field->get_type(), data, rng);
+        if(chance(rng, 8) && !data.empty()) {
+            data[rng() % data.size()] = uint8_t(rng());
+        }
+        if(chance(rng, 8)) {
+            data.resize(rng() % (data.size() + 1));
+        }
+        if(chance(rng, 4)) {
+            data.push_back(uint8_t(rng()));
+        }
+
+        DatagramHandle dg = Datagram::create(data.data(), data.size());
+
+        Outcome by_plan = run(dg, [plan](DatagramIterator &dgi, std::vector<uint8_t> &buffer) {
+            dgi.unpack_ops(plan->begin(), plan->end(), buffer);
+        });
+        Outcome by_dtype = run(dg, [field](DatagramIterator &dgi, std::vector<uint8_t> &buffer) {
+            dgi.unpack_dtype(field->get_type(), buffer);
+        });
+        if(!compare(field, "unpacking", data, by_plan, by_dtype)) {
+            ++failures;
+        } else if(by_plan.error.empty()) {
+            ++unpacked;
+        } else if(by_plan.error == "DatagramIteratorEOF") {
+            ++truncated;
+        } else {
+            ++violations;
+        }
+
+        by_plan = run(dg, [plan](DatagramIterator &dgi, std::vector<uint8_t> &) {
+            dgi.skip_ops(plan->begin(), plan->end());
+        });
+        by_dtype = run(dg, [field](DatagramIterator &dgi, std::vector<uint8_t> &) {
+            dgi.skip_dtype(field->get_type());
+        });
+        if(!compare(field, "skipping", data, by_plan, by_dtype)) {
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        std::cerr << "Usage: " << argv[0] << " <dc file> [seed]" << std::endl;
+        return 2;
+    }
+    uint64_t seed = argc > 2 ? strtoull(argv[2], nullptr, 10) : 1;
+
+    // The same keywords as astrond declares.
+    dclass::File *file = new dclass::File();
+    for(const char *keyword : {"required", "ram", "db", "broadcast", "clrecv", "clsend",
+                               "ownsend", "ownrecv", "airecv"}) {
+        file->add_keyword(keyword);
+    }
+    std::istringstream coverage(coverage_dc);
+    if(!dclass::append(file, argv[1]) || !dclass::append(file, coverage, "<coverage>")) {
+        std::cerr << "Failed to read the dc file." << std::endl;
+        return 2;
+    }
+
+    // Every field of every class and struct, including inherited ones, but each only once.
+    std::vector<const dclass::Field*> fields;
+    std::set<const dclass::Field*> seen;
+    auto add_fields = [&](const dclass::Struct *dstruct) {
+        for(unsigned int i = 0; i < dstruct->get_num_fields(); ++i) {
+            const dclass::Field *field = dstruct->get_field(i);
+            if(field->get_plan() != nullptr && seen.insert(field).second) {
+                fields.push_back(field);
+            }
+        }
+    };
+    for(unsigned int i = 0; i < file->get_num_classes(); ++i) {
+        add_fields(file->get_class(i));
+    }
+    for(unsigned int i = 0; i < file->get_num_structs(); ++i) {
+        add_fields(file->get_struct(i));
+    }
+
+    Random rng(seed);
+    unsigned int failed_fields = 0;
+    for(const dclass::Field *field : fields) {
+        if(test_field(field, rng) > 0) {
+            ++failed_fields;
+        }
+    }
+
+    std::cout << fields.size() << " fields tested with " << samples_per_field
+              << " samples each (seed " << seed << "): " << unpacked << " unpacked, "
+              << violations << " constraint violations, " << truncated << " truncated; "
+              << failed_fields << " fields failed." << std::endl;
+    return failed_fields == 0 && !fields.empty() ? 0 : 1;
+}
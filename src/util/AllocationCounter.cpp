@@ -0,0 +1,39 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+// Incremented by every allocation the thread makes.  It has a trivial initializer,
+// so it is safe to use in operator new before the thread has finished starting up.
+static thread_local uint64_t allocation_count = 0;
+
+uint64_t thread_allocation_count()
+{
+    return allocation_count;
+}
+
+// The replaceable allocation functions: the array and nothrow forms all end up here.
+void *operator new(size_t size)
+{
+    ++allocation_count;
+
+    void *ptr = malloc(size == 0 ? 1 : size);
+    while(ptr == nullptr) {
+        std::new_handler handler = std::get_new_handler();
+        if(handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+        ptr = malloc(size == 0 ? 1 : size);
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
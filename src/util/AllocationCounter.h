@@ -0,0 +1,18 @@
+#pragma once
+#include <cstdint>
+
+// thread_allocation_count returns the number of times the calling thread has allocated
+//     memory through operator new (including SmallVector spilling onto the heap).
+// Hot paths which are meant to be allocation-free compare the count before and after
+//     doing their work, so regressions show up in their statistics instead of a profiler.
+// Counting replaces the global operator new, so it's only done in builds which define
+//     ASTRON_COUNT_ALLOCATIONS and link AllocationCounter.cpp (i.e. astron_md_bench);
+//     everywhere else the count is always 0.
+#ifdef ASTRON_COUNT_ALLOCATIONS
+uint64_t thread_allocation_count();
+#else
+inline uint64_t thread_allocation_count()
+{
+    return 0;
+}
+#endif
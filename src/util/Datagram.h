@@ -9,6 +9,7 @@
 #include <memory>
 #include "core/types.h"
 #include "dclass/util/byteorder.h"
+#include "DatagramPool.h"
 
 #ifdef ASTRON_32BIT_DATAGRAMS
 typedef uint32_t dgsize_t;
@@ -23,6 +24,44 @@ class Datagram; // foward declaration
 typedef std::shared_ptr<Datagram> DatagramPtr;
 typedef std::shared_ptr<const Datagram> DatagramHandle;
 
+// A DatagramSpan is a view of a contiguous sequence of datagrams, such as a burst of datagrams
+// handed over at once.  It doesn't own the datagrams, so it mustn't outlive their container.
+class DatagramSpan
+{
+  public:
+    DatagramSpan(const DatagramHandle *data, size_t size) : m_data(data), m_size(size)
+    {
+    }
+    DatagramSpan(const std::vector<DatagramHandle> &dgs) : m_data(dgs.data()), m_size(dgs.size())
+    {
+    }
+
+    inline const DatagramHandle *begin() const
+    {
+        return m_data;
+    }
+    inline const DatagramHandle *end() const
+    {
+        return m_data + m_size;
+    }
+    inline size_t size() const
+    {
+        return m_size;
+    }
+    inline bool empty() const
+    {
+        return m_size == 0;
+    }
+    inline const DatagramHandle &operator[](size_t i) const
+    {
+        return m_data[i];
+    }
+
+  private:
+    const DatagramHandle *m_data;
+    size_t m_size;
+};
+
 // A DatagramOverflow is an exception which occurs when an add_<value> method is called which would
 // increase the size of the datagram past DGSIZE_MAX (preventing integer and buffer overflow).
 class DatagramOverflow : public std::runtime_error
@@ -40,6 +79,14 @@ class Datagram
     uint8_t* buf;
     size_t buf_cap; // Can be larger than buf_offset, so use a size_t
     size_t buf_offset;
+    // Where buf came from, and so how to give it back:
+    enum BufferOwner : uint8_t {
+        BUFFER_SLAB, // Part of the Datagram's own allocation, so there's nothing to free.
+        BUFFER_POOL, // A block from the datagram pool.
+        BUFFER_ARRAY, // Allocated with new[] by the caller.
+        BUFFER_SHARED, // Part of a larger buffer, kept alive by buf_ref.
+    } buf_owner;
+    std::shared_ptr<const uint8_t> buf_ref;
 
     void check_add_length(dgsize_t len)
     {
@@ -52,150 +99,159 @@ class Datagram
         }
 
         if(new_offset > buf_cap) {
-            uint8_t *tmp_buf = new uint8_t[buf_cap + len + 64];
-            memcpy(tmp_buf, buf, buf_cap);
-            delete [] buf;
-            buf = tmp_buf;
-            buf_cap = buf_cap + len + 64;
+            // Grow geometrically, so building a large datagram a piece at a time stays linear.
+            size_t new_cap = buf_cap * 2;
+            if(new_cap < new_offset) {
+                new_cap = new_offset;
+            } else if(new_cap > DGSIZE_MAX) {
+                new_cap = DGSIZE_MAX;
+            }
+            grow(new_cap);
         }
     }
-    // default-constructor:
-    //     creates a new datagram with some pre-allocated space
-    Datagram() : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
-    {
-    }
-
-    /*
-    // TODO: Deal with overload collision with Datagram(uint16_t message_type)
 
-    // sized-constructor:
-    //     allows you to specify the capacity of the datagram ahead of time,
-    //     this should be used when the exact size is known ahead of time for performance
-    Datagram(dgsize_t capacity) : buf(new uint8_t[capacity]), buf_cap(capacity),
-    	buf_offset(0)
+    void grow(size_t new_cap)
     {
+        uint8_t *tmp_buf = static_cast<uint8_t*>(datagram_pool::allocate(new_cap));
+        memcpy(tmp_buf, buf, buf_offset);
+        release_buffer();
+        buf = tmp_buf;
+        buf_cap = new_cap;
+        buf_owner = BUFFER_POOL;
     }
-    */
 
-    // copy-constructor:
-    //     creates a new datagram which is a deep-copy of another datagram;
-    //     capacity is not perserved and instead is reduced to the size of the source datagram.
-    Datagram(const Datagram &dg) : buf(new uint8_t[dg.size()]), buf_cap(dg.size()),
-        buf_offset(dg.size())
-    {
-        memcpy(buf, dg.buf, dg.size());
-    }
-
-    // shallow-constructor:
-    //     creates a new datagram that uses an existing buffer as its data
-    Datagram(uint8_t *data, dgsize_t length, dgsize_t capacity) : buf(data),
-        buf_cap(capacity), buf_offset(length)
+    void release_buffer()
     {
+        if(buf_owner == BUFFER_POOL) {
+            datagram_pool::release(buf, buf_cap);
+        } else if(buf_owner == BUFFER_ARRAY) {
+            delete [] buf;
+        } else if(buf_owner == BUFFER_SHARED) {
+            buf_ref.reset();
+        }
     }
 
-    // binary-constructor(pointer):
-    //     creates a new datagram with a copy of the data contained at the pointer.
-    Datagram(const uint8_t *data, dgsize_t length) : buf(new uint8_t[length]), buf_cap(length),
-        buf_offset(length)
+    // allocate creates an empty datagram with room for at least capacity bytes.
+    //     The datagram, its shared_ptr control block and its buffer are all one pooled block.
+    static DatagramPtr allocate(size_t capacity)
     {
-        memcpy(buf, data, length);
+        DatagramSlab slab(capacity);
+        return std::allocate_shared<Datagram>(DatagramSlabAllocator<Datagram>(&slab), slab);
     }
 
-    // binary-constructor(vector):
-    //     creates a new datagram with a copy of the binary data contained in a vector<uint8_t>.
-    Datagram(const std::vector<uint8_t> &data) : buf(new uint8_t[data.size()]),
-        buf_cap(data.size()), buf_offset(data.size())
+  public:
+    // slab-constructor:
+    //     creates an empty datagram using the buffer that was allocated along with it.
+    //     Use one of the create methods rather than this.
+    Datagram(const DatagramSlab &slab) : buf(slab.buf), buf_cap(slab.cap), buf_offset(0),
+        buf_owner(BUFFER_SLAB)
     {
-        memcpy(buf, &data[0], data.size());
     }
 
-    // binary-constructor(string):
-    //     creates a new datagram with a copy of the data contained in a string, treated as binary.
-    Datagram(const std::string &data) : buf(new uint8_t[data.length()]), buf_cap(data.length()),
-        buf_offset(data.length())
-    {
-        memcpy(buf, data.c_str(), data.length());
-    }
+    Datagram(const Datagram &) = delete;
+    Datagram &operator=(const Datagram &) = delete;
 
-    // server-header-constructor(single-receiver):
-    //     creates a new datagram initialized with a server header (accepts only 1 receiver).
-    Datagram(channel_t to_channel, channel_t from_channel, uint16_t message_type) :
-        buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
-    {
-        add_server_header(to_channel, from_channel, message_type);
-    }
-
-    // server-header-constructor(multi-target):
-    //     creates a new datagram initialized with a server header (accepts a set of receivers)
-    Datagram(const std::unordered_set<channel_t> &to_channels, channel_t from_channel,
-             uint16_t message_type) : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+    // create makes a new empty datagram with some pre-allocated space.
+    static DatagramPtr create()
     {
-        add_server_header(to_channels, from_channel, message_type);
+        return allocate(64);
     }
 
-    // control-header constructor:
-    //     creates a new datagram initialized with a control header containing the msgtype.
-    Datagram(uint16_t message_type) : buf(new uint8_t[64]), buf_cap(64), buf_offset(0)
+    // create_with_capacity makes a new empty datagram with room for at least capacity bytes.
+    //     When the size of a datagram can be worked out ahead of time, this means it is only
+    //     ever allocated once.
+    static DatagramPtr create_with_capacity(size_t capacity)
     {
-        add_control_header(message_type);
+        return allocate(capacity);
     }
 
-
-  public:
-    static DatagramPtr create()
+    // create(copy) makes a new datagram which is a deep-copy of another datagram;
+    //     capacity is not perserved and instead is reduced to the size of the source datagram.
+    static DatagramPtr create(DatagramHandle dg)
     {
-        DatagramPtr dg_ptr(new Datagram);
+        DatagramPtr dg_ptr = allocate(dg->size());
+        dg_ptr->add_data(dg);
         return dg_ptr;
     }
 
-    static DatagramPtr create(DatagramHandle dg)
+    // create(shallow) makes a new datagram that takes ownership of an existing buffer,
+    //     which must have been allocated with new[].
+    static DatagramPtr create(uint8_t *data, dgsize_t length, dgsize_t capacity)
     {
-        DatagramPtr dg_ptr(new Datagram(*dg.get()));
+        DatagramPtr dg_ptr = allocate(0);
+        dg_ptr->buf = data;
+        dg_ptr->buf_cap = capacity;
+        dg_ptr->buf_offset = length;
+        dg_ptr->buf_owner = BUFFER_ARRAY;
         return dg_ptr;
     }
 
-    static DatagramPtr create(uint8_t *data, dgsize_t length, dgsize_t capacity)
+    // create_slice makes a new datagram which views length bytes at data, inside a larger buffer
+    //     owned by block, instead of copying them.  The block is kept alive for as long as the
+    //     datagram is, and the data is only copied if more is added to the datagram.
+    static DatagramPtr create_slice(std::shared_ptr<const uint8_t> block, const uint8_t *data,
+                                    dgsize_t length)
     {
-        DatagramPtr dg_ptr(new Datagram(data, length, capacity));
+        DatagramPtr dg_ptr = allocate(0);
+        dg_ptr->buf = const_cast<uint8_t*>(data);
+        dg_ptr->buf_cap = length;
+        dg_ptr->buf_offset = length;
+        dg_ptr->buf_owner = BUFFER_SHARED;
+        dg_ptr->buf_ref = std::move(block);
         return dg_ptr;
     }
 
+    // create(binary) makes a new datagram with a copy of the data contained at the pointer.
     static DatagramPtr create(const uint8_t *data, dgsize_t length)
     {
-        DatagramPtr dg_ptr(new Datagram(data, length));
+        DatagramPtr dg_ptr = allocate(length);
+        dg_ptr->add_data(data, length);
         return dg_ptr;
     }
 
+    // create(binary) makes a new datagram with a copy of the binary data in a vector<uint8_t>.
     static DatagramPtr create(const std::vector<uint8_t> &data)
     {
-        DatagramPtr dg_ptr(new Datagram(data));
+        DatagramPtr dg_ptr = allocate(data.size());
+        dg_ptr->add_data(data);
         return dg_ptr;
     }
 
+    // create(binary) makes a new datagram with a copy of the data in a string, treated as binary.
     static DatagramPtr create(const std::string &data)
     {
-        DatagramPtr dg_ptr(new Datagram(data));
+        DatagramPtr dg_ptr = allocate(data.length());
+        dg_ptr->add_data(data);
         return dg_ptr;
     }
 
+    // create(server header) makes a new datagram initialized with a server header
+    //     (accepts only 1 receiver).
     static DatagramPtr create(channel_t to_channel, channel_t from_channel,
                               uint16_t message_type)
     {
-        DatagramPtr dg_ptr(new Datagram(to_channel, from_channel, message_type));
+        DatagramPtr dg_ptr = allocate(64);
+        dg_ptr->add_server_header(to_channel, from_channel, message_type);
         return dg_ptr;
     }
 
+    // create(server header) makes a new datagram initialized with a server header
+    //     (accepts a set of receivers).
     static DatagramPtr create(const std::unordered_set<channel_t> &to_channels,
                               channel_t from_channel,
                               uint16_t message_type)
     {
-        DatagramPtr dg_ptr(new Datagram(to_channels, from_channel, message_type));
+        DatagramPtr dg_ptr = allocate(64);
+        dg_ptr->add_server_header(to_channels, from_channel, message_type);
         return dg_ptr;
     }
 
+    // create(control header) makes a new datagram initialized with a control header
+    //     containing the msgtype.
     static DatagramPtr create(uint16_t message_type)
     {
-        DatagramPtr dg_ptr(new Datagram(message_type));
+        DatagramPtr dg_ptr = allocate(64);
+        dg_ptr->add_control_header(message_type);
         return dg_ptr;
     }
 
@@ -203,7 +259,7 @@ class Datagram
     // destructor
     ~Datagram()
     {
-        delete [] buf;
+        release_buffer();
     }
 
     // add_bool adds an 8-bit integer to the datagram that is guaranteed
@@ -470,6 +526,25 @@ class Datagram
         add_uint16(message_type);
     }
 
+    // reserve makes room for at least capacity bytes in total, so that adding data up to that
+    //     size won't have to grow the datagram again.
+    void reserve(size_t capacity)
+    {
+        if(capacity > DGSIZE_MAX) {
+            capacity = DGSIZE_MAX;
+        }
+        if(capacity > buf_cap) {
+            grow(capacity);
+        }
+    }
+
+    // server_header_size returns the size of a server header with the given number of receivers,
+    //     for working out the size of a datagram ahead of time.
+    static constexpr size_t server_header_size(size_t num_targets = 1)
+    {
+        return sizeof(uint8_t) + (num_targets + 1) * sizeof(channel_t) + sizeof(uint16_t);
+    }
+
     // size returns the amount of data added to the datagram in bytes.
     dgsize_t size() const
     {
@@ -481,7 +556,7 @@ class Datagram
     //       for debugging, and possible performance considerations.
     dgsize_t cap() const
     {
-        return buf_cap;
+        return buf_cap < DGSIZE_MAX ? buf_cap : DGSIZE_MAX;
     }
 
     // get_data returns a pointer to the start of the Datagram's data buffer.
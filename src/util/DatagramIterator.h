@@ -6,6 +6,9 @@
 #include "dclass/dc/Parameter.h"
 #include "dclass/dc/ArrayType.h"
 #include "dclass/dc/NumericType.h"
+#include "dclass/dc/UnpackPlan.h"
+#include <cassert>
+#include <boost/utility/string_view.hpp>
 #ifdef _DEBUG
 #include <fstream>
 #endif
@@ -26,6 +29,152 @@ class FieldConstraintViolation : public std::runtime_error
         FieldConstraintViolation(const std::string &what) : std::runtime_error(what) { }
 };
 
+// A BlobView is a view of binary data held in a datagram.  It doesn't own the data,
+//     so it mustn't outlive the datagram it came from.
+class BlobView
+{
+  public:
+    BlobView(const uint8_t *data, dgsize_t size) : m_data(data), m_size(size)
+    {
+    }
+
+    inline const uint8_t *data() const
+    {
+        return m_data;
+    }
+    inline dgsize_t size() const
+    {
+        return m_size;
+    }
+    inline bool empty() const
+    {
+        return m_size == 0;
+    }
+    inline const uint8_t *begin() const
+    {
+        return m_data;
+    }
+    inline const uint8_t *end() const
+    {
+        return m_data + m_size;
+    }
+    inline uint8_t operator[](dgsize_t i) const
+    {
+        return m_data[i];
+    }
+
+  private:
+    const uint8_t *m_data;
+    dgsize_t m_size;
+};
+
+// A DatagramRegion reads values from a stretch of a datagram whose length has already been
+//     checked, so unlike DatagramIterator it doesn't check each read.  Use one to read a run of
+//     fixed-size values, taking the whole run at once with DatagramIterator::read_region:
+//
+//     DatagramRegion r = dgi.read_region(sizeof(doid_t) * 2 + sizeof(zone_t));
+//     doid_t do_id = r.read_doid();
+//     ...
+//
+//     Reading past the end of the region is a programming error, not a malformed datagram.
+class DatagramRegion
+{
+  public:
+    DatagramRegion(const uint8_t *data, size_t length) : m_ptr(data), m_end(data + length)
+    {
+    }
+
+    bool read_bool()
+    {
+        return read_uint8() != false;
+    }
+    int8_t read_int8()
+    {
+        return read<int8_t>();
+    }
+    int16_t read_int16()
+    {
+        return read<int16_t>();
+    }
+    int32_t read_int32()
+    {
+        return read<int32_t>();
+    }
+    int64_t read_int64()
+    {
+        return read<int64_t>();
+    }
+    uint8_t read_uint8()
+    {
+        return read<uint8_t>();
+    }
+    uint16_t read_uint16()
+    {
+        return read<uint16_t>();
+    }
+    uint32_t read_uint32()
+    {
+        return read<uint32_t>();
+    }
+    uint64_t read_uint64()
+    {
+        return read<uint64_t>();
+    }
+    dgsize_t read_size()
+    {
+        return read<dgsize_t>();
+    }
+    channel_t read_channel()
+    {
+        return read<channel_t>();
+    }
+    doid_t read_doid()
+    {
+        return read<doid_t>();
+    }
+    zone_t read_zone()
+    {
+        return read<zone_t>();
+    }
+    float read_float32()
+    {
+        return read<float>();
+    }
+    double read_float64()
+    {
+        return read<double>();
+    }
+
+    // read_view returns a view of the next <length> bytes of the region.
+    BlobView read_view(dgsize_t length)
+    {
+        assert(length <= get_remaining());
+        BlobView view(m_ptr, length);
+        m_ptr += length;
+        return view;
+    }
+
+    // get_remaining returns the number of unread bytes left in the region.
+    dgsize_t get_remaining() const
+    {
+        return dgsize_t(m_end - m_ptr);
+    }
+
+  private:
+    const uint8_t *m_ptr;
+    const uint8_t *m_end;
+
+    template<typename T>
+    T read()
+    {
+        assert(sizeof(T) <= get_remaining());
+        T r;
+        memcpy(&r, m_ptr, sizeof(T));
+        m_ptr += sizeof(T);
+        return swap_le(r);
+    }
+};
+
 // A DatagramIterator lets you step trough a datagram by reading a single value at a time.
 class DatagramIterator
 {
@@ -33,7 +182,7 @@ class DatagramIterator
     DatagramHandle m_dg;
     size_t m_offset;
 
-    void check_read_length(dgsize_t length)
+    void check_read_length(size_t length)
     {
         size_t new_offset = m_offset + length;
         if(new_offset > m_dg->size()) {
@@ -43,6 +192,16 @@ class DatagramIterator
             throw DatagramIteratorEOF(error.str());
         };
     }
+
+    // read_raw checks that there are <length> bytes left, steps over them,
+    //     and returns a pointer to them.
+    const uint8_t *read_raw(size_t length)
+    {
+        check_read_length(length);
+        const uint8_t *data = m_dg->get_data() + m_offset;
+        m_offset += length;
+        return data;
+    }
   public:
     // constructor
     DatagramIterator(DatagramHandle dg, dgsize_t offset = 0) : m_dg(dg), m_offset(offset)
@@ -212,6 +371,31 @@ class DatagramIterator
         return read_data(length);
     }
 
+    // read_string_view reads a string like read_string, but returns a view of the characters
+    //     in the datagram instead of a copy.  The view is only valid while the datagram is.
+    boost::string_view read_string_view()
+    {
+        dgsize_t length = read_size();
+        return boost::string_view((const char*)read_raw(length), length);
+    }
+
+    // read_blob_view reads a blob like read_blob, but returns a view of the binary part
+    //     in the datagram instead of a copy.  The view is only valid while the datagram is.
+    BlobView read_blob_view()
+    {
+        dgsize_t length = read_size();
+        return BlobView(read_raw(length), length);
+    }
+
+    // read_region checks that there are <length> bytes left in the datagram and steps over them,
+    //     returning a DatagramRegion that reads them back without checking each value.
+    //     The length is taken as a size_t, so one computed from a count read off the wire
+    //     can't wrap around to something short enough to pass the check.
+    DatagramRegion read_region(size_t length)
+    {
+        return DatagramRegion(read_raw(length), length);
+    }
+
     // read_datagram reads a blob from the datagram and returns it as another datagram.
     DatagramPtr read_datagram()
     {
@@ -222,10 +406,8 @@ class DatagramIterator
     // read_data returns the next <length> bytes in the datagram.
     std::vector<uint8_t> read_data(dgsize_t length)
     {
-        check_read_length(length);
-        std::vector<uint8_t> data(m_dg->get_data() + m_offset, m_dg->get_data() + m_offset + length);
-        m_offset += length;
-        return data;
+        const uint8_t *data = read_raw(length);
+        return std::vector<uint8_t>(data, data + length);
     }
 
     // read_remainder returns a vector containing the rest of the bytes in the datagram.
@@ -234,6 +416,13 @@ class DatagramIterator
         return read_data(m_dg->size() - m_offset);
     }
 
+    // copy_remainder adds the rest of the bytes in the datagram to the end of another datagram.
+    void copy_remainder(DatagramPtr dg)
+    {
+        dg->add_data(m_dg->get_data() + m_offset, m_dg->size() - m_offset);
+        m_offset = m_dg->size();
+    }
+
 
     // unpack_field accepts a Field of a distributed class
     //     and returns the packed value for the field.
@@ -247,7 +436,131 @@ class DatagramIterator
     // unpack_field can also be called to read into an existing buffer.
     void unpack_field(const dclass::Field* field, std::vector<uint8_t> &buffer)
     {
-        unpack_dtype(field->get_type(), buffer);
+        const dclass::UnpackPlan* plan = field->get_plan();
+        if(plan != nullptr) {
+            unpack_ops(plan->begin(), plan->end(), buffer);
+        } else {
+            unpack_dtype(field->get_type(), buffer);
+        }
+    }
+
+    // unpack_ops runs the ops of an UnpackPlan, copying the data they unpack into a buffer.
+    //     This has the same effect as unpack_dtype on the type the plan was compiled from.
+    void unpack_ops(const dclass::UnpackOp* op, const dclass::UnpackOp* end,
+                    std::vector<uint8_t> &buffer)
+    {
+        using namespace dclass;
+
+        while(op != end) {
+            switch(op->code) {
+            case UnpackOp::FIXED: {
+                const uint8_t *data = read_raw(op->size);
+                buffer.insert(buffer.end(), data, data + op->size);
+                break;
+            }
+            case UnpackOp::NUMBER: {
+                const uint8_t *data = read_raw(op->size);
+                if(!op->value_within_range(data)) {
+                    std::stringstream error;
+                    error << "Failed to unpack numeric-type field of type " << op->type->get_alias()
+                          << " due to value range constraint violation";
+                    throw FieldConstraintViolation(error.str());
+                }
+                buffer.insert(buffer.end(), data, data + op->size);
+                break;
+            }
+            case UnpackOp::ARRAY: {
+                const uint8_t *data = read_raw(op->size);
+                if(!op->values_within_range(data, op->count)) {
+                    std::stringstream error;
+                    error << "Failed to unpack numeric-type field of type "
+                          << op->type->as_array()->get_element_type()->get_alias()
+                          << " due to value range constraint violation";
+                    throw FieldConstraintViolation(error.str());
+                }
+                buffer.insert(buffer.end(), data, data + op->size);
+                break;
+            }
+            case UnpackOp::STRING:
+            case UnpackOp::VARSTRING:
+            case UnpackOp::VARBLOB: {
+                bool fixed = (op->code == UnpackOp::STRING);
+                dgsize_t len = op->size;
+                if(!fixed) {
+                    len = read_size();
+                    dgsize_t net_len = swap_le(len);
+                    buffer.insert(buffer.end(), (uint8_t*)&net_len, (uint8_t*)&net_len + sizeof(dgsize_t));
+                }
+
+                const uint8_t *data = read_raw(len);
+                if(op->code != UnpackOp::VARBLOB) {
+                    for(size_t i = 0; i < len; ++i) {
+                        // TODO: Move this to an utility function, account for UTF-8 encoding.
+                        if(*(signed char*)&data[i] < 0) {
+                            std::stringstream error;
+                            error << "Failed to unpack " << (fixed ? "fixed" : "variable")
+                                  << "-length string field of type " << op->type->get_alias()
+                                  << " due to string encoding type violation";
+                            throw FieldConstraintViolation(error.str());
+                        }
+                    }
+                }
+                buffer.insert(buffer.end(), data, data + len);
+
+                if(!fixed && !op->type->within_range(nullptr, len)) {
+                    std::stringstream error;
+                    error << "Failed to unpack variable-length field of type " << op->type->get_alias()
+                          << " due to element count constraint violation (got " << len << ")";
+                    throw FieldConstraintViolation(error.str());
+                }
+                break;
+            }
+            case UnpackOp::REPEAT: {
+                for(size_t i = 0; i < op->count; ++i) {
+                    unpack_ops(op + 1, op + 1 + op->body, buffer);
+                }
+                break;
+            }
+            case UnpackOp::VARARRAY: {
+                dgsize_t len = read_size();
+                dgsize_t net_len = swap_le(len);
+                buffer.insert(buffer.end(), (uint8_t*)&net_len, (uint8_t*)&net_len + sizeof(dgsize_t));
+
+                uint64_t elem_cnt = 0;
+                if(op->body == 1 && op[1].code == UnpackOp::FIXED) {
+                    // The elements need no checking, so they can all be copied at once.
+                    size_t element_size = op[1].size;
+                    elem_cnt = (len + element_size - 1) / element_size;
+                    const uint8_t *data = read_raw(elem_cnt * element_size);
+                    buffer.insert(buffer.end(), data, data + elem_cnt * element_size);
+                } else {
+                    size_t cur_ptr = buffer.size();
+                    while(buffer.size() - cur_ptr < len) {
+                        size_t before = buffer.size();
+                        unpack_ops(op + 1, op + 1 + op->body, buffer);
+                        if(buffer.size() == before) {
+                            // An empty element can't add up to the array's length.
+                            std::stringstream error;
+                            error << "Failed to unpack variable-length field of type "
+                                  << op->type->get_alias() << " with empty elements";
+                            throw FieldConstraintViolation(error.str());
+                        }
+                        ++elem_cnt;
+                    }
+                }
+
+                if(!op->type->within_range(nullptr, elem_cnt)) {
+                    std::stringstream error;
+                    error << "Failed to unpack variable-length field of type " << op->type->get_alias()
+                          << " due to element count constraint violation (got " << elem_cnt << ")";
+                    throw FieldConstraintViolation(error.str());
+                }
+                break;
+            }
+            }
+
+            op += 1 + op->body;
+        }
     }
 
     // unpack_dtype accepts a DistributedType and copies the data for the value into a buffer.
@@ -263,16 +576,32 @@ class DatagramIterator
             const ArrayType* array = dtype->as_array();
 
             if(dtype->get_type() == T_ARRAY && array && array->get_element_type()->has_range()) {
-                // Slow-path mode:
-                // We have a (slightly unoptimised) edge case to account for here.
-                // unpack_dtype is normally not recursively invoked in the event that we have a fixed-size array with fixed-size elements (T_ARRAY)
-                // Ergo, we have to do this here instead. We more or less effectively lose out the benefits of our single-read optimisation.
-                // Of course, this only applies if the underlying element type has any constraints applying to it in the first place.
+                const DistributedType* element = array->get_element_type();
+                const NumericType* element_num = element->as_numeric();
+                if(!element_num) {
+                    // Slow-path mode:
+                    // We have a (slightly unoptimised) edge case to account for here.
+                    // unpack_dtype is normally not recursively invoked in the event that we have a fixed-size array with fixed-size elements (T_ARRAY)
+                    // Ergo, we have to do this here instead. We more or less effectively lose out the benefits of our single-read optimisation.
+                    // Of course, this only applies if the underlying element type has any constraints applying to it in the first place.
+
+                    for(size_t i = 0; i < array->get_array_size(); ++i) {
+                        unpack_dtype(element, buffer);
+                    }
 
-                for(size_t i = 0; i < array->get_array_size(); ++i) {
-                    unpack_dtype(array->get_element_type(), buffer);
+                    return;
+                }
+
+                // An array of numbers can still be read in one go, and checked in place.
+                const uint8_t *data = read_raw(dtype->get_size());
+                if(!element_num->values_within_range(data, array->get_array_size())) {
+                    std::stringstream error;
+                    error << "Failed to unpack numeric-type field of type " << element->get_alias()
+                          << " due to value range constraint violation";
+                    throw FieldConstraintViolation(error.str());
                 }
 
+                buffer.insert(buffer.end(), data, data + dtype->get_size());
                 return;
             }
 
@@ -280,12 +609,12 @@ class DatagramIterator
             // Also any other type lucky enough to be fixed size will be computed faster
             const NumericType* num = dtype->as_numeric();
 
-            std::vector<uint8_t> data = read_data(dtype->get_size());
+            const uint8_t *data = read_raw(dtype->get_size());
 
             // Check for any value range constraints applying to fixed-size numerical types:
             if(num && num->has_range()) {
                 // We do have a value range constraint to check for.
-                if(!num->within_range(&data, 0)) {
+                if(!num->value_within_range(data)) {
                     std::stringstream error;
                     error << "Failed to unpack numeric-type field of type " << num->get_alias()
                           << " due to value range constraint violation";
@@ -305,7 +634,7 @@ class DatagramIterator
                 }
             }
 
-            buffer.insert(buffer.end(), data.begin(), data.end());
+            buffer.insert(buffer.end(), data, data + dtype->get_size());
             return;
         }
 
@@ -332,7 +661,7 @@ class DatagramIterator
                 }
             } else if(dtype->get_type() == T_VARSTRING) {
                 // We're dealing with a string, so elem_cnt == len (and we need to validate it is truly a string).
-                std::vector<uint8_t> data = read_data(len);
+                const uint8_t *data = read_raw(len);
 
                 for(size_t i = 0; i < len; ++i) {
                     // TODO: Move this to an utility function, account for UTF-8 encoding.
@@ -344,12 +673,12 @@ class DatagramIterator
                     }
                 }
 
-                buffer.insert(buffer.end(), data.begin(), data.end());
+                buffer.insert(buffer.end(), data, data + len);
                 elem_cnt = len;
             } else {
                 // We're dealing with a blob, ergo elem_cnt == len
-                std::vector<uint8_t> data = read_data(len);
-                buffer.insert(buffer.end(), data.begin(), data.end());
+                const uint8_t *data = read_raw(len);
+                buffer.insert(buffer.end(), data, data + len);
                 elem_cnt = len;
             }
 
@@ -389,7 +718,35 @@ class DatagramIterator
     //     Throws DatagramIteratorEOF if it skips past the end of the datagram.
     void skip_field(const dclass::Field* field)
     {
-        skip_dtype(field->get_type());
+        const dclass::UnpackPlan* plan = field->get_plan();
+        if(plan != nullptr) {
+            skip_ops(plan->begin(), plan->end());
+        } else {
+            skip_dtype(field->get_type());
+        }
+    }
+
+    // skip_ops can be used to seek past the packed data for an UnpackPlan.
+    //     Throws DatagramIteratorEOF if it skips past the end of the datagram.
+    void skip_ops(const dclass::UnpackOp* op, const dclass::UnpackOp* end)
+    {
+        while(op != end) {
+            switch(op->code) {
+            case dclass::UnpackOp::VARSTRING:
+            case dclass::UnpackOp::VARBLOB:
+            case dclass::UnpackOp::VARARRAY: {
+                // Variable-length data is preceded by its length, so its body isn't needed.
+                dgsize_t length = read_size();
+                skip(length);
+                break;
+            }
+            default: {
+                skip(op->size);
+                break;
+            }
+            }
+            op += 1 + op->body;
+        }
     }
 
     // skip_dtype can be used to seek past the packed data for a DistributedType.
@@ -476,6 +833,12 @@ class DatagramIterator
         return msg_type;
     }
 
+    // get_datagram returns the datagram being iterated over.
+    DatagramHandle get_datagram() const
+    {
+        return m_dg;
+    }
+
     // tell returns the current message offset in std::vector<uint8_t>
     dgsize_t tell() const
     {
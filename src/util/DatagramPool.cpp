@@ -0,0 +1,163 @@
+#include "DatagramPool.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace datagram_pool
+{
+
+static const unsigned int class_count = 5;
+static const size_t class_sizes[class_count] = { 64, 256, 1024, 4096, 65536 };
+// The most blocks of each class a thread keeps around (no more than 512KiB apiece).
+static const size_t class_limits[class_count] = { 1024, 1024, 256, 64, 8 };
+// The most full free lists of each class kept in the depot for other threads to take.
+static const size_t depot_limit = 8;
+
+// A free block holds the link to the next one in its own memory.
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+struct FreeList {
+    FreeBlock *head = nullptr;
+    size_t count = 0;
+};
+
+static void delete_list(FreeList &list)
+{
+    while(list.head != nullptr) {
+        FreeBlock *block = list.head;
+        list.head = block->next;
+        ::operator delete(block);
+    }
+    list.count = 0;
+}
+
+// Blocks are often released on a different thread from the one that allocated them (say, a
+// datagram read on an IO thread and dropped on a delivery thread), so they only pass between
+// threads in whole free lists: a thread whose list is full hands it over to the depot, and a
+// thread whose list is empty takes one back.  That way no thread's pool grows past its limits,
+// and the blocks freed on one thread still get back to the threads that allocate them.
+struct Depot {
+    std::mutex lock;
+    std::vector<FreeList> lists[class_count];
+    std::atomic<size_t> counts[class_count];
+
+    Depot()
+    {
+        for(unsigned int c = 0; c < class_count; ++c) {
+            lists[c].reserve(depot_limit);
+            counts[c].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void put(unsigned int c, FreeList &list)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if(lists[c].size() < depot_limit) {
+                lists[c].push_back(list);
+                counts[c].store(lists[c].size(), std::memory_order_relaxed);
+                list = FreeList();
+                return;
+            }
+        }
+        delete_list(list);
+    }
+
+    bool take(unsigned int c, FreeList &list)
+    {
+        if(counts[c].load(std::memory_order_relaxed) == 0) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        if(lists[c].empty()) {
+            return false;
+        }
+        list = lists[c].back();
+        lists[c].pop_back();
+        counts[c].store(lists[c].size(), std::memory_order_relaxed);
+        return true;
+    }
+};
+
+// N.B. the depot is never destroyed, since threads may still be releasing blocks during exit.
+static Depot &depot()
+{
+    static Depot *instance = new Depot;
+    return *instance;
+}
+
+struct ThreadPool {
+    FreeList lists[class_count];
+    ~ThreadPool();
+};
+
+// Set once the thread's pool has been destroyed, since datagrams can still be released later
+// on in the thread's shutdown.  It has a trivial destructor, so it outlives the pool.
+static thread_local bool pool_destroyed = false;
+static thread_local ThreadPool pool;
+
+ThreadPool::~ThreadPool()
+{
+    for(auto& list : lists) {
+        delete_list(list);
+    }
+    pool_destroyed = true;
+}
+
+static unsigned int size_class(size_t size)
+{
+    unsigned int i = 0;
+    while(i < class_count && class_sizes[i] < size) {
+        ++i;
+    }
+    return i;
+}
+
+size_t round_size(size_t size)
+{
+    unsigned int c = size_class(size);
+    return c < class_count ? class_sizes[c] : size;
+}
+
+void *allocate(size_t &size)
+{
+    unsigned int c = size_class(size);
+    if(c == class_count) {
+        return ::operator new(size);
+    }
+
+    size = class_sizes[c];
+    if(!pool_destroyed) {
+        FreeList &list = pool.lists[c];
+        if(list.head != nullptr || depot().take(c, list)) {
+            FreeBlock *block = list.head;
+            list.head = block->next;
+            --list.count;
+            return block;
+        }
+    }
+    return ::operator new(size);
+}
+
+void release(void *block, size_t size)
+{
+    unsigned int c = size_class(size);
+    if(c < class_count && !pool_destroyed) {
+        FreeList &list = pool.lists[c];
+        if(list.count == class_limits[c]) {
+            depot().put(c, list);
+        }
+        FreeBlock *free_block = static_cast<FreeBlock*>(block);
+        free_block->next = list.head;
+        list.head = free_block;
+        ++list.count;
+        return;
+    }
+    ::operator delete(block);
+}
+
+} // close namespace datagram_pool
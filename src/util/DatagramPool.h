@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The datagram pool hands out the memory behind Datagrams from per-thread free lists in a few
+//     size classes (64B, 256B, 1KiB, 4KiB and 64KiB), so that the steady stream of datagrams
+//     passing through a thread doesn't have to go through the general-purpose allocator.
+// A block may be released by a different thread than the one that allocated it.  Each free list
+//     is capped; a thread whose list is full passes it to a shared depot, where threads that run
+//     out take their blocks from.  Anything the depot has no room for (or larger than the biggest
+//     class) goes back to operator delete.
+namespace datagram_pool
+{
+
+// round_size returns the size of the block that would be allocated for size bytes.
+size_t round_size(size_t size);
+
+// allocate returns a block of at least size bytes, and rounds size up to the block's real size.
+void *allocate(size_t &size);
+
+// release returns a block to the pool, where size is the (rounded) size it was allocated with.
+void release(void *block, size_t size);
+
+} // close namespace datagram_pool
+
+class Datagram;
+
+// A DatagramSlab describes the buffer which was carved out of a Datagram's own allocation.
+// Only Datagram can make one, so it can't be used to construct a Datagram anywhere else.
+class DatagramSlab
+{
+    friend class Datagram;
+    template<typename T> friend class DatagramSlabAllocator;
+
+    DatagramSlab(size_t capacity) : buf(nullptr), cap(capacity)
+    {
+    }
+
+    uint8_t *buf;
+    size_t cap;
+};
+
+// A DatagramSlabAllocator is used with std::allocate_shared so that a Datagram, its shared_ptr
+//     control block and its initial buffer all share a single pooled block.  The buffer follows
+//     the control block, and is given whatever remains of the block's size class.
+template<typename T>
+class DatagramSlabAllocator
+{
+    template<typename U> friend class DatagramSlabAllocator;
+
+  public:
+    typedef T value_type;
+
+    DatagramSlabAllocator(DatagramSlab *slab) : m_slab(slab), m_capacity(slab->cap)
+    {
+    }
+    template<typename U>
+    DatagramSlabAllocator(const DatagramSlabAllocator<U> &other) :
+        m_slab(other.m_slab), m_capacity(other.m_capacity)
+    {
+    }
+
+    T *allocate(size_t n)
+    {
+        size_t header = header_size(n);
+        size_t size = header + m_capacity;
+        uint8_t *block = static_cast<uint8_t*>(datagram_pool::allocate(size));
+        m_slab->buf = block + header;
+        m_slab->cap = size - header;
+        return reinterpret_cast<T*>(block);
+    }
+
+    // N.B. the allocator kept in the control block is a copy made before allocate was called,
+    //     so the block's size has to be worked out again from the requested capacity.
+    void deallocate(T *p, size_t n)
+    {
+        size_t size = datagram_pool::round_size(header_size(n) + m_capacity);
+        datagram_pool::release(p, size);
+    }
+
+    template<typename U>
+    bool operator==(const DatagramSlabAllocator<U> &other) const
+    {
+        return m_capacity == other.m_capacity;
+    }
+    template<typename U>
+    bool operator!=(const DatagramSlabAllocator<U> &other) const
+    {
+        return !(*this == other);
+    }
+
+  private:
+    DatagramSlab *m_slab; // Only valid until the block is allocated.
+    size_t m_capacity;
+
+    static size_t header_size(size_t n)
+    {
+        return (n * sizeof(T) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    }
+};
@@ -0,0 +1,85 @@
+#include "EpochReclaimer.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+EpochReclaimer::EpochReclaimer() : m_epoch(1)
+{
+    for(auto& slot : m_slots) {
+        slot.owned.store(false, std::memory_order_relaxed);
+        slot.epoch.store(0, std::memory_order_relaxed);
+    }
+}
+
+EpochReclaimer::~EpochReclaimer()
+{
+    // Nobody can be reading anymore.
+    for(auto& retired : m_retired) {
+        retired.deleter(retired.object);
+    }
+}
+
+EpochReclaimer::ReadGuard::ReadGuard(EpochReclaimer &reclaimer) : m_slot(nullptr)
+{
+    // Threads start looking for a free slot at their own, so they rarely collide.
+    static thread_local size_t preferred_slot =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % max_readers;
+
+    for(size_t i = 0; i < max_readers; ++i) {
+        ReaderSlot &slot = reclaimer.m_slots[(preferred_slot + i) % max_readers];
+        if(!slot.owned.load(std::memory_order_relaxed) &&
+           !slot.owned.exchange(true, std::memory_order_acquire)) {
+            m_slot = &slot;
+            preferred_slot = (preferred_slot + i) % max_readers;
+            break;
+        }
+    }
+
+    if(m_slot != nullptr) {
+        // N.B. this must be visible to writers before we load anything they may retire.
+        m_slot->epoch.store(reclaimer.m_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+}
+
+EpochReclaimer::ReadGuard::~ReadGuard()
+{
+    if(m_slot != nullptr) {
+        m_slot->epoch.store(0, std::memory_order_release);
+        m_slot->owned.store(false, std::memory_order_release);
+    }
+}
+
+void EpochReclaimer::retire(const void *object, void (*deleter)(const void*))
+{
+    // Readers which start after this point announce a later epoch, so they can't see the object.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_relaxed);
+    m_retired.push_back(Retired{object, deleter, epoch});
+}
+
+void EpochReclaimer::reclaim()
+{
+    if(m_retired.empty()) {
+        return;
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t oldest_reader = UINT64_MAX;
+    for(auto& slot : m_slots) {
+        uint64_t epoch = slot.epoch.load(std::memory_order_acquire); // Pairs with readers leaving.
+        if(epoch != 0) {
+            oldest_reader = std::min(oldest_reader, epoch);
+        }
+    }
+
+    auto still_visible = std::partition(m_retired.begin(), m_retired.end(),
+    [oldest_reader](const Retired& retired) {
+        return retired.epoch >= oldest_reader;
+    });
+    for(auto it = still_visible; it != m_retired.end(); ++it) {
+        it->deleter(it->object);
+    }
+    m_retired.erase(still_visible, m_retired.end());
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// An EpochReclaimer defers the deletion of objects which lock-free readers may still be using.
+// Writers publish a replacement for an object, then retire the old one; it is only deleted once
+//     every reader that could have seen it has finished.
+// Readers announce themselves with a ReadGuard.  There are a fixed number of reader slots; when
+//     they're all in use, pinned() returns false and the reader must fall back to the writers' lock.
+// retire() and reclaim() must only be called by one thread at a time (e.g. under the writers' lock).
+class EpochReclaimer
+{
+  private:
+    // A reader owns a slot while it reads, announcing the epoch it started reading in.
+    struct alignas(64) ReaderSlot {
+        std::atomic<bool> owned;
+        std::atomic<uint64_t> epoch; // 0 while the slot isn't in use
+    };
+
+  public:
+    EpochReclaimer();
+    ~EpochReclaimer();
+
+    EpochReclaimer(const EpochReclaimer&) = delete;
+    EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+    class ReadGuard
+    {
+      public:
+        ReadGuard(EpochReclaimer &reclaimer);
+        ~ReadGuard();
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        inline bool pinned() const
+        {
+            return m_slot != nullptr;
+        }
+
+      private:
+        ReaderSlot *m_slot;
+    };
+
+    // retire schedules an object which is no longer reachable by new readers for deletion.
+    template<typename T>
+    inline void retire(const T *object)
+    {
+        if(object != nullptr) {
+            retire(object, [](const void *o) {
+                delete static_cast<const T*>(o);
+            });
+        }
+    }
+    void retire(const void *object, void (*deleter)(const void*));
+
+    // reclaim deletes every retired object that no reader can still be using.
+    void reclaim();
+
+  private:
+    struct Retired {
+        const void *object;
+        void (*deleter)(const void*);
+        uint64_t epoch;
+    };
+
+    static const size_t max_readers = 64;
+
+    ReaderSlot m_slots[max_readers];
+    std::atomic<uint64_t> m_epoch;
+    std::vector<Retired> m_retired;
+};
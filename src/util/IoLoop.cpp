@@ -0,0 +1,198 @@
+#include "IoLoop.h"
+#include <cstring>
+#include <future>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "core/global.h"
+
+static LogCategory ioloop_log("ioloop", "I/O Loop");
+
+// The I/O threads' loops. They are never deleted, as handles belonging to them may still be
+// closed (from a participant's destructor, for instance) while the process is exiting.
+static std::vector<IoLoop*> io_loops;
+static std::atomic<unsigned int> next_loop(0);
+static thread_local IoLoop *current_loop = nullptr;
+
+IoLoop::IoLoop(std::shared_ptr<uvw::Loop> loop, TaskQueue *tasks, std::thread::id thread_id) :
+    m_loop(loop), m_own_tasks(), m_tasks(tasks), m_thread_id(thread_id)
+{
+    m_loop->raw()->data = this;
+}
+
+IoLoop::IoLoop() : m_loop(uvw::Loop::create()), m_own_tasks(new TaskQueue), m_tasks(m_own_tasks.get())
+{
+    m_loop->raw()->data = this;
+
+    // The task queue's handle has to be set up by the thread before anything can be posted,
+    // and it keeps the loop running until stop_threads stops it.
+    std::promise<void> ready;
+    m_thread.reset(new std::thread([this, &ready]() {
+        current_loop = this;
+        m_thread_id = std::this_thread::get_id();
+        m_tasks->init_queue(m_loop, m_thread_id);
+        ready.set_value();
+
+        m_loop->run();
+    }));
+    ready.get_future().wait();
+}
+
+IoLoop& IoLoop::main()
+{
+    static IoLoop *main_loop = new IoLoop(g_loop, &TaskQueue::singleton, g_main_thread_id);
+    return *main_loop;
+}
+
+IoLoop& IoLoop::current()
+{
+    return current_loop != nullptr ? *current_loop : main();
+}
+
+IoLoop& IoLoop::of(const uvw::Loop &loop)
+{
+    IoLoop *io_loop = static_cast<IoLoop*>(loop.raw()->data);
+    return io_loop != nullptr ? *io_loop : main();
+}
+
+IoLoop& IoLoop::next()
+{
+    if(io_loops.empty()) {
+        return main();
+    }
+
+    return *io_loops[next_loop.fetch_add(1, std::memory_order_relaxed) % io_loops.size()];
+}
+
+size_t IoLoop::thread_count()
+{
+    return io_loops.size();
+}
+
+IoLoop& IoLoop::thread(size_t index)
+{
+    return *io_loops.at(index);
+}
+
+void IoLoop::start_threads(unsigned int count)
+{
+    assert(std::this_thread::get_id() == g_main_thread_id);
+    assert(io_loops.empty());
+
+    if(count == 0) {
+        return;
+    }
+
+#ifdef _WIN32
+    ioloop_log.warning() << "I/O threads aren't supported on Windows; "
+                         "all connections will be handled by the main thread.\n";
+#else
+    ioloop_log.info() << "Starting " << count << " I/O threads...\n";
+    for(unsigned int i = 0; i < count; ++i) {
+        io_loops.push_back(new IoLoop());
+    }
+
+    // The threads must be stopped before anything they might be using is destroyed.
+    atexit(&IoLoop::stop_threads);
+#endif
+}
+
+void IoLoop::stop_threads()
+{
+    for(IoLoop *io_loop : io_loops) {
+        if(io_loop->m_thread == nullptr) {
+            continue;
+        }
+
+        io_loop->tasks().enqueue_task([io_loop]() {
+            io_loop->m_loop->stop();
+        });
+        io_loop->m_thread->join();
+        io_loop->m_thread = nullptr;
+    }
+}
+
+TimerWheel& IoLoop::timers()
+{
+    assert(in_thread());
+
+    if(m_timers == nullptr) {
+        m_timers.reset(new TimerWheel(m_loop));
+    }
+    return *m_timers;
+}
+
+void IoLoop::start_deferred()
+{
+    // Deferred tasks are run after the events handled by uv_run's poll (the check handle),
+    //     or, for any deferred by timers or by other deferred tasks, before it next polls
+    //     (the prepare handle).  Both are stopped again once there's nothing left to run.
+    if(m_check == nullptr) {
+        m_check = m_loop->resource<uvw::CheckHandle>();
+        m_check->on<uvw::CheckEvent>([self = this](const uvw::CheckEvent&, uvw::CheckHandle&) {
+            self->run_deferred();
+        });
+        m_prepare = m_loop->resource<uvw::PrepareHandle>();
+        m_prepare->on<uvw::PrepareEvent>([self = this](const uvw::PrepareEvent&, uvw::PrepareHandle&) {
+            self->run_deferred();
+        });
+    }
+
+    m_check->start();
+    m_prepare->start();
+}
+
+void IoLoop::run_deferred()
+{
+    m_running.swap(m_deferred);
+    for(Task &task : m_running) {
+        task();
+    }
+    m_running.clear();
+
+    if(m_deferred.empty()) {
+        m_check->stop();
+        m_prepare->stop();
+    }
+}
+
+void IoLoop::adopt(const std::shared_ptr<uvw::TcpHandle> &socket, AdoptCallback callback)
+{
+    if(&socket->loop() == m_loop.get()) {
+        m_tasks->enqueue_task([socket, callback]() {
+            callback(socket);
+        });
+        return;
+    }
+
+#ifdef _WIN32
+    // start_threads never starts any other loops to move sockets onto.
+    assert(false);
+#else
+    // Hand a duplicate of the socket over to this loop; closing the original handle then
+    // leaves the connection open.
+    int fd = dup(socket->fileno());
+    int dup_error = errno;
+    socket->close();
+    if(fd < 0) {
+        ioloop_log.error() << "Couldn't move a connection onto an I/O thread: "
+                           << strerror(dup_error) << "\n";
+        return;
+    }
+
+    m_tasks->enqueue_task([this, fd, callback]() {
+        std::shared_ptr<uvw::TcpHandle> moved = m_loop->resource<uvw::TcpHandle>();
+        int err = uv_tcp_open(moved->raw(), fd);
+        if(err < 0) {
+            ioloop_log.error() << "Couldn't move a connection onto an I/O thread: "
+                               << uv_strerror(err) << "\n";
+            ::close(fd);
+            moved->close();
+            return;
+        }
+
+        callback(moved);
+    });
+#endif
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include "deps/uvw/uvw.hpp"
+#include "util/TaskQueue.h"
+#include "util/TimerWheel.h"
+
+typedef std::function<void(const std::shared_ptr<uvw::TcpHandle>&)> AdoptCallback;
+
+// An IoLoop is a libuv loop together with the one thread which runs it. libuv is not
+// thread-safe, so a handle may only be used from the thread running its loop; any other
+// thread has to post its work to the loop's TaskQueue instead.
+//
+// The main loop (g_loop) always exists. If general/io_threads is set, that many more loops
+// are started, each on a thread of its own, and accepted connections are spread across them
+// so the main thread isn't left doing the socket work for every connection by itself.
+class IoLoop
+{
+  public:
+    // main returns the IoLoop for g_loop, which is run by the main thread.
+    static IoLoop& main();
+    // current returns the IoLoop run by the calling thread, or the main loop if it runs none.
+    static IoLoop& current();
+    // of returns the IoLoop which runs loop.
+    static IoLoop& of(const uvw::Loop &loop);
+    // next returns the loop a new connection should be placed on: each I/O thread's in turn,
+    //     or the main loop if there are no I/O threads.
+    static IoLoop& next();
+    // thread_count returns the number of I/O threads.
+    static size_t thread_count();
+    // thread returns the loop run by the I/O thread with the given index.
+    static IoLoop& thread(size_t index);
+
+    // start_threads starts count I/O threads, each running a loop of its own.
+    static void start_threads(unsigned int count);
+    // stop_threads stops the I/O threads' loops and waits for the threads to finish.
+    static void stop_threads();
+
+    inline const std::shared_ptr<uvw::Loop>& loop() const
+    {
+        return m_loop;
+    }
+
+    inline TaskQueue& tasks()
+    {
+        return *m_tasks;
+    }
+
+    // timers returns the wheel which runs the loop's timeouts.  It must be called from the
+    //     thread which runs the loop.
+    TimerWheel& timers();
+
+    // in_thread returns true if it is called from the thread which runs the loop.
+    inline bool in_thread() const
+    {
+        return std::this_thread::get_id() == m_thread_id;
+    }
+
+    // adopt moves a socket which was accepted on another loop onto this one, and then calls
+    //     callback with it from this loop's thread. The connection itself isn't interrupted;
+    //     only the handle libuv tracks it with is replaced.
+    void adopt(const std::shared_ptr<uvw::TcpHandle> &socket, AdoptCallback callback);
+
+    // defer runs task once the loop has handled the events it is handling now, just before it
+    //     next waits for more.  Work posted by many events in one iteration (e.g. the writes for
+    //     a burst of datagrams) can be deferred, then done all at once.  It must be called from
+    //     the thread which runs the loop.
+    template<typename F>
+    void defer(F &&task)
+    {
+        assert(in_thread());
+
+        if(m_deferred.empty()) {
+            start_deferred();
+        }
+        m_deferred.emplace_back(std::forward<F>(task));
+    }
+
+  private:
+    IoLoop(std::shared_ptr<uvw::Loop> loop, TaskQueue *tasks, std::thread::id thread_id);
+    IoLoop();
+
+    void start_deferred();
+    void run_deferred();
+
+    std::shared_ptr<uvw::Loop> m_loop;
+    std::unique_ptr<TaskQueue> m_own_tasks; // Unset for the main loop, which uses the singleton.
+    TaskQueue *m_tasks;
+    std::unique_ptr<TimerWheel> m_timers; // Created when it's first used.
+    std::vector<Task> m_deferred;
+    std::vector<Task> m_running; // The deferred tasks being run, kept for their storage.
+    // The handles which run the deferred tasks, created when defer is first used.
+    std::shared_ptr<uvw::CheckHandle> m_check;
+    std::shared_ptr<uvw::PrepareHandle> m_prepare;
+    std::thread::id m_thread_id;
+    std::unique_ptr<std::thread> m_thread;
+};
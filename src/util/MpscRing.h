@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// An MpscRing is a bounded, lock-free queue that may be pushed to from any number of threads
+//     but only popped from by a single consumer thread.
+// Each cell carries a sequence number which tells producers when it is free to be claimed and
+//     the consumer when it has been published, so neither side ever takes a lock.
+template<typename T>
+class MpscRing
+{
+  public:
+    // The capacity is rounded up to the next power of two.
+    explicit MpscRing(size_t capacity) : m_enqueue_pos(0), m_dequeue_pos(0)
+    {
+        size_t size = 2;
+        while(size < capacity) {
+            size <<= 1;
+        }
+
+        m_cells.reset(new Cell[size]);
+        m_mask = size - 1;
+        for(size_t i = 0; i < size; ++i) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    // try_push appends a value to the ring, returning false if the ring is full.
+    // It may be called from any thread.
+    bool try_push(T&& value)
+    {
+        size_t pos = m_enqueue_pos.load(std::memory_order_relaxed);
+        while(true) {
+            Cell &cell = m_cells[pos & m_mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+            if(diff == 0) {
+                // The cell is free; try to claim it.
+                if(m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                // The cell still holds a value from the previous lap: the ring is full.
+                return false;
+            } else {
+                // Another producer claimed the cell first.
+                pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // try_pop removes the oldest published value, returning false if there is none.
+    // It may only be called from the consumer thread.
+    bool try_pop(T &value)
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        Cell &cell = m_cells[pos & m_mask];
+        if(cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+
+        value = std::move(cell.value);
+        cell.value = T(); // Don't keep the value alive until the cell is reused.
+        cell.sequence.store(pos + m_mask + 1, std::memory_order_release);
+        m_dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // empty returns true if the next value in the ring hasn't been published yet.
+    // It may only be called from the consumer thread.
+    bool empty() const
+    {
+        size_t pos = m_dequeue_pos.load(std::memory_order_relaxed);
+        const Cell &cell = m_cells[pos & m_mask];
+        return cell.sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+    // size returns roughly how many values are waiting in the ring, for monitoring.
+    // It may be called from any thread, but is only a snapshot of a moving target.
+    size_t size() const
+    {
+        size_t dequeued = m_dequeue_pos.load(std::memory_order_relaxed);
+        size_t enqueued = m_enqueue_pos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    // enqueue_position returns the number of values ever claimed by producers.
+    inline size_t enqueue_position() const
+    {
+        return m_enqueue_pos.load(std::memory_order_acquire);
+    }
+
+    // dequeue_position returns the number of values ever popped by the consumer.
+    // It may only be called from the consumer thread.
+    inline size_t dequeue_position() const
+    {
+        return m_dequeue_pos.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+
+    // The producer and consumer positions live on separate cache lines.  Only the consumer
+    // writes m_dequeue_pos; it's atomic just so size() may read it from other threads.
+    // N.B. they're kept apart with padding rather than alignas, so that rings may be members
+    // of heap allocated objects (C++14's operator new doesn't honour extended alignments).
+    char m_pad0[64];
+    std::atomic<size_t> m_enqueue_pos;
+    char m_pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> m_dequeue_pos;
+    char m_pad2[64 - sizeof(std::atomic<size_t>)];
+};
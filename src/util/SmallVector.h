@@ -0,0 +1,228 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+// A SmallVector is a vector which stores up to N elements inline before spilling onto the heap.
+// It only holds trivially copyable types, so elements are moved around with memcpy/memmove.
+template<typename T, size_t N>
+class SmallVector
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "SmallVector can only hold trivially copyable types.");
+    static_assert(N > 0, "SmallVector must have room for at least one inline element.");
+
+  public:
+    typedef T value_type;
+    typedef T *iterator;
+    typedef const T *const_iterator;
+
+    SmallVector() : m_size(0), m_capacity(N), m_storage()
+    {
+    }
+
+    SmallVector(const SmallVector &other) : m_size(0), m_capacity(N), m_storage()
+    {
+        append(other.begin(), other.end());
+    }
+
+    SmallVector(SmallVector &&other) noexcept : m_size(0), m_capacity(N), m_storage()
+    {
+        steal(other);
+    }
+
+    ~SmallVector()
+    {
+        release();
+    }
+
+    SmallVector &operator=(const SmallVector &other)
+    {
+        if(this != &other) {
+            m_size = 0;
+            append(other.begin(), other.end());
+        }
+        return *this;
+    }
+
+    SmallVector &operator=(SmallVector &&other) noexcept
+    {
+        if(this != &other) {
+            release();
+            m_size = 0;
+            m_capacity = N;
+            steal(other);
+        }
+        return *this;
+    }
+
+    inline size_t size() const
+    {
+        return m_size;
+    }
+    inline bool empty() const
+    {
+        return m_size == 0;
+    }
+    inline size_t capacity() const
+    {
+        return m_capacity;
+    }
+    inline bool is_inline() const
+    {
+        return m_capacity == N;
+    }
+
+    inline T *data()
+    {
+        return is_inline() ? m_storage.inline_elements : m_storage.heap_elements;
+    }
+    inline const T *data() const
+    {
+        return is_inline() ? m_storage.inline_elements : m_storage.heap_elements;
+    }
+
+    inline iterator begin()
+    {
+        return data();
+    }
+    inline iterator end()
+    {
+        return data() + m_size;
+    }
+    inline const_iterator begin() const
+    {
+        return data();
+    }
+    inline const_iterator end() const
+    {
+        return data() + m_size;
+    }
+
+    inline T &operator[](size_t i)
+    {
+        return data()[i];
+    }
+    inline const T &operator[](size_t i) const
+    {
+        return data()[i];
+    }
+    inline T &back()
+    {
+        return data()[m_size - 1];
+    }
+
+    inline void push_back(const T &value)
+    {
+        if(m_size == m_capacity) {
+            // Copy first, in case value lives inside our own storage.
+            T copy = value;
+            grow(m_capacity * 2);
+            data()[m_size++] = copy;
+        } else {
+            data()[m_size++] = value;
+        }
+    }
+
+    inline void pop_back()
+    {
+        --m_size;
+    }
+
+    template<typename It>
+    void append(It first, It last)
+    {
+        size_t count = last - first;
+        reserve(m_size + count);
+        T *elements = data() + m_size;
+        for(; first != last; ++first) {
+            *elements++ = *first;
+        }
+        m_size += count;
+    }
+
+    // insert adds value before pos, keeping the elements in order.
+    inline iterator insert(iterator pos, const T &value)
+    {
+        size_t index = pos - begin();
+        T copy = value;
+        reserve(m_size + 1);
+        pos = begin() + index;
+        memmove(pos + 1, pos, (m_size - index) * sizeof(T));
+        *pos = copy;
+        ++m_size;
+        return pos;
+    }
+
+    // erase removes the element at pos, keeping the remaining elements in order.
+    inline iterator erase(iterator pos)
+    {
+        memmove(pos, pos + 1, (end() - pos - 1) * sizeof(T));
+        --m_size;
+        return pos;
+    }
+
+    // erase_unordered removes the element at pos by moving the last element into its place.
+    inline void erase_unordered(iterator pos)
+    {
+        *pos = back();
+        --m_size;
+    }
+
+    inline void clear()
+    {
+        m_size = 0;
+    }
+
+    inline void reserve(size_t capacity)
+    {
+        if(capacity > m_capacity) {
+            size_t new_capacity = m_capacity * 2;
+            while(new_capacity < capacity) {
+                new_capacity *= 2;
+            }
+            grow(new_capacity);
+        }
+    }
+
+  private:
+    uint32_t m_size;
+    uint32_t m_capacity;
+    union Storage {
+        T inline_elements[N];
+        T *heap_elements;
+    } m_storage;
+
+    void grow(size_t capacity)
+    {
+        T *elements = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        memcpy(elements, data(), m_size * sizeof(T));
+        release();
+        m_storage.heap_elements = elements;
+        m_capacity = uint32_t(capacity);
+    }
+
+    void release()
+    {
+        if(!is_inline()) {
+            ::operator delete(m_storage.heap_elements);
+        }
+    }
+
+    // steal takes other's elements, leaving it empty.  We must be empty and inline.
+    void steal(SmallVector &other)
+    {
+        if(other.is_inline()) {
+            memcpy(m_storage.inline_elements, other.m_storage.inline_elements, other.m_size * sizeof(T));
+        } else {
+            m_storage.heap_elements = other.m_storage.heap_elements;
+            m_capacity = other.m_capacity;
+            other.m_capacity = N;
+        }
+
+        m_size = other.m_size;
+        other.m_size = 0;
+    }
+};
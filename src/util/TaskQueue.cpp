@@ -1,65 +1,250 @@
 #include "TaskQueue.h"
+#include <vector>
 
-TaskQueue TaskQueue::singleton;
+TaskQueue &TaskQueue::singleton = *new TaskQueue;
+
+// The rings the calling thread has claimed, which are given back when it exits.  Once they
+//     have been, the thread posts to the queues' shared rings instead.
+static thread_local bool producer_exited = false;
+struct ProducerRings {
+    std::vector<std::pair<TaskQueue*, TaskQueue::Ring*> > rings;
+
+    ~ProducerRings()
+    {
+        producer_exited = true;
+        for(const auto &claim : rings) {
+            if(claim.second != nullptr) {
+                claim.second->claimed.store(false, std::memory_order_release);
+            }
+        }
+    }
+};
+static thread_local ProducerRings producer_rings;
+
+TaskQueue::Ring::Ring() : claimed(false), heap_tasks(0), m_head(new Segment), m_tail(m_head),
+    m_spare(nullptr), m_pushed(0), m_popped(0)
+{
+}
+
+TaskQueue::Ring::~Ring()
+{
+    while(m_head != nullptr) {
+        Segment *next = m_head->next.load(std::memory_order_relaxed);
+        delete m_head;
+        m_head = next;
+    }
+    delete m_spare.load(std::memory_order_relaxed);
+}
+
+void TaskQueue::Ring::next_segment()
+{
+    Segment *segment = m_spare.exchange(nullptr, std::memory_order_acquire);
+    if(segment == nullptr) {
+        segment = new Segment;
+    }
+
+    m_tail->next.store(segment, std::memory_order_release);
+    m_tail = segment;
+}
+
+bool TaskQueue::Ring::pop(Task &task)
+{
+    while(true) {
+        size_t written = m_head->written.load(std::memory_order_acquire);
+        if(m_head->read < written) {
+            task = std::move(m_head->tasks[m_head->read++]);
+            m_popped.store(m_popped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // The producer only moves on to the next segment once this one is full.
+        Segment *next = m_head->next.load(std::memory_order_acquire);
+        if(written < segment_tasks || next == nullptr) {
+            return false;
+        }
+
+        // The producer is done with the drained segment, so it can have it back.
+        Segment *drained = m_head;
+        m_head = next;
+        drained->written.store(0, std::memory_order_relaxed);
+        drained->read = 0;
+        drained->next.store(nullptr, std::memory_order_relaxed);
+        delete m_spare.exchange(drained, std::memory_order_acq_rel);
+    }
+}
+
+TaskQueue::TaskQueue() : m_ring_count(1), m_wake_pending(false), m_tasks_run(0), m_wakeups(0),
+    m_max_depth(0)
+{
+    m_rings[0].store(new Ring, std::memory_order_relaxed);
+    m_rings[0].load(std::memory_order_relaxed)->claimed.store(true, std::memory_order_relaxed);
+    for(size_t i = 1; i < max_rings; ++i) {
+        m_rings[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
 
 TaskQueue::~TaskQueue()
 {
-    assert(m_task_queue.empty());
+    assert(depth() == 0);
     if(m_flush_handle) {
         m_flush_handle->close();
         m_flush_handle = nullptr;
     }
+
+    size_t count = m_ring_count.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i) {
+        delete m_rings[i].load(std::memory_order_relaxed);
+    }
 }
 
 void TaskQueue::init_queue()
 {
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    init_queue(g_loop, g_main_thread_id);
+}
 
-    m_flush_handle = g_loop->resource<uvw::AsyncHandle>();
+void TaskQueue::init_queue(const std::shared_ptr<uvw::Loop> &loop, std::thread::id thread_id)
+{
+    assert(std::this_thread::get_id() == thread_id);
+
+    m_thread_id = thread_id;
+    m_flush_handle = loop->resource<uvw::AsyncHandle>();
     m_flush_handle->on<uvw::AsyncEvent>([self = this](const uvw::AsyncEvent&, uvw::AsyncHandle&) {
+        self->m_wakeups.store(self->m_wakeups.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
         self->flush_tasks();
     });
 }
 
-void TaskQueue::enqueue_task(TaskCallback task)
+TaskQueue::Ring *TaskQueue::producer_ring()
 {
-    {
-        std::lock_guard<std::mutex> lock(m_queue_mutex);
-        m_task_queue.push(task);        
+    if(producer_exited) {
+        return nullptr;
+    }
+
+    for(const auto &claim : producer_rings.rings) {
+        if(claim.first == this) {
+            return claim.second;
+        }
+    }
+
+    // N.B. a thread which couldn't claim a ring remembers that, and keeps using the shared one.
+    Ring *ring = claim_ring();
+    producer_rings.rings.push_back(std::make_pair(this, ring));
+    return ring;
+}
+
+TaskQueue::Ring *TaskQueue::claim_ring()
+{
+    std::lock_guard<std::mutex> lock(m_rings_mutex);
+
+    // Reuse the ring of a thread which has exited, if there is one.
+    size_t count = m_ring_count.load(std::memory_order_relaxed);
+    for(size_t i = 1; i < count; ++i) {
+        Ring *ring = m_rings[i].load(std::memory_order_relaxed);
+        if(!ring->claimed.load(std::memory_order_relaxed) &&
+           !ring->claimed.exchange(true, std::memory_order_acquire)) {
+            return ring;
+        }
     }
 
-    if(std::this_thread::get_id() != g_main_thread_id) {
+    if(count == max_rings) {
+        return nullptr;
+    }
+
+    Ring *ring = new Ring;
+    ring->claimed.store(true, std::memory_order_relaxed);
+    m_rings[count].store(ring, std::memory_order_relaxed);
+    m_ring_count.store(count + 1, std::memory_order_release);
+    return ring;
+}
+
+void TaskQueue::wake()
+{
+    // Only the first task of a batch has to wake the loop; the flush which follows runs the rest.
+    //     N.B. the task must be visible before we check, as a flush clears the flag before it
+    //     looks for tasks.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!m_wake_pending.exchange(true, std::memory_order_relaxed)) {
         m_flush_handle->send();
-    } else {
-        flush_tasks();
     }
 }
 
+uint64_t TaskQueue::depth() const
+{
+    uint64_t depth = 0;
+    size_t count = m_ring_count.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i) {
+        depth += m_rings[i].load(std::memory_order_relaxed)->depth();
+    }
+    return depth;
+}
+
 void TaskQueue::flush_tasks()
 {
-    // We need to make absolutely certain this is running within the main (loop's) thread.
-    assert(std::this_thread::get_id() == g_main_thread_id);
+    // We need to make absolutely certain this is running within the loop's thread.
+    assert(std::this_thread::get_id() == m_thread_id);
 
     if(m_in_flush) {
-        // We're already in the middle of a flush_tasks operation.    
+        // We're already in the middle of a flush_tasks operation.
         return;
     }
 
     m_in_flush = true;
-    std::queue<TaskCallback> pending_tasks;
+    m_wake_pending.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
 
-    {
-        std::lock_guard<std::mutex> lock(m_queue_mutex);
-        pending_tasks = std::move(m_task_queue);
+    uint64_t pending = depth();
+    if(pending > m_max_depth.load(std::memory_order_relaxed)) {
+        m_max_depth.store(pending, std::memory_order_relaxed);
     }
 
-    {
-        while(!pending_tasks.empty()) {
-            TaskCallback task = pending_tasks.front();
-            pending_tasks.pop();
-            task();
+    // Take a few tasks from each ring in turn, so one busy thread can't hold up the others.
+    static const size_t tasks_per_turn = 64;
+
+    // Only the tasks which were waiting are run now; any posted since then are left for the
+    //     next flush, so the loop isn't held up while other threads keep posting more.
+    uint64_t run = 0;
+    while(run < pending) {
+        bool ran = false;
+        size_t count = m_ring_count.load(std::memory_order_acquire);
+        for(size_t i = 0; i < count; ++i) {
+            Ring *ring = m_rings[i].load(std::memory_order_relaxed);
+            for(size_t taken = 0; taken < tasks_per_turn; ++taken) {
+                Task task;
+                if(!ring->pop(task)) {
+                    break;
+                }
+                task();
+                ++run;
+                ran = true;
+            }
+        }
+
+        if(!ran) {
+            break;
         }
     }
 
+    m_tasks_run.store(m_tasks_run.load(std::memory_order_relaxed) + run, std::memory_order_relaxed);
     m_in_flush = false;
+
+    if(depth() > 0) {
+        wake();
+    }
+}
+
+TaskQueue::Stats TaskQueue::stats() const
+{
+    Stats stats;
+    stats.tasks = m_tasks_run.load(std::memory_order_relaxed);
+    stats.wakeups = m_wakeups.load(std::memory_order_relaxed);
+    stats.heap_tasks = 0;
+    size_t count = m_ring_count.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i) {
+        stats.heap_tasks += m_rings[i].load(std::memory_order_relaxed)->heap_tasks.load(
+                                std::memory_order_relaxed);
+    }
+    stats.depth = depth();
+    stats.max_depth = m_max_depth.load(std::memory_order_relaxed);
+    return stats;
 }
@@ -1,24 +1,302 @@
 #pragma once
 
-#include <queue>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include <mutex>
+#include <new>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include "core/global.h"
 #include "deps/uvw/uvw.hpp"
 
-typedef std::function<void()> TaskCallback;
+// A Task is a callable with no arguments, like a std::function<void()>, except that closures
+//     small enough to fit in its buffer are stored inline instead of on the heap.  Most of the
+//     lambdas posted between threads only capture a pointer or two, so queuing them is free.
+class Task
+{
+  public:
+    // The size of the inline buffer; larger closures are moved to the heap.
+    static const size_t inline_size = 48;
+
+    Task() : m_manage(nullptr)
+    {
+    }
+
+    template<typename F, typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&f) : m_manage(nullptr)
+    {
+        emplace(std::forward<F>(f));
+    }
+
+    Task(Task &&other) : m_manage(other.m_manage)
+    {
+        if(m_manage != nullptr) {
+            m_manage(MOVE, &other.m_storage, &m_storage);
+            other.m_manage = nullptr;
+        }
+    }
+
+    Task& operator=(Task &&other)
+    {
+        if(this != &other) {
+            reset();
+            if(other.m_manage != nullptr) {
+                other.m_manage(MOVE, &other.m_storage, &m_storage);
+                m_manage = other.m_manage;
+                other.m_manage = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        reset();
+    }
+
+    // emplace stores f in the task, replacing whatever it held.
+    template<typename F>
+    void emplace(F &&f)
+    {
+        typedef typename std::decay<F>::type Callable;
+
+        reset();
+        if(stored_inline<Callable>()) {
+            new(&m_storage) Callable(std::forward<F>(f));
+            m_manage = &manage_inline<Callable>;
+        } else {
+            *reinterpret_cast<Callable**>(&m_storage) = new Callable(std::forward<F>(f));
+            m_manage = &manage_heap<Callable>;
+        }
+    }
+
+    // reset destroys the task's closure, leaving it empty.
+    inline void reset()
+    {
+        if(m_manage != nullptr) {
+            m_manage(DESTROY, &m_storage, nullptr);
+            m_manage = nullptr;
+        }
+    }
+
+    inline void operator()()
+    {
+        m_manage(INVOKE, &m_storage, nullptr);
+    }
 
+    inline explicit operator bool() const
+    {
+        return m_manage != nullptr;
+    }
+
+    // stored_inline returns true if a closure of type Callable fits in a Task's buffer.
+    template<typename Callable>
+    static constexpr bool stored_inline()
+    {
+        return sizeof(Callable) <= inline_size &&
+               alignof(Callable) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Callable>::value;
+    }
+
+  private:
+    enum Op { INVOKE, MOVE, DESTROY };
+    typedef typename std::aligned_storage<inline_size, alignof(std::max_align_t)>::type Storage;
+
+    Storage m_storage;
+    void (*m_manage)(Op op, void *storage, void *to);
+
+    template<typename Callable>
+    static void manage_inline(Op op, void *storage, void *to)
+    {
+        Callable *callable = static_cast<Callable*>(storage);
+        switch(op) {
+        case INVOKE:
+            (*callable)();
+            break;
+        case MOVE:
+            new(to) Callable(std::move(*callable));
+            callable->~Callable();
+            break;
+        case DESTROY:
+            callable->~Callable();
+            break;
+        }
+    }
+
+    template<typename Callable>
+    static void manage_heap(Op op, void *storage, void *to)
+    {
+        Callable *&callable = *static_cast<Callable**>(storage);
+        switch(op) {
+        case INVOKE:
+            (*callable)();
+            break;
+        case MOVE:
+            *static_cast<Callable**>(to) = callable;
+            break;
+        case DESTROY:
+            delete callable;
+            break;
+        }
+    }
+};
+
+// A TaskQueue runs tasks posted from any thread on the thread which runs its loop.
+// Each thread which posts to a queue is given a ring of its own, which only it writes to and
+//     only the loop's thread reads from, so posting doesn't take a lock or allocate (except when
+//     a ring's segment fills up and no spare is left).  The loop is woken once per batch of
+//     tasks, rather than once per task.
+// A TaskQueue must outlive every thread which posts to it.
 class TaskQueue
 {
-    private:
-        std::mutex m_queue_mutex;
-        std::queue<TaskCallback> m_task_queue;
-        std::shared_ptr<uvw::AsyncHandle> m_flush_handle;
-        bool m_in_flush = false;
-    public:
-        ~TaskQueue();
-        static TaskQueue singleton;
-        void init_queue();
-        void enqueue_task(TaskCallback task);
-        void flush_tasks();
+  private:
+    friend struct ProducerRings;
+
+    // A Ring is an unbounded single-producer, single-consumer queue of tasks.  It is made of
+    //     fixed-size segments; a drained segment is kept as a spare for the producer to reuse.
+    class Ring
+    {
+      public:
+        Ring();
+        ~Ring();
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        template<typename F>
+        void push(F &&f)
+        {
+            size_t index = m_tail->written.load(std::memory_order_relaxed);
+            if(index == segment_tasks) {
+                next_segment();
+                index = 0;
+            }
+            m_tail->tasks[index].emplace(std::forward<F>(f));
+            if(!Task::stored_inline<typename std::decay<F>::type>()) {
+                heap_tasks.store(heap_tasks.load(std::memory_order_relaxed) + 1,
+                                 std::memory_order_relaxed);
+            }
+            // The task is counted before it's published, so the consumer can't pop it uncounted.
+            m_pushed.store(m_pushed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            m_tail->written.store(index + 1, std::memory_order_release);
+        }
+
+        // pop moves the oldest task in the ring into task; it returns false if there is none.
+        bool pop(Task &task);
+
+        // depth returns the number of tasks waiting in the ring.  Other threads than the consumer
+        //     may see tasks popped since they read m_pushed, so the difference is clamped at zero.
+        inline uint64_t depth() const
+        {
+            uint64_t pushed = m_pushed.load(std::memory_order_acquire);
+            uint64_t popped = m_popped.load(std::memory_order_relaxed);
+            return pushed > popped ? pushed - popped : 0;
+        }
+
+        std::atomic<bool> claimed;        // True while a producer thread owns the ring.
+        std::atomic<uint64_t> heap_tasks; // Tasks which didn't fit in a Task's buffer.
+
+      private:
+        static const size_t segment_tasks = 256;
+
+        struct Segment {
+            Task tasks[segment_tasks];
+            std::atomic<size_t> written; // Written by the producer.
+            size_t read;                 // Only touched by the consumer.
+            std::atomic<Segment*> next;
+
+            Segment() : written(0), read(0), next(nullptr)
+            {
+            }
+        };
+
+        void next_segment();
+
+        Segment *m_head;                // The consumer's segment.
+        Segment *m_tail;                // The producer's segment.
+        std::atomic<Segment*> m_spare;  // A drained segment, handed back to the producer.
+        std::atomic<uint64_t> m_pushed; // Written by the producer.
+        std::atomic<uint64_t> m_popped; // Written by the consumer.
+    };
+
+  public:
+    TaskQueue();
+    ~TaskQueue();
+
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    // singleton is the main loop's queue.  It's never destroyed, as datagrams may still be
+    //     sent (and their sockets closed) by other static objects' destructors.
+    static TaskQueue &singleton;
+
+    // init_queue sets the queue up to be flushed on the main loop.
+    void init_queue();
+    // init_queue(loop, thread_id) sets the queue up to be flushed on another loop,
+    //     which is run by the thread thread_id.  It must be called from that thread.
+    void init_queue(const std::shared_ptr<uvw::Loop> &loop, std::thread::id thread_id);
+
+    // enqueue_task posts task to be run on the loop's thread.  If it's called from that thread,
+    //     it runs the queue straight away, unless it's being run already.
+    template<typename F>
+    void enqueue_task(F &&task)
+    {
+        Ring *ring = producer_ring();
+        if(ring != nullptr) {
+            ring->push(std::forward<F>(task));
+        } else {
+            std::lock_guard<std::mutex> lock(m_shared_mutex);
+            m_rings[0].load(std::memory_order_relaxed)->push(std::forward<F>(task));
+        }
+
+        if(std::this_thread::get_id() == m_thread_id) {
+            flush_tasks();
+        } else {
+            wake();
+        }
+    }
+
+    // flush_tasks runs the tasks waiting in the queue; any posted while it's running are left
+    //     for another flush, which it wakes the loop for.  It must be called from the loop's thread.
+    void flush_tasks();
+
+    // Stats describes the work a TaskQueue has done since it was created.
+    struct Stats {
+        uint64_t tasks;      // The number of tasks which have been run.
+        uint64_t wakeups;    // The number of times the loop was woken to run tasks.
+        uint64_t heap_tasks; // The number of tasks too large to be stored inline.
+        uint64_t depth;      // The number of tasks waiting to be run.
+        uint64_t max_depth;  // The most tasks that were waiting when the queue was run.
+    };
+    // stats returns a snapshot of the queue's statistics.  It may be called from any thread.
+    Stats stats() const;
+
+  private:
+    // Ring 0 is shared, under m_shared_mutex, by any threads which can't have a ring of their own.
+    static const size_t max_rings = 64;
+
+    Ring *producer_ring();
+    Ring *claim_ring();
+    void wake();
+    uint64_t depth() const;
+
+    std::atomic<Ring*> m_rings[max_rings];
+    std::atomic<size_t> m_ring_count;
+    std::mutex m_rings_mutex; // Held while adding a ring.
+    std::mutex m_shared_mutex;
+
+    std::shared_ptr<uvw::AsyncHandle> m_flush_handle;
+    std::thread::id m_thread_id; // The thread which runs the loop the queue is flushed on.
+    std::atomic<bool> m_wake_pending;
+    bool m_in_flush = false;
+
+    std::atomic<uint64_t> m_tasks_run;
+    std::atomic<uint64_t> m_wakeups;
+    std::atomic<uint64_t> m_max_depth;
 };
@@ -2,17 +2,18 @@
 #include <functional>
 #include <atomic>
 #include <memory>
-#include "deps/uvw/uvw.hpp"
-#include "util/TaskQueue.h"
+#include "util/IoLoop.h"
+#include "util/TimerWheel.h"
 
-// This class abstracts the uvw::TimerHandle timer in order to provide a generic
-// facility for timeouts. Once constructed, this class will wait a certain
+// This class provides a generic facility for timeouts, on top of the TimerWheel of
+// the IoLoop it was created on. Once constructed, this class will wait a certain
 // amount of time and then call the function. The timeout must be canceled
 // with cancel() before you invalidate your callback.
 //
 // You must start the timeout with start().
 //
-// NOTE: The thread that calls the function is the main thread.
+// NOTE: The thread that calls the function is the thread running the IoLoop the Timeout
+// was created on (usually the main thread). It must be started and reset from that thread.
 // Make sure that your callback doesn't have unintended consequences on performance.
 // NOTE 2: The Timeout deletes itself under 2 different conditions:
 // a) The timeout has been reached
@@ -21,7 +22,7 @@
 
 typedef std::function<void()> TimeoutCallback;
 
-class Timeout
+class Timeout : private WheelTimer
 {
   public:
     Timeout(unsigned long ms, std::function<void()> f);
@@ -44,16 +45,14 @@ class Timeout
     void initialize(unsigned long ms, TimeoutCallback callback);
 
   private:
-    std::shared_ptr<uvw::Loop> m_loop;
-    std::shared_ptr<uvw::TimerHandle> m_timer;
+    IoLoop *m_io_loop;
     TimeoutCallback m_callback;
     unsigned long m_timeout_interval;
 
     std::atomic<bool> m_callback_disabled;
 
-    void setup();
     void destroy_timer();
-    void timer_callback();
+    virtual void expire();
 };
 
 typedef std::function<void(Timeout*)> TimeoutSetCallback;
@@ -0,0 +1,206 @@
+#include "TimerWheel.h"
+#include <cassert>
+
+WheelTimer::WheelTimer() : m_prev(nullptr), m_next(nullptr), m_expires(0), m_level(unscheduled),
+    m_slot(0)
+{
+}
+
+WheelTimer::~WheelTimer()
+{
+    assert(!scheduled());
+}
+
+TimerWheel::TimerWheel(const std::shared_ptr<uvw::Loop> &loop) :
+    m_timer(loop->resource<uvw::TimerHandle>()), m_current(0), m_armed(no_tick)
+{
+    for(unsigned int level = 0; level < levels; ++level) {
+        m_occupied[level] = 0;
+        for(size_t slot = 0; slot < slots; ++slot) {
+            m_slots[level][slot] = nullptr;
+        }
+    }
+    m_current = now();
+
+    m_timer->on<uvw::TimerEvent>([self = this](const uvw::TimerEvent&, uvw::TimerHandle&) {
+        self->advance();
+    });
+}
+
+TimerWheel::~TimerWheel()
+{
+    m_timer->stop();
+    m_timer->close();
+}
+
+uint64_t TimerWheel::now() const
+{
+    return (uint64_t)m_timer->loop().now().count();
+}
+
+void TimerWheel::schedule(WheelTimer *timer, uint64_t ms)
+{
+    if(timer->scheduled()) {
+        unlink(timer);
+    }
+
+    // If nothing is due yet, catch the wheel up first, so new timers are placed relative to now.
+    uint64_t current = now();
+    if(m_current < current && next_tick() > current) {
+        m_current = current;
+    }
+
+    timer->m_expires = current + ms;
+    uint64_t tick = place(timer);
+    if(tick < m_armed) {
+        arm(tick);
+    }
+}
+
+void TimerWheel::cancel(WheelTimer *timer)
+{
+    // The uv timer is left as it is; if it goes off for nothing, it's just started again.
+    if(timer->scheduled()) {
+        unlink(timer);
+    }
+}
+
+// place links a timer into the slot it belongs in, and returns the tick that slot is next due on.
+uint64_t TimerWheel::place(WheelTimer *timer)
+{
+    // Timers are placed relative to the next tick to be expired.
+    uint64_t next = m_current + 1;
+    uint64_t expires = timer->m_expires > next ? timer->m_expires : next;
+    uint64_t delta = expires - next;
+
+    unsigned int level = 0;
+    while(level + 1 < levels && delta >= (uint64_t(1) << (slot_bits * (level + 1)))) {
+        ++level;
+    }
+    if(delta >= (uint64_t(1) << (slot_bits * levels))) {
+        // Too far off for the outermost wheel; it's re-placed when its slot comes due.
+        expires = next + (uint64_t(1) << (slot_bits * levels)) - 1;
+    }
+
+    unsigned int shift = slot_bits * level;
+    size_t slot = (expires >> shift) & (slots - 1);
+
+    timer->m_level = (uint8_t)level;
+    timer->m_slot = (uint8_t)slot;
+    timer->m_prev = nullptr;
+    timer->m_next = m_slots[level][slot];
+    if(timer->m_next != nullptr) {
+        timer->m_next->m_prev = timer;
+    }
+    m_slots[level][slot] = timer;
+    m_occupied[level] |= uint64_t(1) << slot;
+
+    return (expires >> shift) << shift;
+}
+
+void TimerWheel::unlink(WheelTimer *timer)
+{
+    WheelTimer *&head = m_slots[timer->m_level][timer->m_slot];
+    if(timer->m_prev != nullptr) {
+        timer->m_prev->m_next = timer->m_next;
+    } else {
+        head = timer->m_next;
+    }
+    if(timer->m_next != nullptr) {
+        timer->m_next->m_prev = timer->m_prev;
+    }
+    if(head == nullptr) {
+        m_occupied[timer->m_level] &= ~(uint64_t(1) << timer->m_slot);
+    }
+
+    timer->m_prev = nullptr;
+    timer->m_next = nullptr;
+    timer->m_level = WheelTimer::unscheduled;
+}
+
+// cascade moves the timers in a slot of an outer wheel down to the wheels they now belong in.
+void TimerWheel::cascade(unsigned int level, size_t slot)
+{
+    WheelTimer *timer = m_slots[level][slot];
+    m_slots[level][slot] = nullptr;
+    m_occupied[level] &= ~(uint64_t(1) << slot);
+
+    while(timer != nullptr) {
+        WheelTimer *next = timer->m_next;
+        place(timer);
+        timer = next;
+    }
+}
+
+// next_tick returns the next tick on which a slot is due, or no_tick if there are no timers.
+uint64_t TimerWheel::next_tick() const
+{
+    uint64_t tick = no_tick;
+    for(unsigned int level = 0; level < levels; ++level) {
+        uint64_t occupied = m_occupied[level];
+        if(occupied == 0) {
+            continue;
+        }
+
+        // Timers are only ever placed in slots after the wheel's current one, so look for the
+        //     first occupied slot from there, wrapping around.
+        unsigned int shift = slot_bits * level;
+        uint64_t next = (m_current >> shift) + 1;
+        unsigned int from = (unsigned int)(next & (slots - 1));
+        uint64_t rotated = (occupied >> from) | (occupied << ((slots - from) & (slots - 1)));
+        uint64_t due = (next + (uint64_t)__builtin_ctzll(rotated)) << shift;
+        if(due < tick) {
+            tick = due;
+        }
+    }
+    return tick;
+}
+
+// advance expires every timer that is due, and starts the uv timer again for the next tick.
+void TimerWheel::advance()
+{
+    uint64_t current = now();
+
+    // Timers scheduled while we're expiring others don't need to start the uv timer.
+    m_armed = 0;
+
+    // Nothing is due between the ticks next_tick returns, so the wheel can jump straight to them.
+    uint64_t tick;
+    while((tick = next_tick()) <= current) {
+        // The outer wheels go first, as their timers may be due in an inner wheel's slot.
+        m_current = tick - 1;
+        for(unsigned int level = levels - 1; level > 0; --level) {
+            unsigned int shift = slot_bits * level;
+            if((tick & ((uint64_t(1) << shift) - 1)) == 0) {
+                cascade(level, (tick >> shift) & (slots - 1));
+            }
+        }
+        m_current = tick;
+
+        // Anything the timers schedule is due later, so this slot is emptied for good.
+        WheelTimer *&due = m_slots[0][tick & (slots - 1)];
+        while(due != nullptr) {
+            WheelTimer *timer = due;
+            unlink(timer);
+            timer->expire();
+        }
+    }
+    m_current = current;
+
+    m_armed = no_tick;
+    arm(tick);
+}
+
+void TimerWheel::arm(uint64_t tick)
+{
+    if(tick == no_tick) {
+        m_timer->stop();
+        m_armed = no_tick;
+        return;
+    }
+
+    uint64_t current = now();
+    m_timer->start(uvw::TimerHandle::Time{tick > current ? tick - current : 0},
+                   uvw::TimerHandle::Time{0});
+    m_armed = tick;
+}
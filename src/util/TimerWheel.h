@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "deps/uvw/uvw.hpp"
+
+// A WheelTimer is something which can be scheduled on a TimerWheel.  The wheel links it into
+//     a slot in place, so scheduling and cancelling it never allocate.
+class WheelTimer
+{
+  public:
+    WheelTimer();
+    virtual ~WheelTimer();
+
+    // scheduled returns true if the timer is waiting to expire.
+    inline bool scheduled() const
+    {
+        return m_level != unscheduled;
+    }
+
+  protected:
+    // expire is called by the wheel when the timer's time is up.  The timer has already been
+    //     unscheduled, so it may be rescheduled (or deleted) from here.
+    virtual void expire() = 0;
+
+  private:
+    friend class TimerWheel;
+
+    static const uint8_t unscheduled = 0xFF;
+
+    WheelTimer *m_prev; // Null for the first timer in a slot.
+    WheelTimer *m_next;
+    uint64_t m_expires; // The tick (loop time, in ms) the timer expires on.
+    uint8_t m_level;    // The wheel the timer is in, or unscheduled.
+    uint8_t m_slot;
+};
+
+// A TimerWheel drives any number of WheelTimers from a single uv timer on its loop.
+// Timers are kept in a hierarchy of wheels: the first has a slot for each of the next 64ms,
+//     the second a slot for each of the 64 spans of 64ms after that, and so on, so scheduling
+//     or cancelling a timer is just linking it into or out of a slot.  As time passes, the
+//     timers in a slot of an outer wheel are moved down to the inner wheels, until they expire
+//     from the innermost one.  The uv timer is only started for the next tick which has
+//     something to do, so a wheel holding long timeouts doesn't wake its loop every tick.
+// A TimerWheel, and the timers on it, may only be used from the thread which runs its loop.
+class TimerWheel
+{
+  public:
+    TimerWheel(const std::shared_ptr<uvw::Loop> &loop);
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // schedule has timer expire in ms milliseconds.  If it is already scheduled, it's moved.
+    void schedule(WheelTimer *timer, uint64_t ms);
+    // cancel unschedules timer, if it is scheduled.
+    void cancel(WheelTimer *timer);
+
+  private:
+    static const unsigned int slot_bits = 6;
+    static const size_t slots = size_t(1) << slot_bits;
+    static const unsigned int levels = 5; // Enough for about 12 days; later timers are re-placed.
+    static const uint64_t no_tick = UINT64_MAX;
+
+    std::shared_ptr<uvw::TimerHandle> m_timer;
+    uint64_t m_current;  // Every timer expiring on or before this tick has been expired.
+    uint64_t m_armed;    // The tick the uv timer is started for, or no_tick if it is stopped.
+    uint64_t m_occupied[levels]; // A bit for each slot with timers in it.
+    WheelTimer *m_slots[levels][slots];  // The first timer in each slot.
+
+    uint64_t now() const;
+    uint64_t place(WheelTimer *timer);
+    void unlink(WheelTimer *timer);
+    void cascade(unsigned int level, size_t slot);
+    uint64_t next_tick() const;
+    void advance();
+    void arm(uint64_t tick);
+};
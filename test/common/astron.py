@@ -83,6 +83,7 @@ CONSTANTS = {
     'CONTROL_REMOVE_CHANNEL':       9001,
     'CONTROL_ADD_RANGE':            9002,
     'CONTROL_REMOVE_RANGE':         9003,
+    'CONTROL_SUBSCRIPTION_BATCH':   9004,
     'CONTROL_ADD_POST_REMOVE':      9010,
     'CONTROL_CLEAR_POST_REMOVE':    9011,
     'CONTROL_SET_CON_NAME':         9012,
@@ -274,6 +275,7 @@ else:
     CONSTANTS['ZONE_SIZE_BITS'] = 32
 
 CONSTANTS['USE_THREADING'] = 'DISABLE_THREADING' not in os.environ
+CONSTANTS['IO_THREADS'] = int(os.environ.get('IO_THREADS', 0))
 
 locals().update(CONSTANTS)
 __all__.extend(CONSTANTS.keys())
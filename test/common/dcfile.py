@@ -70,6 +70,7 @@ FIELDS = [
     'sendMessage',
     'sendMessageConstraint',
     'setColorConstraint',
+    'setPathConstraint',
 
     ### Fields for Block ###
     'blockX',
@@ -107,4 +108,4 @@ setRDbD5DefaultValue = 20
 
 # If you edit test.dc *AT ALL*, you will have to recalculate this.
 # If you don't know how, ask CFS.
-DC_HASH = 0xb77baf2
+DC_HASH = 0xca56657
@@ -1,5 +1,6 @@
 #!/usr/bin/env python2
 import unittest, time, ssl, struct
+import socket as socket_module
 from socket import socket, AF_INET, SOCK_STREAM, error as socket_error
 from common.unittests import ProtocolTest
 from common.astron import *
@@ -12,6 +13,7 @@ messagedirector:
     threaded: %s
 
 general:
+    io_threads: %d
     dc_files:
         - %r
 
@@ -69,6 +71,16 @@ roles:
           min: 440600
           max: 440649
 
+    - type: clientagent
+      bind: 127.0.0.1:57231
+      version: "Sword Art Online v5.1"
+      listeners: 2
+      channels:
+          min: 550600
+          max: 550699
+      client:
+          write_cork_delay_ms: 50
+
     - type: clientagent
       bind: 127.0.0.1:51201
       version: "Sword Art Online v5.1"
@@ -78,7 +90,7 @@ roles:
       client:
           heartbeat_timeout: 1000
 
-""" % (USE_THREADING, test_dc)
+""" % (USE_THREADING, IO_THREADS, test_dc)
 VERSION = 'Sword Art Online v5.1'
 
 class TestClientAgent(ProtocolTest):
@@ -3339,6 +3351,69 @@ class TestClientAgent(ProtocolTest):
 
         self.server.send(Datagram.create_remove_channel(10052))
 
+    def test_listeners(self):
+        self.server.flush()
+
+        # The CA opens one listener per I/O thread, sharing the port with SO_REUSEPORT, only
+        # when it has enough I/O threads; otherwise it falls back to a single listener.
+        # Only a socket in the same SO_REUSEPORT group can bind the port alongside them:
+        reuseport = IO_THREADS >= 2 and hasattr(socket_module, 'SO_REUSEPORT')
+        probe = socket(AF_INET, SOCK_STREAM)
+        try:
+            if hasattr(socket_module, 'SO_REUSEPORT'):
+                probe.setsockopt(socket_module.SOL_SOCKET, socket_module.SO_REUSEPORT, 1)
+            try:
+                probe.bind(('127.0.0.1', 57231))
+                shared = True
+            except socket_error:
+                shared = False
+        finally:
+            probe.close()
+        self.assertEqual(shared, reuseport)
+
+        # Connections to a CA with several listeners all end up on one of them:
+        clients = [self.connect(port=57231) for _ in xrange(8)]
+        ids = [self.identify(client, min=550600, max=550699) for client in clients]
+        self.assertEqual(len(set(ids)), len(ids))
+
+        for client in clients:
+            client.close()
+        self.server.flush()
+
+    def test_write_cork(self):
+        self.server.flush()
+
+        # A CA which holds back small writes still delivers them, in order, within the delay:
+        client = self.connect(port=57231)
+        id = self.identify(client, min=550600, max=550699)
+
+        raw_dgs = []
+        for n in xrange(5):
+            raw_dg = Datagram()
+            raw_dg.add_uint16(5555)
+            raw_dg.add_uint32(n)
+            raw_dgs.append(raw_dg)
+
+            dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+            dg.add_string(raw_dg.get_data())
+            self.server.send(dg)
+
+        for raw_dg in raw_dgs:
+            self.expect(client, raw_dg, isClient = True)
+        self.expectNone(client)
+
+        # ...as well as writes large enough to go out straight away.
+        raw_dg = Datagram()
+        raw_dg.add_uint16(5555)
+        raw_dg.add_string('x' * 2000)
+        dg = Datagram.create([id], 1, CLIENTAGENT_SEND_DATAGRAM)
+        dg.add_string(raw_dg.get_data())
+        self.server.send(dg)
+        self.expect(client, raw_dg, isClient = True)
+
+        client.close()
+        self.server.flush()
+
     def test_haproxy_protocol(self):
         self.server.flush()
         self.server.send(Datagram.create_add_channel(10010))
@@ -3771,6 +3846,17 @@ class TestClientAgent(ProtocolTest):
 
         self.expectNone(client)
 
+        # A fixed-size array of in-range values is fine too...
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(10000)
+        dg.add_uint16(setPathConstraint)
+        for i in xrange(64):
+            dg.add_uint16(i * 15)
+        client.send(dg)
+
+        self.expectNone(client)
+
         # Violate the ASCII constraint for T_STRING/T_VARSTRING.
         dg = Datagram()
         dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
@@ -3781,6 +3867,31 @@ class TestClientAgent(ProtocolTest):
 
         self.assertDisconnect(client, CLIENT_DISCONNECT_FIELD_CONSTRAINT)
 
+        # ...but not when a single element is out of range.
+        self.server.flush()
+        client = self.connect()
+        id = self.identify(client)
+
+        dg = Datagram.create([id], 1, CLIENTAGENT_DECLARE_OBJECT)
+        dg.add_doid(10000) # doid
+        dg.add_uint16(DistributedClientTestObject) # dclass
+        self.server.send(dg)
+
+        # Mitigate race condition with declare_object
+        time.sleep(0.1)
+
+        self.set_state(client, CLIENT_STATE_ESTABLISHED)
+
+        dg = Datagram()
+        dg.add_uint16(CLIENT_OBJECT_SET_FIELD)
+        dg.add_doid(10000)
+        dg.add_uint16(setPathConstraint)
+        for i in xrange(64):
+            dg.add_uint16(1001 if i == 61 else i)
+        client.send(dg)
+
+        self.assertDisconnect(client, CLIENT_DISCONNECT_FIELD_CONSTRAINT)
+
     def send_heartbeat(self, client):
         # Construct heartbeat datagram
         heartbeat_dg = Datagram()
@@ -66,6 +66,32 @@ class TestConfigCore(ConfigTest):
             """ % test_dc
         self.assertEquals(self.checkConfig(config), 'Valid')
 
+    def test_routing_threads(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+                threaded: true
+                threads: 4
+            """
+        self.assertEquals(self.checkConfig(config), 'Valid')
+
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+                threads: 0
+            """
+        self.assertEquals(self.checkConfig(config), 'Invalid')
+
+    def test_queue_stats(self):
+        config = """\
+            messagedirector:
+                bind: 127.0.0.1:57123
+                threads: 4
+                queue_limit: 1000
+                stats_interval: 60000
+            """
+        self.assertEquals(self.checkConfig(config), 'Valid')
+
     def test_roles_missing_type(self):
         config = """\
             messagedirector:
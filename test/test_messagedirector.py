@@ -1,5 +1,5 @@
 #!/usr/bin/env python2
-import unittest
+import unittest, time
 from socket import *
 
 from common.unittests import ProtocolTest
@@ -9,7 +9,10 @@ CONFIG = """\
 messagedirector:
     bind: 127.0.0.1:57123
     connect: 127.0.0.1:57124
-"""
+
+general:
+    io_threads: %d
+""" % IO_THREADS
 
 class TestMessageDirector(ProtocolTest):
     @classmethod
@@ -634,6 +637,101 @@ class TestMessageDirector(ProtocolTest):
         self.__class__.c2 = self.connectToServer()
         self.l1.flush()
 
+    def test_subscription_batch(self):
+        self.l1.flush()
+        self.c1.flush()
+        self.c2.flush()
+
+        # Subscribe to a pair of channels and a range in one datagram...
+        dg = Datagram.create_control()
+        dg.add_uint16(CONTROL_SUBSCRIPTION_BATCH)
+        dg.add_uint16(3)
+        dg.add_uint16(CONTROL_ADD_CHANNEL)
+        dg.add_channel(5005)
+        dg.add_uint16(CONTROL_ADD_RANGE)
+        dg.add_channel(6000)
+        dg.add_channel(6099)
+        dg.add_uint16(CONTROL_ADD_CHANNEL)
+        dg.add_channel(7007)
+        self.c1.send(dg)
+        self.expectNone(self.c1)
+        # The MD should subscribe to each of them upstream.
+        self.expectMany(self.l1, [Datagram.create_add_channel(5005),
+                                  Datagram.create_add_range(6000, 6099),
+                                  Datagram.create_add_channel(7007)])
+
+        # Everything in the batch should be delivered...
+        for channel in [5005, 6050, 7007]:
+            dg = Datagram.create([channel], 0, 1234)
+            dg.add_uint32(0xDEADBEEF)
+            self.l1.send(dg)
+            self.expect(self.c1, dg)
+
+        # ...until another batch removes it.
+        dg = Datagram.create_control()
+        dg.add_uint16(CONTROL_SUBSCRIPTION_BATCH)
+        dg.add_uint16(2)
+        dg.add_uint16(CONTROL_REMOVE_CHANNEL)
+        dg.add_channel(5005)
+        dg.add_uint16(CONTROL_REMOVE_RANGE)
+        dg.add_channel(6000)
+        dg.add_channel(6099)
+        self.c1.send(dg)
+        self.expectMany(self.l1, [Datagram.create_remove_channel(5005),
+                                  Datagram.create_remove_range(6000, 6099)])
+
+        for channel in [5005, 6050]:
+            dg = Datagram.create([channel], 0, 1234)
+            dg.add_uint32(0xDEADBEEF)
+            self.l1.send(dg)
+            self.expectNone(self.c1)
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer()
+        self.l1.flush()
+
+    def test_burst(self):
+        self.l1.flush()
+        self.c1.flush()
+
+        dg = Datagram.create_add_channel(8008)
+        self.c1.send(dg)
+        self.expect(self.l1, dg)
+
+        # Lots of datagrams arriving in a single read should all be delivered in order...
+        dgs = []
+        for i in range(200):
+            dg = Datagram.create([8008], 0, 1234)
+            dg.add_uint32(i)
+            dg.add_string('x' * (i % 50))
+            dgs.append(dg)
+        stream = Datagram()
+        for dg in dgs:
+            stream.add_blob(dg.get_data())
+        data = stream.get_data()
+        self.l1.s.sendall(data)
+        for dg in dgs:
+            self.expect(self.c1, dg)
+
+        # ...and so should ones which are split across reads, even in the length tag.
+        self.l1.s.sendall(data[:3])
+        time.sleep(0.05)
+        self.l1.s.sendall(data[3:len(data) - 5])
+        time.sleep(0.05)
+        self.l1.s.sendall(data[len(data) - 5:])
+        for dg in dgs:
+            self.expect(self.c1, dg)
+        self.expectNone(self.c1)
+
+        # Cleanup
+        dg = Datagram.create_remove_channel(8008)
+        self.c1.send(dg)
+        self.expect(self.l1, dg)
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer()
+        self.l1.flush()
+
     def test_malformed_control(self):
         dg = Datagram()
         dg.add_uint16(0) # Datagram length
@@ -671,5 +769,486 @@ class TestMessageDirector(ProtocolTest):
         self.__class__.c1 = self.connectToServer()
         self.l1.flush()
 
+CONTROL_WINDOW_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57125
+    connect: 127.0.0.1:57126
+    control_window: 300
+
+general:
+    io_threads: %d
+""" % IO_THREADS
+
+class TestControlWindow(ProtocolTest):
+    @classmethod
+    def setUpClass(cls):
+        listener = socket(AF_INET, SOCK_STREAM)
+        listener.setsockopt(SOL_SOCKET, SO_REUSEADDR, 1)
+        listener.setsockopt(SOL_TCP, TCP_NODELAY, 1)
+        listener.bind(('127.0.0.1', 57126))
+        listener.listen(1)
+        listener.settimeout(0.3)
+
+        cls.daemon = Daemon(CONTROL_WINDOW_CONFIG)
+        cls.daemon.start()
+
+        l, _ = listener.accept()
+        listener.close()
+        cls.l1 = MDConnection(l)
+
+        cls.c1 = cls.connectToServer(port = 57125)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.l1.close()
+        cls.c1.close()
+        cls.daemon.stop()
+
+    @staticmethod
+    def create_batch(changes):
+        dg = Datagram.create_control()
+        dg.add_uint16(CONTROL_SUBSCRIPTION_BATCH)
+        dg.add_uint16(len(changes))
+        for change in changes:
+            dg.add_uint16(change[0])
+            for channel in change[1:]:
+                dg.add_channel(channel)
+        return dg
+
+    def expectWindow(self, conn, expected):
+        # Nothing should go out until the control window closes...
+        self.expectNone(conn)
+        time.sleep(0.3)
+        # ...and then everything in it should go out at once.
+        if expected is None:
+            self.expectNone(conn)
+        else:
+            self.expect(conn, expected)
+            self.expectNone(conn)
+
+    def test_window_batch(self):
+        self.l1.flush()
+
+        # Changes made within the window go upstream together when it closes.
+        self.c1.send(Datagram.create_add_channel(1001))
+        self.c1.send(Datagram.create_add_channel(1002))
+        self.c1.send(Datagram.create_add_range(1100, 1199))
+        self.expectWindow(self.l1, self.create_batch([(CONTROL_ADD_CHANNEL, 1001),
+                                                      (CONTROL_ADD_CHANNEL, 1002),
+                                                      (CONTROL_ADD_RANGE, 1100, 1199)]))
+
+        # A lone change goes out as its usual control message.
+        self.c1.send(Datagram.create_remove_channel(1001))
+        self.expectWindow(self.l1, Datagram.create_remove_channel(1001))
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57125)
+        time.sleep(0.4)
+        self.l1.flush()
+
+    def test_window_cancel(self):
+        self.l1.flush()
+
+        # Adding a channel and removing it again within the window sends nothing for it...
+        self.c1.send(Datagram.create_add_channel(2001))
+        self.c1.send(Datagram.create_add_channel(2002))
+        self.c1.send(Datagram.create_remove_channel(2001))
+        self.expectWindow(self.l1, Datagram.create_add_channel(2002))
+
+        # ...and neither does the reverse.
+        self.c1.send(Datagram.create_remove_channel(2002))
+        self.c1.send(Datagram.create_add_channel(2002))
+        self.expectWindow(self.l1, None)
+
+        # The same goes for a range which is removed straight after being added.
+        self.c1.send(Datagram.create_add_range(2100, 2199))
+        self.c1.send(Datagram.create_remove_range(2100, 2199))
+        self.expectWindow(self.l1, None)
+
+        # The subscription to 2002 should have survived all of that.
+        dg = Datagram.create([2002], 0, 1234)
+        dg.add_uint32(0xDEADBEEF)
+        self.l1.send(dg)
+        self.expect(self.c1, dg)
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57125)
+        time.sleep(0.4)
+        self.l1.flush()
+
+    def test_window_range_barrier(self):
+        self.l1.flush()
+
+        # A range change in between stops a channel's changes from cancelling out.
+        self.c1.send(Datagram.create_add_channel(3001))
+        self.c1.send(Datagram.create_add_range(3100, 3199))
+        self.c1.send(Datagram.create_remove_channel(3001))
+        self.expectWindow(self.l1, self.create_batch([(CONTROL_ADD_CHANNEL, 3001),
+                                                      (CONTROL_ADD_RANGE, 3100, 3199),
+                                                      (CONTROL_REMOVE_CHANNEL, 3001)]))
+
+        # Likewise a range only cancels out the change just before it.
+        self.c1.send(Datagram.create_remove_range(3100, 3199))
+        self.c1.send(Datagram.create_add_channel(3002))
+        self.c1.send(Datagram.create_add_range(3100, 3199))
+        self.expectWindow(self.l1, self.create_batch([(CONTROL_REMOVE_RANGE, 3100, 3199),
+                                                      (CONTROL_ADD_CHANNEL, 3002),
+                                                      (CONTROL_ADD_RANGE, 3100, 3199)]))
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57125)
+        time.sleep(0.4)
+        self.l1.flush()
+
+    def test_window_flush_before_data(self):
+        self.l1.flush()
+
+        # A datagram going upstream takes the pending changes with it, ahead of itself.
+        self.c1.send(Datagram.create_add_channel(4001))
+        self.c1.send(Datagram.create_add_channel(4002))
+        dg = Datagram.create([4999], 4001, 1234)
+        dg.add_uint32(0xDEADBEEF)
+        self.c1.send(dg)
+        self.expect(self.l1, self.create_batch([(CONTROL_ADD_CHANNEL, 4001),
+                                                (CONTROL_ADD_CHANNEL, 4002)]))
+        self.expect(self.l1, dg)
+
+        # That closes the window, so nothing else follows.
+        time.sleep(0.3)
+        self.expectNone(self.l1)
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57125)
+        time.sleep(0.4)
+        self.l1.flush()
+
+    def test_window_cap(self):
+        self.l1.flush()
+
+        # A full batch goes out without waiting for the window to close...
+        self.c1.send(self.create_batch([(CONTROL_ADD_CHANNEL, 50000 + i) for i in xrange(2049)]))
+        self.expect(self.l1, self.create_batch([(CONTROL_ADD_CHANNEL, 50000 + i) for i in xrange(2048)]))
+        # ...and whatever is left over waits for the next one.
+        self.expectWindow(self.l1, Datagram.create_add_channel(50000 + 2048))
+
+        # Cleanup
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57125)
+        time.sleep(0.4)
+        self.l1.flush()
+
+UPSTREAM_GROUP_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:57127
+    upstreams:
+        - 127.0.0.1:57128
+        - 127.0.0.1:57129
+
+general:
+    io_threads: %d
+""" % IO_THREADS
+
+def upstream_owner(channel, live):
+    """Returns which of the live upstreams owns a channel, as MDUpstreamGroup picks it."""
+    mask = 0xFFFFFFFFFFFFFFFF
+    best, best_score = 0, 0
+    for i in live:
+        score = channel ^ ((0x9e3779b97f4a7c15 * (i + 1)) & mask)
+        score ^= score >> 33
+        score = (score * 0xff51afd7ed558ccd) & mask
+        score ^= score >> 33
+        score = (score * 0xc4ceb9fe1a85ec53) & mask
+        score ^= score >> 33
+        if score >= best_score:
+            best, best_score = i, score
+    return best
+
+class TestUpstreamGroup(ProtocolTest):
+    @classmethod
+    def listen(cls, port):
+        listener = socket(AF_INET, SOCK_STREAM)
+        listener.setsockopt(SOL_SOCKET, SO_REUSEADDR, 1)
+        listener.setsockopt(SOL_TCP, TCP_NODELAY, 1)
+        listener.bind(('127.0.0.1', port))
+        listener.listen(1)
+        return listener
+
+    @classmethod
+    def accept(cls, listener, timeout):
+        listener.settimeout(timeout)
+        l, _ = listener.accept()
+        return MDConnection(l)
+
+    @classmethod
+    def setUpClass(cls):
+        listener1 = cls.listen(57128)
+        # The second upstream's listener is kept open, for it to reconnect to.
+        cls.listener2 = cls.listen(57129)
+
+        cls.daemon = Daemon(UPSTREAM_GROUP_CONFIG)
+        cls.daemon.start()
+
+        cls.l1 = cls.accept(listener1, 0.3)
+        listener1.close()
+        cls.l2 = cls.accept(cls.listener2, 0.3)
+
+        cls.c1 = cls.connectToServer(port = 57127)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.l1.close()
+        cls.l2.close()
+        cls.listener2.close()
+        cls.c1.close()
+        cls.daemon.stop()
+
+    def owned_channels(self, first, owner, count, live = (0, 1)):
+        channels = []
+        channel = first
+        while len(channels) < count:
+            if upstream_owner(channel, live) == owner:
+                channels.append(channel)
+            channel += 1
+        return channels
+
+    def reconnect(self):
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57127)
+        time.sleep(0.1)
+        self.l1.flush()
+        self.l2.flush()
+
+    def test_group_subscriptions(self):
+        self.l1.flush()
+        self.l2.flush()
+
+        # Every upstream is told every subscription...
+        channels = range(10000, 10010)
+        upstreams = [self.l1, self.l2]
+        for channel in channels:
+            self.c1.send(Datagram.create_add_channel(channel))
+        for upstream in upstreams:
+            self.expectMany(upstream, [Datagram.create_add_channel(c) for c in channels])
+            self.expectNone(upstream)
+
+        # ...but a datagram goes to just the one which owns its recipient.
+        self.assertEqual(set(upstream_owner(c, (0, 1)) for c in channels), set([0, 1]))
+        for channel in channels:
+            dg = Datagram.create([channel], 5, 1234)
+            dg.add_uint32(channel)
+            self.c1.send(dg)
+            self.expect(upstreams[upstream_owner(channel, (0, 1))], dg)
+            self.expectNone(upstreams[1 - upstream_owner(channel, (0, 1))])
+
+        # Ranges go to every upstream too.
+        dg = Datagram.create_add_range(11000, 11999)
+        self.c1.send(dg)
+        self.expect(self.l1, dg)
+        self.expect(self.l2, dg)
+
+        for channel in channels:
+            self.c1.send(Datagram.create_remove_channel(channel))
+        for upstream in upstreams:
+            self.expectMany(upstream, [Datagram.create_remove_channel(c) for c in channels])
+            self.expectNone(upstream)
+
+        # Cleanup
+        self.reconnect()
+
+    def test_group_first_recipient(self):
+        self.l1.flush()
+        self.l2.flush()
+
+        a0, b0 = self.owned_channels(12000, 0, 2)
+        a1, = self.owned_channels(12000, 1, 1)
+
+        # A datagram for channels with different owners goes, whole, to the first one's owner...
+        dg = Datagram.create([a1, a0, b0], 5, 1234)
+        dg.add_string('Route me once!')
+        self.c1.send(dg)
+        self.expect(self.l2, dg)
+        self.expectNone(self.l1)
+
+        dg = Datagram.create([a0, a1], 5, 1234)
+        dg.add_string('Route me once!')
+        self.c1.send(dg)
+        self.expect(self.l1, dg)
+        self.expectNone(self.l2)
+
+    def test_group_post_remove(self):
+        self.l1.flush()
+        self.l2.flush()
+
+        a0, = self.owned_channels(13000, 0, 1)
+        a1, = self.owned_channels(13000, 1, 1)
+        sender = 171717
+        upstreams = [self.l1, self.l2]
+        holder = upstreams[upstream_owner(sender, (0, 1))]
+
+        # A post remove is held by its sender's owner alone...
+        dg_pr = Datagram.create([a1, a0], 0, 4321)
+        dg_pr.add_string('Testing...')
+        self.c1.send(Datagram.create_add_post_remove(sender, dg_pr))
+        self.expect(holder, Datagram.create_add_post_remove(sender, dg_pr))
+        self.expectNone(upstreams[1 - upstream_owner(sender, (0, 1))])
+
+        # ...while the datagram itself goes to its first recipient's owner when it's sent,
+        # and the clear goes to both.
+        self.c1.close()
+        self.__class__.c1 = self.connectToServer(port = 57127)
+        dg_clear = Datagram.create_clear_post_removes(sender)
+        self.expectMany(self.l2, [dg_pr, dg_clear])
+        self.expectMany(self.l1, [dg_clear])
+        self.expectNone(self.l1)
+        self.expectNone(self.l2)
+
+    def test_group_link_lost(self):
+        self.l1.flush()
+        self.l2.flush()
+
+        a0, = self.owned_channels(14000, 0, 1)
+        a1, = self.owned_channels(14000, 1, 1)
+        sender, = self.owned_channels(181818, 1, 1)
+
+        # Subscribe to a channel owned by each upstream and a range, and hang a post remove
+        # on the second upstream.
+        self.c1.send(Datagram.create_add_channel(a0))
+        self.c1.send(Datagram.create_add_channel(a1))
+        self.c1.send(Datagram.create_add_range(15000, 15099))
+        dg_pr = Datagram.create([a0, a1], 0, 4321)
+        dg_pr.add_string('Testing...')
+        self.c1.send(Datagram.create_add_post_remove(sender, dg_pr))
+        subscriptions = [Datagram.create_add_channel(a0),
+                         Datagram.create_add_channel(a1),
+                         Datagram.create_add_range(15000, 15099)]
+        self.expectMany(self.l1, subscriptions)
+        self.expectMany(self.l2, subscriptions + [Datagram.create_add_post_remove(sender, dg_pr)])
+
+        # Lose the second upstream; the first already has the subscriptions, so only the
+        # post remove moves to it...
+        self.l2.close()
+        self.expect(self.l1, Datagram.create_add_post_remove(sender, dg_pr))
+        self.expectNone(self.l1)
+
+        # ...and it routes what the second one owned.
+        dg = Datagram.create([a1], 5, 1234)
+        dg.add_uint32(0xDEADBEEF)
+        self.c1.send(dg)
+        self.expect(self.l1, dg)
+
+        # Once it reconnects, it's subscribed to everything and gets its share back.
+        self.__class__.l2 = self.accept(self.listener2, 10.0)
+        self.expect(self.l1, Datagram.create_clear_post_removes(sender))
+        self.expectMany(self.l2, subscriptions + [Datagram.create_add_post_remove(sender, dg_pr)])
+        self.expectNone(self.l1)
+        self.expectNone(self.l2)
+
+        self.c1.send(dg)
+        self.expect(self.l2, dg)
+        self.expectNone(self.l1)
+
+        # Cleanup
+        self.reconnect()
+
+ROOT_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:%d
+
+general:
+    io_threads: %d
+"""
+
+GROUP_MEMBER_CONFIG = """\
+messagedirector:
+    bind: 127.0.0.1:%d
+    upstreams:
+        - 127.0.0.1:57130
+        - 127.0.0.1:57131
+
+general:
+    io_threads: %d
+"""
+
+class TestUpstreamGroupDelivery(ProtocolTest):
+    """Two MDs sharing two real roots, to check what their participants actually receive."""
+
+    @classmethod
+    def setUpClass(cls):
+        cls.roots = [Daemon(ROOT_CONFIG % (57130, IO_THREADS)),
+                     Daemon(ROOT_CONFIG % (57131, IO_THREADS))]
+        for root in cls.roots:
+            root.start()
+        cls.members = [Daemon(GROUP_MEMBER_CONFIG % (57132, IO_THREADS)),
+                       Daemon(GROUP_MEMBER_CONFIG % (57133, IO_THREADS))]
+        for member in cls.members:
+            member.start()
+
+        cls.receiver = cls.connectToServer(port = 57132)
+        cls.sender = cls.connectToServer(port = 57133)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.receiver.close()
+        cls.sender.close()
+        for daemon in cls.members + cls.roots:
+            daemon.stop()
+
+    def owned_channels(self, first, owner, count):
+        channels = []
+        channel = first
+        while len(channels) < count:
+            if upstream_owner(channel, (0, 1)) == owner:
+                channels.append(channel)
+            channel += 1
+        return channels
+
+    def test_group_delivery(self):
+        self.receiver.flush()
+
+        a0, = self.owned_channels(16000, 0, 1)
+        a1, = self.owned_channels(16000, 1, 1)
+
+        # A participant subscribed to channels which different roots route for...
+        self.receiver.send(Datagram.create_add_channel(a0))
+        self.receiver.send(Datagram.create_add_channel(a1))
+        time.sleep(0.2)
+
+        # ...gets a datagram addressed to both of them just once, whichever root routes it.
+        for channels in ([a0, a1], [a1, a0]):
+            dg = Datagram.create(channels, 5, 1234)
+            dg.add_string('Just once!')
+            self.sender.send(dg)
+            self.expect(self.receiver, dg)
+            self.expectNone(self.receiver)
+
+        # Cleanup
+        self.receiver.send(Datagram.create_remove_channel(a0))
+        self.receiver.send(Datagram.create_remove_channel(a1))
+        time.sleep(0.2)
+
+    def test_group_root_lost(self):
+        self.receiver.flush()
+
+        a1, = self.owned_channels(17000, 1, 1)
+        self.receiver.send(Datagram.create_add_channel(a1))
+        time.sleep(0.2)
+
+        # Once the second root is gone, its share is routed by the first.
+        self.roots.pop(1).stop()
+        time.sleep(0.2)
+        dg = Datagram.create([a1], 5, 1234)
+        dg.add_string('Still here!')
+        self.sender.send(dg)
+        self.expect(self.receiver, dg)
+        self.expectNone(self.receiver)
+
+        # Cleanup
+        self.receiver.send(Datagram.create_remove_channel(a1))
+        time.sleep(0.2)
+
 if __name__ == '__main__':
     unittest.main()
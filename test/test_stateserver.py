@@ -1354,6 +1354,44 @@ class TestStateServer(ProtocolTest):
         self.expect(conn, dg)
 
 
+        ### Test for GetFields with fewer field ids than its count ### (continues from previous)
+        dg = Datagram.create([15000], 890, STATESERVER_OBJECT_GET_FIELDS)
+        dg.add_uint32(0x3DDA200A) # Context
+        dg.add_doid(15000) # ID
+        dg.add_uint16(3) # Field count
+        dg.add_uint16(setRequired1)
+        dg.add_uint16(setBR1)
+        conn.send(dg)
+
+        # The truncated request is dropped
+        self.expectNone(conn)
+
+        # A count whose field ids would take 65536 bytes mustn't wrap around to an empty list:
+        dg = Datagram.create([15000], 890, STATESERVER_OBJECT_GET_FIELDS)
+        dg.add_uint32(0x2CC91FF9) # Context
+        dg.add_doid(15000) # ID
+        dg.add_uint16(0x8000) # Field count
+        dg.add_uint16(setRequired1)
+        conn.send(dg)
+        self.expectNone(conn)
+
+        # The object still answers afterwards
+        dg = Datagram.create([15000], 890, STATESERVER_OBJECT_GET_FIELDS)
+        dg.add_uint32(0x1BB80EE8) # Context
+        dg.add_doid(15000) # ID
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRequired1)
+        conn.send(dg)
+
+        dg = Datagram.create([890], 15000, STATESERVER_OBJECT_GET_FIELDS_RESP)
+        dg.add_uint32(0x1BB80EE8) # Context
+        dg.add_uint8(SUCCESS)
+        dg.add_uint16(1) # Field count
+        dg.add_uint16(setRequired1)
+        dg.add_uint32(0)
+        self.expect(conn, dg)
+
+
         ### Cleanup ###
         deleteObject(conn, 5, 15000)
         self.disconnect(conn)